@@ -51,16 +51,27 @@ class MainActivity : AppCompatActivity() {
     private var servicesDiscovered = false
     private var bluetoothGatt: BluetoothGatt? = null
 
+    // --- WAVEFORM STREAM ---
+    private val REQUESTED_MTU = 247     // Larger notifications carry more waveform samples
+    private var waveformSeq = -1        // Last packet sequence, -1 = none yet
+    private var waveformLost = 0
+
     // --- CHARACTERISTICS ---
     private var controlChar: BluetoothGattCharacteristic? = null
-    private var notifyChar: BluetoothGattCharacteristic? = null
+    private var healthChar: BluetoothGattCharacteristic? = null
+    private var waveformChar: BluetoothGattCharacteristic? = null
+    private var statusChar: BluetoothGattCharacteristic? = null
+    private val pendingCccdWrites = mutableListOf<BluetoothGattDescriptor>()
 
     private val deviceName = "Massage_Pro_X1"  // FIXED: Match ESP32 exactly
 
     // FIXED: Match ESP32 UUIDs exactly
     private val SERVICE_UUID = UUID.fromString("12345678-1234-5678-1234-56789ABCDEF0")
     private val CONTROL_CHAR_UUID = UUID.fromString("ABCDEF01-1234-5678-1234-56789ABCDEF0")
-    private val NOTIFY_CHAR_UUID = UUID.fromString("ABCDEF02-1234-5678-1234-56789ABCDEF0")
+    // One characteristic per stream; health keeps the old single notify UUID
+    private val HEALTH_CHAR_UUID = UUID.fromString("ABCDEF02-1234-5678-1234-56789ABCDEF0")
+    private val WAVEFORM_CHAR_UUID = UUID.fromString("ABCDEF03-1234-5678-1234-56789ABCDEF0")
+    private val STATUS_CHAR_UUID = UUID.fromString("ABCDEF04-1234-5678-1234-56789ABCDEF0")
 
     // Standard CCCD UUID (DO NOT CHANGE)
     private val CCCD_UUID = UUID.fromString("00002902-0000-1000-8000-00805f9b34fb")
@@ -211,8 +222,13 @@ class MainActivity : AppCompatActivity() {
                         BluetoothProfile.STATE_CONNECTED -> {
                             showToast("Connected - Discovering services...")
                             isConnected = true
+                            waveformSeq = -1
                             updateUI()
-                            gatt.discoverServices()
+                            // Larger MTU first: waveform batches are sized to it.
+                            // Discovery follows in onMtuChanged
+                            if (!gatt.requestMtu(REQUESTED_MTU)) {
+                                gatt.discoverServices()
+                            }
                         }
                         BluetoothProfile.STATE_DISCONNECTED -> {
                             showToast("Disconnected")
@@ -224,6 +240,11 @@ class MainActivity : AppCompatActivity() {
                 }
             }
 
+            override fun onMtuChanged(gatt: BluetoothGatt, mtu: Int, status: Int) {
+                Log.d("BLE", "MTU $mtu (status $status)")
+                gatt.discoverServices()
+            }
+
             override fun onServicesDiscovered(gatt: BluetoothGatt, status: Int) {
                 runOnUiThread {
                     if (status == BluetoothGatt.GATT_SUCCESS) {
@@ -240,9 +261,12 @@ class MainActivity : AppCompatActivity() {
 
                         // Find characteristics
                         controlChar = service.getCharacteristic(CONTROL_CHAR_UUID)
-                        notifyChar = service.getCharacteristic(NOTIFY_CHAR_UUID)
+                        healthChar = service.getCharacteristic(HEALTH_CHAR_UUID)
+                        // Absent on firmware that sent every stream on the health characteristic
+                        waveformChar = service.getCharacteristic(WAVEFORM_CHAR_UUID)
+                        statusChar = service.getCharacteristic(STATUS_CHAR_UUID)
 
-                        if (controlChar != null && notifyChar != null) {
+                        if (controlChar != null && healthChar != null) {
                             servicesDiscovered = true
                             showToast("Ready!")
                             updateUI()
@@ -250,7 +274,7 @@ class MainActivity : AppCompatActivity() {
                             enableNotifications(gatt)
                         } else {
                             showToast("Characteristics not found. Check ESP32 UUIDs.")
-                            Log.e("BLE", "Control: $controlChar, Notify: $notifyChar")
+                            Log.e("BLE", "Control: $controlChar, Health: $healthChar")
                         }
                     } else {
                         showToast("Service discovery failed: $status")
@@ -258,12 +282,25 @@ class MainActivity : AppCompatActivity() {
                 }
             }
 
+            // The CCCDs are written one at a time: the next goes out when this one is done
+            override fun onDescriptorWrite(
+                gatt: BluetoothGatt,
+                descriptor: BluetoothGattDescriptor,
+                status: Int
+            ) {
+                Log.d("BLE", "CCCD of ${descriptor.characteristic.uuid}: status $status")
+                runOnUiThread { writeNextCccd(gatt) }
+            }
+
             // FIXED: Handle notification data from ESP32
+            // The packet type byte still tells the formats apart on every characteristic
             override fun onCharacteristicChanged(
                 gatt: BluetoothGatt,
                 characteristic: BluetoothGattCharacteristic
             ) {
-                if (characteristic.uuid == NOTIFY_CHAR_UUID) {
+                if (characteristic.uuid == HEALTH_CHAR_UUID ||
+                    characteristic.uuid == WAVEFORM_CHAR_UUID ||
+                    characteristic.uuid == STATUS_CHAR_UUID) {
                     val data = characteristic.value
                     if (data == null || data.isEmpty()) return
 
@@ -271,55 +308,191 @@ class MainActivity : AppCompatActivity() {
 
                     when (packetType) {
                         0xF1 -> {
-                            // Health data: [0xF1][HR][SpO2]
+                            // Health data: [0xF1][HR][SpO2][Quality][Flags]
+                            // Quality and flags are absent on older firmware
                             if (data.size >= 3) {
                                 val heartRate = data[1].toInt() and 0xFF
                                 val spo2 = data[2].toInt() and 0xFF
+                                val quality = if (data.size >= 4) data[3].toInt() and 0xFF else -1
+                                val motion = data.size >= 5 && (data[4].toInt() and 0x01) != 0
 
                                 runOnUiThread {
-                                    txtHeartRate.text = if (heartRate > 0) "$heartRate BPM" else "-- BPM"
+                                    txtHeartRate.text = when {
+                                        heartRate > 0 -> "$heartRate BPM"
+                                        motion -> "Hold still"
+                                        else -> "-- BPM"
+                                    }
                                     txtSpO2.text = if (spo2 > 0) "$spo2 %" else "-- %"
                                 }
+                                if (quality >= 0) {
+                                    Log.d("Health", "HR=$heartRate SpO2=$spo2 quality=$quality motion=$motion")
+                                }
                             }
                         }
 
-                        0xF2 -> {
-                            // Waveform data: [0xF2][IR_HIGH][IR_MID][IR_LOW]
-                            if (data.size >= 4) {
-                                val irValue = ((data[1].toInt() and 0xFF) shl 16) or
-                                        ((data[2].toInt() and 0xFF) shl 8) or
-                                        (data[3].toInt() and 0xFF)
+                        0xF4 -> {
+                            // Waveform batch: [0xF4][SEQ (2)][T_US (4)][N] + N x [IR (3)]
+                            if (data.size >= 8) {
+                                val seq = ((data[1].toInt() and 0xFF) shl 8) or
+                                        (data[2].toInt() and 0xFF)
+                                val count = data[7].toInt() and 0xFF
+                                if (data.size < 8 + count * 3) return
+
+                                trackWaveformSeq(seq)
+
+                                val samples = FloatArray(count) { i ->
+                                    val o = 8 + i * 3
+                                    (((data[o].toInt() and 0xFF) shl 16) or
+                                            ((data[o + 1].toInt() and 0xFF) shl 8) or
+                                            (data[o + 2].toInt() and 0xFF)).toFloat()
+                                }
+                                runOnUiThread {
+                                    samples.forEach { waveformView.addDataPoint(it) }
+                                }
+                            }
+                        }
 
+                        0xF5 -> {
+                            // Packed waveform batch: [0xF5][SEQ (2)][T_US (4)][N] + packed IR
+                            if (data.size >= 8) {
+                                val seq = ((data[1].toInt() and 0xFF) shl 8) or
+                                        (data[2].toInt() and 0xFF)
+                                val count = data[7].toInt() and 0xFF
+                                val samples = decodeWavepack(data, 8, count) ?: return
+
+                                trackWaveformSeq(seq)
                                 runOnUiThread {
-                                    waveformView.addDataPoint(irValue.toFloat())
+                                    samples.forEach { waveformView.addDataPoint(it) }
                                 }
                             }
                         }
+
+                        0xF3 -> {
+                            // HRV: [0xF3][RMSSD x10 (2)][SDNN x10 (2)][pNN50][N (2)]
+                            if (data.size >= 8) {
+                                val rmssd = (((data[1].toInt() and 0xFF) shl 8) or
+                                        (data[2].toInt() and 0xFF)) / 10f
+                                val sdnn = (((data[3].toInt() and 0xFF) shl 8) or
+                                        (data[4].toInt() and 0xFF)) / 10f
+                                val pnn50 = data[5].toInt() and 0xFF
+                                val beats = ((data[6].toInt() and 0xFF) shl 8) or
+                                        (data[7].toInt() and 0xFF)
+
+                                Log.d("HRV", "RMSSD=$rmssd ms SDNN=$sdnn ms pNN50=$pnn50% ($beats beats)")
+                            }
+                        }
+
+                        0xF6 -> {
+                            // Status: [0xF6][LEVEL][FLAGS], bit 0 reverse, 1 heat, 2 assistant, 3 recording
+                            if (data.size >= 3) {
+                                val level = data[1].toInt() and 0xFF
+                                val flags = data[2].toInt() and 0xFF
+
+                                runOnUiThread { txtLevel.text = "Level: $level" }
+                                Log.d("Status", "level=$level reverse=${flags and 0x01 != 0} " +
+                                        "heat=${flags and 0x02 != 0} assistant=${flags and 0x04 != 0} " +
+                                        "recording=${flags and 0x08 != 0}")
+                            }
+                        }
                     }
                 }
             }
         })
     }
 
+    private fun trackWaveformSeq(seq: Int) {
+        if (waveformSeq >= 0) {
+            val missed = (seq - waveformSeq - 1) and 0xFFFF
+            if (missed > 0) {
+                waveformLost += missed
+                Log.w("Waveform", "$missed packets lost ($waveformLost total)")
+            }
+        }
+        waveformSeq = seq
+    }
+
+    // Mirrors ppg_wavepack_decode: 24-bit key, then groups of 8 zig-zag
+    // residuals behind a header byte (bits 0-4 width, bits 5-6 low bits
+    // dropped, bit 7 linear predictor)
+    private fun decodeWavepack(data: ByteArray, offset: Int, count: Int): FloatArray? {
+        if (count == 0) return FloatArray(0)
+        if (data.size < offset + 3) return null
+
+        var p = offset
+        var last = ((data[p].toInt() and 0xFF) shl 16) or
+                ((data[p + 1].toInt() and 0xFF) shl 8) or
+                (data[p + 2].toInt() and 0xFF)
+        var last2 = last
+        p += 3
+        val samples = FloatArray(count)
+        samples[0] = last.toFloat()
+
+        var n = 1
+        while (n < count) {
+            if (p >= data.size) return null
+            val header = data[p++].toInt() and 0xFF
+            val width = header and 0x1F
+            val drop = (header and 0x60) shr 5
+            val linear = (header and 0x80) != 0
+            val group = minOf(count - n, 8)
+            if (width > 26 || data.size - p < (group * width + 7) / 8) return null
+
+            var acc = 0L
+            var bits = 0
+            repeat(group) {
+                while (bits < width) {
+                    acc = (acc shl 8) or (data[p++].toLong() and 0xFF)
+                    bits += 8
+                }
+                bits -= width
+                val zz = ((acc ushr bits) and ((1L shl width) - 1)).toInt()
+                var sample = last + (((zz ushr 1) xor -(zz and 1)) shl drop)
+                if (linear) sample += last - last2
+                last2 = last
+                last = sample
+                samples[n++] = sample.toFloat()
+            }
+        }
+        return samples
+    }
+
     @SuppressLint("MissingPermission")
     private fun enableNotifications(gatt: BluetoothGatt) {
-        if (notifyChar == null || !hasBlePermissions()) return
-
-        // 1. Enable notifications locally
-        val success = gatt.setCharacteristicNotification(notifyChar, true)
-        Log.d("BLE", "setCharacteristicNotification: $success")
-
-        // 2. Write to CCCD
-        val descriptor = notifyChar?.getDescriptor(CCCD_UUID)
-        if (descriptor != null) {
-            descriptor.value = BluetoothGattDescriptor.ENABLE_NOTIFICATION_VALUE
-            val writeSuccess = gatt.writeDescriptor(descriptor)
-            Log.d("BLE", "writeDescriptor: $writeSuccess")
-            showToast("Notifications enabled")
-        } else {
+        if (healthChar == null || !hasBlePermissions()) return
+
+        // Subscribe to each stream this screen renders; Android allows one
+        // GATT operation at a time, so the CCCD writes are queued
+        pendingCccdWrites.clear()
+        listOfNotNull(healthChar, waveformChar, statusChar).forEach { char ->
+            // 1. Enable notifications locally
+            val success = gatt.setCharacteristicNotification(char, true)
+            Log.d("BLE", "setCharacteristicNotification ${char.uuid}: $success")
+
+            // 2. Queue the CCCD write
+            val descriptor = char.getDescriptor(CCCD_UUID)
+            if (descriptor != null) {
+                pendingCccdWrites.add(descriptor)
+            } else {
+                Log.e("BLE", "CCCD descriptor not found on ${char.uuid}")
+            }
+        }
+
+        if (pendingCccdWrites.isEmpty()) {
             showToast("CCCD not found!")
-            Log.e("BLE", "CCCD descriptor not found")
+            return
         }
+        writeNextCccd(gatt)
+        showToast("Notifications enabled")
+    }
+
+    @SuppressLint("MissingPermission")
+    private fun writeNextCccd(gatt: BluetoothGatt) {
+        if (!hasBlePermissions()) return
+        val descriptor = pendingCccdWrites.removeFirstOrNull() ?: return
+
+        descriptor.value = BluetoothGattDescriptor.ENABLE_NOTIFICATION_VALUE
+        val writeSuccess = gatt.writeDescriptor(descriptor)
+        Log.d("BLE", "writeDescriptor ${descriptor.characteristic.uuid}: $writeSuccess")
     }
 
     // --- Send packets ---
@@ -369,7 +542,10 @@ class MainActivity : AppCompatActivity() {
         isConnected = false
         servicesDiscovered = false
         controlChar = null
-        notifyChar = null
+        healthChar = null
+        waveformChar = null
+        statusChar = null
+        pendingCccdWrites.clear()
         updateUI()
         showToast("Disconnected")
     }
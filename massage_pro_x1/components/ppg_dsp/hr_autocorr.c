@@ -0,0 +1,104 @@
+/*
+ * Autocorrelation Heart Rate Module
+ * Sliding-window, hop-based period estimate for the PPG signal
+ */
+
+#include "hr_autocorr.h"
+#include <string.h>
+
+#define RING_MASK       (HR_AC_RING - 1)
+#define SAMPLE_LIMIT    (1 << 20)   // Keeps each product under 2^40
+
+static uint8_t estimate_bpm(const hr_autocorr_t *hr) {
+    if (hr->r[0] <= 0) {
+        return 0;
+    }
+
+    // Highest correlation in the heart-rate lag range
+    int best = 0;
+    for (int k = HR_AC_MIN_LAG; k <= HR_AC_MAX_LAG; k++) {
+        if (best == 0 || hr->r[k] > hr->r[best]) {
+            best = k;
+        }
+    }
+
+    // Multiples of the period correlate almost as well as the period itself;
+    // take the shortest lag whose local peak is close to the best one
+    for (int k = HR_AC_MIN_LAG + 1; k < best; k++) {
+        if (hr->r[k] > hr->r[k - 1] && hr->r[k] >= hr->r[k + 1] &&
+            hr->r[k] * 10 > hr->r[best] * 8) {
+            best = k;
+            break;
+        }
+    }
+
+    if ((float)hr->r[best] < HR_AC_MIN_CORR * (float)hr->r[0]) {
+        return 0;
+    }
+
+    // Parabolic interpolation around the peak for sub-lag resolution
+    float lag = (float)best;
+    if (best > HR_AC_MIN_LAG && best < HR_AC_MAX_LAG) {
+        float ym = (float)hr->r[best - 1];
+        float y0 = (float)hr->r[best];
+        float yp = (float)hr->r[best + 1];
+        float denom = ym - 2 * y0 + yp;
+        if (denom < 0) {
+            lag += 0.5f * (ym - yp) / denom;
+        }
+    }
+
+    float bpm = 60.0f * HR_AC_RATE / lag;
+    if (bpm < 40.0f || bpm > 200.0f) {
+        return 0;
+    }
+    return (uint8_t)(bpm + 0.5f);
+}
+
+void hr_autocorr_reset(hr_autocorr_t *hr) {
+    memset(hr, 0, sizeof(*hr));
+}
+
+bool hr_autocorr_push(hr_autocorr_t *hr, int32_t sample) {
+    if (sample > SAMPLE_LIMIT) sample = SAMPLE_LIMIT;
+    if (sample < -SAMPLE_LIMIT) sample = -SAMPLE_LIMIT;
+
+    // Average HR_AC_DECIM inputs into one analysis sample
+    hr->decim_acc += sample;
+    if (++hr->decim_count < HR_AC_DECIM) {
+        return false;
+    }
+    int32_t x = hr->decim_acc / HR_AC_DECIM;
+    hr->decim_acc = 0;
+    hr->decim_count = 0;
+
+    uint32_t n = hr->seq;
+    hr->x[n & RING_MASK] = x;
+
+    // Add products ending at the new sample...
+    for (int k = 0; k <= HR_AC_MAX_LAG + 1; k++) {
+        if (n >= (uint32_t)k) {
+            hr->r[k] += (int64_t)x * hr->x[(n - k) & RING_MASK];
+        }
+    }
+
+    // ...and remove the ones ending at the sample leaving the window
+    if (n >= HR_AC_WINDOW) {
+        uint32_t old = n - HR_AC_WINDOW;
+        int32_t xo = hr->x[old & RING_MASK];
+        for (int k = 0; k <= HR_AC_MAX_LAG + 1; k++) {
+            if (old >= (uint32_t)k) {
+                hr->r[k] -= (int64_t)xo * hr->x[(old - k) & RING_MASK];
+            }
+        }
+    }
+
+    hr->seq = n + 1;
+
+    if (hr->seq < HR_AC_WINDOW || ++hr->hop_count < HR_AC_HOP) {
+        return false;
+    }
+    hr->hop_count = 0;
+    hr->bpm = estimate_bpm(hr);
+    return true;
+}
@@ -0,0 +1,125 @@
+/*
+ * HRV Module
+ * Incremental RMSSD, SDNN and pNN50 over a ring of RR intervals
+ */
+
+#include "hrv.h"
+#include <math.h>
+#include <string.h>
+
+#define DIFF_NONE   INT16_MIN
+
+static bool hrv_outlier(hrv_t *h, uint32_t rr_ms) {
+    if (rr_ms < HRV_RR_MIN_MS || rr_ms > HRV_RR_MAX_MS) {
+        return true;
+    }
+    if (h->reference_ms == 0) {
+        // Nothing to check the first interval against: it only seeds the
+        // reference (the first beats after placement are often settling)
+        h->reference_ms = (uint16_t)rr_ms;
+        return true;
+    }
+
+    uint32_t limit = (uint32_t)h->reference_ms * HRV_OUTLIER_PCT / 100;
+    uint32_t dev = (rr_ms > h->reference_ms) ? rr_ms - h->reference_ms : h->reference_ms - rr_ms;
+    return dev > limit;
+}
+
+static void hrv_add_diff(hrv_t *h, int32_t diff, int sign) {
+    uint32_t sq = (uint32_t)(diff * diff);
+
+    if (sign > 0) {
+        h->diff_sq += sq;
+        h->diffs++;
+        h->nn50 += (diff > HRV_NN50_MS || diff < -HRV_NN50_MS);
+    } else {
+        h->diff_sq -= sq;
+        h->diffs--;
+        h->nn50 -= (diff > HRV_NN50_MS || diff < -HRV_NN50_MS);
+    }
+}
+
+// Drop the oldest interval (which never holds a diff); its successor
+// loses the difference against it
+static void hrv_evict(hrv_t *h) {
+    uint32_t rr = h->rr[h->head & HRV_RR_MASK];
+
+    h->sum -= rr;
+    h->sum_sq -= (uint64_t)rr * rr;
+    h->head++;
+    h->count--;
+
+    if (h->count > 0 && h->diff[h->head & HRV_RR_MASK] != DIFF_NONE) {
+        hrv_add_diff(h, h->diff[h->head & HRV_RR_MASK], -1);
+        h->diff[h->head & HRV_RR_MASK] = DIFF_NONE;
+    }
+}
+
+void hrv_init(hrv_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void hrv_break(hrv_t *h) {
+    h->chained = false;
+}
+
+bool hrv_push(hrv_t *h, uint32_t rr_ms) {
+    if (hrv_outlier(h, rr_ms)) {
+        h->rejected++;
+        h->chained = false;
+
+        // A sustained change in rate is real: re-learn from the latest interval
+        if (++h->reject_run >= HRV_RELEARN_REJECTS) {
+            h->reference_ms = (rr_ms >= HRV_RR_MIN_MS && rr_ms <= HRV_RR_MAX_MS) ? rr_ms : 0;
+            h->reject_run = 0;
+        }
+        return false;
+    }
+
+    if (h->count == HRV_RR_CAPACITY) {
+        hrv_evict(h);
+    }
+
+    uint32_t slot = (h->head + h->count) & HRV_RR_MASK;
+    int16_t diff = DIFF_NONE;
+    if (h->chained && h->count > 0) {
+        uint32_t prev = h->rr[(h->head + h->count - 1) & HRV_RR_MASK];
+        diff = (int16_t)((int32_t)rr_ms - (int32_t)prev);
+        hrv_add_diff(h, diff, 1);
+    }
+
+    h->rr[slot] = (uint16_t)rr_ms;
+    h->diff[slot] = diff;
+    h->count++;
+    h->sum += rr_ms;
+    h->sum_sq += (uint64_t)rr_ms * rr_ms;
+
+    // Reference tracks slow drift: 1/8 step towards each accepted interval
+    h->reference_ms = (uint16_t)(h->reference_ms + ((int32_t)rr_ms - h->reference_ms) / 8);
+    h->accepted++;
+    h->reject_run = 0;
+    h->chained = true;
+    return true;
+}
+
+void hrv_get(const hrv_t *h, hrv_metrics_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->intervals = (uint16_t)h->count;
+    out->accepted = h->accepted;
+    out->rejected = h->rejected;
+
+    if (h->count < HRV_MIN_INTERVALS) {
+        return;
+    }
+
+    double n = h->count;
+    double mean = h->sum / n;
+    double var = (h->sum_sq - h->sum * mean) / (n - 1);
+
+    out->mean_rr_ms = (uint16_t)lround(mean);
+    out->sdnn_ms = (var > 0) ? (float)sqrt(var) : 0.0f;
+    if (h->diffs > 0) {
+        out->rmssd_ms = (float)sqrt((double)h->diff_sq / h->diffs);
+        out->pnn50 = 100.0f * h->nn50 / h->diffs;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef HR_AUTOCORR_H
+#define HR_AUTOCORR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Analysis runs at sample rate / HR_AC_DECIM
+#define HR_AC_DECIM         2
+#define HR_AC_RATE          50                          // Hz after decimation
+#define HR_AC_WINDOW        (4 * HR_AC_RATE)            // 4s correlation window
+#define HR_AC_HOP           (HR_AC_RATE / 2)            // New estimate every 0.5s
+#define HR_AC_MIN_LAG       (60 * HR_AC_RATE / 200)     // 200 BPM
+#define HR_AC_MAX_LAG       (60 * HR_AC_RATE / 40)      // 40 BPM
+#define HR_AC_RING          512                         // >= WINDOW + MAX_LAG, power of two
+#define HR_AC_MIN_CORR      0.3f                        // Normalized peak needed for a reading
+
+/**
+ * @brief Autocorrelation heart-rate estimator
+ *
+ * Keeps R[k] = sum x[n]*x[n-k] over the window for every candidate lag.
+ * Each decimated sample adds the newest products and removes the oldest
+ * ones, so an update is O(lags) and the window is never recomputed. Sums
+ * are integer, so there is no drift from repeated add/subtract.
+ */
+typedef struct {
+    int32_t x[HR_AC_RING];
+    int64_t r[HR_AC_MAX_LAG + 2];   // r[0] is the window energy
+    uint32_t seq;                   // Decimated samples pushed
+    int32_t decim_acc;
+    int decim_count;
+    int hop_count;
+    uint8_t bpm;                    // Latest estimate, 0 if none
+} hr_autocorr_t;
+
+/**
+ * @brief Clear the estimator
+ *
+ * @param hr Estimator state
+ */
+void hr_autocorr_reset(hr_autocorr_t *hr);
+
+/**
+ * @brief Feed one band-passed sample at HR_AC_RATE * HR_AC_DECIM
+ *
+ * @param hr Estimator state
+ * @param sample Band-passed PPG sample
+ * @return true A new estimate was produced on this sample
+ */
+bool hr_autocorr_push(hr_autocorr_t *hr, int32_t sample);
+
+/**
+ * @brief Latest heart rate estimate
+ *
+ * @param hr Estimator state
+ * @return uint8_t BPM, 0 until the window is full or if no clear period
+ */
+static inline uint8_t hr_autocorr_bpm(const hr_autocorr_t *hr) {
+    return hr->bpm;
+}
+
+#endif // HR_AUTOCORR_H
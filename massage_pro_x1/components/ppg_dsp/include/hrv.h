@@ -0,0 +1,87 @@
+#ifndef HRV_H
+#define HRV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// RR ring, must be a power of two; 512 beats is ~8.5 min at 60 BPM
+#define HRV_RR_CAPACITY         512
+#define HRV_RR_MASK             (HRV_RR_CAPACITY - 1)
+#define HRV_RR_MIN_MS           300     // 200 BPM
+#define HRV_RR_MAX_MS           2000    // 30 BPM
+#define HRV_OUTLIER_PCT         20      // Max deviation from the reference interval
+#define HRV_RELEARN_REJECTS     4       // Consecutive rejects before the reference follows
+#define HRV_NN50_MS             50
+#define HRV_MIN_INTERVALS       8       // Metrics are reported from here on
+
+/**
+ * @brief HRV metrics over the intervals held in the ring
+ */
+typedef struct {
+    uint16_t intervals;         // Accepted RR intervals in the window
+    uint16_t mean_rr_ms;
+    float sdnn_ms;
+    float rmssd_ms;
+    float pnn50;                // Percent of successive differences > HRV_NN50_MS
+    uint32_t accepted;          // Intervals accepted since init
+    uint32_t rejected;          // Intervals dropped as outliers since init
+} hrv_metrics_t;
+
+/**
+ * @brief RR-interval ring with running accumulators
+ *
+ * Every accepted interval adds to, and every evicted interval subtracts
+ * from, integer sums of RR, RR^2 and the successive differences, so the
+ * metrics are O(1) and exact no matter how long the stream runs. An
+ * interval only forms a successive difference with an accepted interval
+ * directly before it; rejects and signal gaps break the chain.
+ */
+typedef struct {
+    uint16_t rr[HRV_RR_CAPACITY];           // ms
+    int16_t diff[HRV_RR_CAPACITY];          // rr - previous rr, INT16_MIN = no predecessor
+    uint32_t head;                          // Free-running index of the oldest interval
+    uint32_t count;
+
+    uint64_t sum;                           // Sum of rr
+    uint64_t sum_sq;                        // Sum of rr^2
+    uint64_t diff_sq;                       // Sum of diff^2 over valid diffs
+    uint32_t diffs;                         // Valid diffs
+    uint32_t nn50;                          // Valid diffs with |diff| > HRV_NN50_MS
+
+    uint16_t reference_ms;                  // Outlier reference, 0 = none yet
+    uint8_t reject_run;
+    bool chained;                           // Next interval follows an accepted one
+    uint32_t accepted;
+    uint32_t rejected;
+} hrv_t;
+
+/**
+ * @brief Clear the ring and accumulators
+ */
+void hrv_init(hrv_t *h);
+
+/**
+ * @brief Add one beat-to-beat interval
+ *
+ * @param h HRV state
+ * @param rr_ms Interval in milliseconds
+ * @return false interval was rejected as an outlier
+ */
+bool hrv_push(hrv_t *h, uint32_t rr_ms);
+
+/**
+ * @brief Mark a gap in the beat sequence (signal lost)
+ *
+ * The next interval is not differenced against the last one.
+ */
+void hrv_break(hrv_t *h);
+
+/**
+ * @brief Current metrics
+ *
+ * @param h HRV state
+ * @param out Metrics; only the counters are set below HRV_MIN_INTERVALS
+ */
+void hrv_get(const hrv_t *h, hrv_metrics_t *out);
+
+#endif // HRV_H
@@ -0,0 +1,57 @@
+#ifndef PPG_AGC_H
+#define PPG_AGC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// LED pulse amplitude codes (MAX30102 REG_LEDx_PA, 0.2 mA per step)
+#define PPG_AGC_PA_MIN          0x04
+#define PPG_AGC_PA_MAX          0xFF    // 51 mA
+#define PPG_AGC_PA_DEFAULT      0x24    // 7.2 mA, the old fixed setting
+
+// Raw DC band the controller keeps each channel in; inside
+// PPG_MIN_VALID_IR..PPG_MAX_VALID_IR with margin for pulsation
+#define PPG_AGC_TARGET          120000
+#define PPG_AGC_LOW             80000
+#define PPG_AGC_HIGH            170000
+#define PPG_AGC_SATURATED       250000  // Near ADC full scale: block mean is clipped
+#define PPG_AGC_NO_FINGER       10000   // IR this low at any current: nothing to track
+#define PPG_AGC_SETTLE_SAMPLES  8       // Ignored after a step while the LED settles
+
+enum {
+    PPG_AGC_RED = 0,
+    PPG_AGC_IR,
+};
+
+/**
+ * @brief LED current controller
+ *
+ * Steps each LED so its block-mean DC lands on PPG_AGC_TARGET in one move,
+ * then holds while the DC stays inside LOW..HIGH. Blocks taken at an
+ * older setting are ignored, so a step is never applied twice.
+ */
+typedef struct {
+    uint8_t pa[2];          // Commanded setting, PPG_AGC_RED / PPG_AGC_IR
+    uint32_t settle;        // Samples still to skip after the last step
+    uint32_t steps;         // Changes made since init
+} ppg_agc_t;
+
+/**
+ * @brief Start at PPG_AGC_PA_DEFAULT on both LEDs
+ */
+void ppg_agc_init(ppg_agc_t *agc);
+
+/**
+ * @brief Feed one block of raw samples
+ *
+ * @param agc Controller
+ * @param red Red samples
+ * @param ir IR samples
+ * @param count Number of samples
+ * @param block_pa LED setting the block was taken with
+ * @return true agc->pa changed and should be written to the sensor
+ */
+bool ppg_agc_update(ppg_agc_t *agc, const uint32_t *red, const uint32_t *ir, int count,
+                    const uint8_t block_pa[2]);
+
+#endif // PPG_AGC_H
@@ -0,0 +1,67 @@
+#ifndef PPG_CLOCK_H
+#define PPG_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PPG_CLOCK_TOLERANCE     0.05    // Max sensor oscillator error accepted
+#define PPG_CLOCK_MIN_SPAN_S    2       // Anchor span before the rate is measured
+#define PPG_CLOCK_MEMORY_S      60      // Anchor weight decays by e over this long
+
+/**
+ * @brief Maps sensor sample indices to esp_timer microseconds
+ *
+ * The sensor samples on its own oscillator, so sample times are derived
+ * from the sample index, not from when the task happened to read them.
+ * Anchors (index of the last sample in a burst, time it was read) feed a
+ * least-squares line whose older anchors fade out over PPG_CLOCK_MEMORY_S,
+ * so read latency jitter averages out over every anchor in that time
+ * instead of moving each sample time, and oscillator drift is followed.
+ * Until the anchors span PPG_CLOCK_MIN_SPAN_S only the offset is fitted,
+ * at the nominal rate. An anchor off the line by more than the tolerance
+ * over that span restarts the fit. Without anchors the nominal rate is
+ * used from time 0.
+ */
+typedef struct {
+    double nominal_period_us;
+    double period_us;           // Fitted sample period
+    double offset_us;           // Fitted time at the origin, relative to origin_us
+    uint64_t start_index;       // First anchor of the fit
+    uint64_t origin_index;      // Newest anchor, origin of the sums
+    double origin_us;
+    double w;                   // Weighted sums over the anchors, relative to the origin
+    double sx;
+    double sy;
+    double sxx;
+    double sxy;
+    bool anchored;
+    bool measured;              // period_us comes from anchors
+} ppg_clock_t;
+
+/**
+ * @brief Initialize at the nominal rate
+ *
+ * @param c Clock
+ * @param rate Nominal sample rate (Hz)
+ */
+void ppg_clock_init(ppg_clock_t *c, uint32_t rate);
+
+/**
+ * @brief Add an anchor
+ *
+ * @param c Clock
+ * @param index Sample index
+ * @param t_us Time the sample was taken (or read, if the latency is constant)
+ */
+void ppg_clock_anchor(ppg_clock_t *c, uint64_t index, int64_t t_us);
+
+/**
+ * @brief Time of a (possibly fractional) sample index
+ *
+ * @param c Clock
+ * @param index Sample index, fractional for interpolated events
+ * @return Microseconds
+ */
+double ppg_clock_time_us(const ppg_clock_t *c, double index);
+
+#endif // PPG_CLOCK_H
@@ -0,0 +1,89 @@
+#ifndef PPG_DECIM_H
+#define PPG_DECIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Anti-alias FIR of PPG_DECIM_TAPS_PER_PHASE * factor taps
+#define PPG_DECIM_MAX_FACTOR        8
+#define PPG_DECIM_TAPS_PER_PHASE    8
+#define PPG_DECIM_MAX_TAPS          (PPG_DECIM_MAX_FACTOR * PPG_DECIM_TAPS_PER_PHASE)
+#define PPG_DECIM_CUTOFF            0.3f    // Passband edge as a fraction of the output rate
+
+/**
+ * @brief Polyphase FIR decimator for the red/IR pair
+ *
+ * Each input sample is multiplied only by the PPG_DECIM_TAPS_PER_PHASE
+ * coefficients of its phase and added to the outputs it contributes to,
+ * so the cost is TAPS_PER_PHASE MACs per input sample and channel, spread
+ * evenly, and no discarded output is ever computed. DC gain is exactly 1.
+ */
+typedef struct {
+    int factor;                                         // 1 = pass-through
+    float coef[PPG_DECIM_MAX_TAPS];                     // Phase-major: coef[phase][j]
+    float acc[2][PPG_DECIM_TAPS_PER_PHASE];             // Partial outputs, red / IR
+    int head;                                           // Ring index of the next output
+    int phase;                                          // Inputs until that output is complete
+    bool primed;
+} ppg_decim_t;
+
+/**
+ * @brief Design the filter and clear its state
+ *
+ * @param d Decimator
+ * @param factor Rate reduction, 1 to PPG_DECIM_MAX_FACTOR
+ * @return false factor is out of range (decimator passes samples through)
+ */
+bool ppg_decim_init(ppg_decim_t *d, int factor);
+
+/**
+ * @brief Clear filter state
+ */
+void ppg_decim_reset(ppg_decim_t *d);
+
+/**
+ * @brief Jump over lost input samples
+ *
+ * Clears the filter (it primes again on the next input) but keeps the
+ * output phase, so output m still lines up with input m * factor.
+ *
+ * @param d Decimator
+ * @param lost Input samples missing from the stream
+ * @return Outputs the lost samples would have completed
+ */
+uint32_t ppg_decim_skip(ppg_decim_t *d, uint32_t lost);
+
+/**
+ * @brief Scale the partial outputs for an input gain change
+ *
+ * @param d Decimator
+ * @param red_gain New red scale relative to the old one
+ * @param ir_gain New IR scale relative to the old one
+ */
+void ppg_decim_rescale(ppg_decim_t *d, float red_gain, float ir_gain);
+
+/**
+ * @brief Input samples between the newest input of an output and its centre
+ *
+ * Output m is complete once input m * factor + factor - 1 has arrived and
+ * is centred (taps - 1) / 2 inputs earlier.
+ *
+ * @return Offset to add to m * factor to get the output's input-time index
+ */
+float ppg_decim_delay(const ppg_decim_t *d);
+
+/**
+ * @brief Decimate a block
+ *
+ * @param d Decimator
+ * @param red_in Red input samples
+ * @param ir_in IR input samples
+ * @param count Number of input samples
+ * @param red_out Red output, room for count / factor + 1 samples
+ * @param ir_out IR output, room for count / factor + 1 samples
+ * @return Number of output samples
+ */
+int ppg_decim_process(ppg_decim_t *d, const uint32_t *red_in, const uint32_t *ir_in, int count,
+                      uint32_t *red_out, uint32_t *ir_out);
+
+#endif // PPG_DECIM_H
@@ -0,0 +1,206 @@
+#ifndef PPG_DSP_H
+#define PPG_DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stream_window.h"
+#include "ppg_filter.h"
+#include "hr_autocorr.h"
+#include "spo2_lut.h"
+#include "ppg_agc.h"
+#include "ppg_decim.h"
+#include "hrv.h"
+#include "ppg_clock.h"
+#include "ppg_sqi.h"
+
+// --- Pipeline Configuration ---
+#define PPG_DSP_SAMPLE_RATE     100     // Hz, processing rate after decimation
+#define PPG_SPO2_WINDOW         50      // Samples for SpO2 AC/DC estimate
+#define PPG_MIN_VALID_IR        50000   // Below: no finger
+#define PPG_MAX_VALID_IR        200000  // Above: saturated
+#define PPG_BEAT_THRESHOLD      3000    // Minimum drop after a peak to count a beat
+#define PPG_MIN_BEAT_MS         300     // 200 BPM max
+#define PPG_RESULT_PERIOD_MS    500     // Reading cadence while a finger is present
+#define PPG_GAP_BRIDGE_MS       200     // Longer gaps in the input restart the pipeline
+#define PPG_PEAK_FIT_HALF       5       // Peak fit until the timing template is learned: samples
+                                        // either side of the maximum
+#define PPG_BEAT_SHAPE_PRE      60      // Timing template: samples before the peak sample...
+#define PPG_BEAT_SHAPE_POST     5       // ...and after it
+#define PPG_BEAT_SHAPE_LEN      (PPG_BEAT_SHAPE_PRE + 1 + PPG_BEAT_SHAPE_POST)
+#define PPG_BEAT_SHAPE_LAG      12      // Template search, samples either side of the peak sample
+#define PPG_BEAT_SHAPE_ALPHA    0.05f   // Template learning rate per clean beat (plain average before 1/alpha)
+#define PPG_BEAT_SHAPE_SETTLE   8       // Clean beats learned before its times feed HRV
+#define PPG_BEAT_HIST           256     // Filtered samples kept for the fit and the beat templates,
+                                        // power of two; the drop that confirms a 40 BPM beat is
+                                        // ~75 samples after its peak, the timing template reaches
+                                        // PRE + LAG before it
+#define PPG_BEAT_HIST_MASK      (PPG_BEAT_HIST - 1)
+
+_Static_assert(PPG_DSP_SAMPLE_RATE == HR_AC_RATE * HR_AC_DECIM, "autocorrelation engine rate");
+
+// Heart rate estimator
+typedef enum {
+    HR_ENGINE_PEAK = 0,     // Peak-to-peak intervals from the beat detector
+    HR_ENGINE_AUTOCORR,     // Autocorrelation over a 4s sliding window
+} hr_engine_t;
+
+/**
+ * @brief One reading from the pipeline
+ *
+ * Emitted every PPG_RESULT_PERIOD_MS while a finger is present, and once
+ * with finger = false when it is removed. heart_rate and spo2 are 0 until
+ * the pipeline has enough data, and while quality is below
+ * PPG_SQI_MIN_QUALITY.
+ */
+typedef struct {
+    uint32_t time_ms;       // Sample time of the reading (esp_timer ms once anchored)
+    uint8_t heart_rate;     // BPM
+    uint8_t spo2;           // Percent
+    int beat_count;         // Beats seen since the finger was placed
+    bool finger;
+    uint8_t quality;        // Signal quality 0-100 (ppg_sqi.h)
+    bool motion;            // Finger moving; quality is 0
+    hrv_metrics_t hrv;      // Over the last HRV_RR_CAPACITY clean intervals
+} ppg_result_t;
+
+typedef void (*ppg_result_cb_t)(const ppg_result_t *result, void *ctx);
+
+typedef struct {
+    hr_engine_t hr_engine;
+    spo2_cal_t spo2_cal;
+    ppg_result_cb_t on_result;      // Called from ppg_dsp_process()
+    void *ctx;
+    uint32_t input_rate;            // Hz, PPG_DSP_SAMPLE_RATE x 1..PPG_DECIM_MAX_FACTOR; 0 = same
+} ppg_dsp_config_t;
+
+/**
+ * @brief Complete pipeline state; instances are fully independent
+ */
+typedef struct {
+    ppg_dsp_config_t cfg;
+
+    // Filtering
+    ppg_decim_t decim;              // input_rate down to PPG_DSP_SAMPLE_RATE
+    stream_window_t red;            // PPG_SPO2_WINDOW: mean + peak-to-peak
+    stream_window_t ir;             // PPG_SPO2_WINDOW: mean + peak-to-peak
+    ppg_filter_t ir_filter;         // Band-pass feeding the beat detector
+    hr_autocorr_t hr_ac;            // Used when HR_ENGINE_AUTOCORR is selected
+    spo2_lut_t spo2_lut;
+    uint8_t led_pa[2];              // LED setting of the samples being processed
+    uint32_t last_red;              // Last input sample, held across short gaps
+    uint32_t last_ir;
+
+    // Beat detector
+    int32_t beat_last_value;
+    int32_t beat_max_value;
+    int32_t beat_hist[PPG_BEAT_HIST];   // Recent band-passed samples, for interpolation
+    float beat_shape[PPG_BEAT_SHAPE_LEN];   // Timing template, zero mean
+    uint32_t beat_shape_count;      // Clean beats learned, 0 = no template
+    uint32_t beat_max_index;
+    uint32_t run_start;             // First sample of the current finger-present run
+    bool beat_rising;
+
+    // Heart rate state
+    double last_beat_us;            // Interpolated peak time
+    uint32_t beat_intervals[4];     // Last 4 clean intervals (us), ring indexed by interval_count
+    uint32_t interval_count;
+    int beat_count;
+    bool beat_clean;                // Last beat passed the quality checks
+    bool beat_timed;                // Last beat was placed by a settled timing template
+    hrv_t hrv;                      // Survives finger loss; cleared by ppg_dsp_reset_hrv()
+
+    // Signal quality
+    ppg_sqi_t sqi;
+    uint8_t quality;                // Of the last reading
+
+    // Timeline
+    ppg_clock_t clock;              // Input sample index -> time
+    float decim_delay;              // Decimator group delay (input samples)
+    uint64_t input_count;           // Input samples since init
+    uint32_t sample_index;          // Samples processed since init
+    uint32_t last_calc_time;
+} ppg_dsp_t;
+
+/**
+ * @brief Initialize a pipeline instance
+ *
+ * An input_rate that is not a supported multiple of PPG_DSP_SAMPLE_RATE
+ * is treated as PPG_DSP_SAMPLE_RATE.
+ *
+ * @param dsp Instance
+ * @param cfg Configuration (copied)
+ * @return false input_rate was not supported
+ */
+bool ppg_dsp_init(ppg_dsp_t *dsp, const ppg_dsp_config_t *cfg);
+
+/**
+ * @brief Drop collected data and restart filtering (timeline continues)
+ *
+ * @param dsp Instance
+ */
+void ppg_dsp_reset(ppg_dsp_t *dsp);
+
+/**
+ * @brief Tie an input sample to esp_timer time
+ *
+ * Beat and result times are derived from the sample index through a clock
+ * fitted to these anchors, so they keep sub-sample resolution regardless
+ * of task scheduling. Typically called once per FIFO burst.
+ *
+ * @param dsp Instance
+ * @param input_index Input sample index (input_count before the block + offset)
+ * @param t_us Time that sample was taken
+ */
+void ppg_dsp_anchor(ppg_dsp_t *dsp, uint64_t input_index, int64_t t_us);
+
+/**
+ * @brief Mark input samples that were lost before the next block
+ *
+ * Up to PPG_GAP_BRIDGE_MS of input is bridged by holding the last sample,
+ * so filters and windows stay settled; a longer gap restarts the pipeline
+ * like a finger removal. Either way the timeline advances by `lost`, so
+ * later samples keep their true time, and no beat interval spans the gap.
+ *
+ * @param dsp Instance
+ * @param lost Input samples missing between the previous block and the next
+ */
+void ppg_dsp_gap(ppg_dsp_t *dsp, uint32_t lost);
+
+/**
+ * @brief Start HRV over, e.g. at the beginning of a session
+ *
+ * @param dsp Instance
+ */
+void ppg_dsp_reset_hrv(ppg_dsp_t *dsp);
+
+/**
+ * @brief Switch heart rate estimator; the autocorrelation window restarts
+ *
+ * @param dsp Instance
+ * @param engine New engine
+ */
+void ppg_dsp_set_hr_engine(ppg_dsp_t *dsp, hr_engine_t engine);
+
+/**
+ * @brief Declare the LED setting of the samples that follow
+ *
+ * On a change, everything held in sensor units (windows, filter state,
+ * beat detector) is rescaled by new/old current, so an AGC step passes
+ * through without a reset or filter transient.
+ *
+ * @param dsp Instance
+ * @param led_pa LED amplitude codes, PPG_AGC_RED / PPG_AGC_IR
+ */
+void ppg_dsp_set_led(ppg_dsp_t *dsp, const uint8_t led_pa[2]);
+
+/**
+ * @brief Process a block of consecutive raw samples at the configured input rate
+ *
+ * @param dsp Instance
+ * @param red Red samples (18-bit)
+ * @param ir IR samples (18-bit)
+ * @param count Number of samples
+ */
+void ppg_dsp_process(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count);
+
+#endif // PPG_DSP_H
@@ -0,0 +1,95 @@
+#ifndef PPG_FIFO_H
+#define PPG_FIFO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// MAX30102 FIFO: 32 samples, 5-bit pointers, OVF_COUNTER saturating at 31
+#define PPG_FIFO_DEPTH          32
+#define PPG_FIFO_PTR_MASK       0x1F
+#define PPG_FIFO_OVF_MAX        0x1F
+
+/**
+ * @brief FIFO pointer snapshot (FIFO_WR_PTR, OVF_COUNTER, FIFO_RD_PTR)
+ */
+typedef struct {
+    uint8_t wr_ptr;
+    uint8_t ovf;                // Samples lost since the last pop, saturates at PPG_FIFO_OVF_MAX
+    uint8_t rd_ptr;
+} ppg_fifo_regs_t;
+
+/**
+ * @brief Next burst as the pointers describe it
+ */
+typedef struct {
+    int count;                  // Samples to read
+    uint32_t lost;              // Timeline samples missing before this burst
+    int duplicates;             // Leading samples of the burst already delivered
+    uint32_t overflow;          // Samples this snapshot reports lost after the burst, 0 = none
+} ppg_fifo_burst_t;
+
+/**
+ * @brief Read pointer bookkeeping for the MAX30102 FIFO
+ *
+ * Register access stays in the driver, which hands each status snapshot
+ * and the outcome of each burst read here:
+ * - With rollover off, a full FIFO keeps its oldest 32 samples and drops
+ *   new ones, counted by OVF_COUNTER; that gap lies after the burst.
+ * - RD_PTR moved past the samples delivered since the last snapshot: a
+ *   failed read popped samples that never arrived. Short of them: a read
+ *   did not pop everything, and those samples come again. They stay
+ *   counted until popped, even through bursts too short to hold them all.
+ *
+ * Pointers are 5 bits, so a read that popped all 32 samples looks like
+ * one that popped none; after a good read of 32 it is taken as all, after
+ * a failed one as none. Likewise a full FIFO without overflow looks empty
+ * unless delivered samples are known to be waiting in it; otherwise it is
+ * read at the next snapshot, once OVF_COUNTER moves.
+ */
+typedef struct {
+    uint32_t rate;              // FIFO samples per second
+    bool rd_known;              // False until the first snapshot after a reset
+    uint8_t rd_ptr;             // At the latest snapshot
+    int delivered;              // Samples from rd_ptr on already delivered
+    int read_count;             // Samples requested by the burst in flight
+    uint32_t lost_after;        // Overflow losses behind the burst being read
+    int64_t status_us;          // Time of the latest snapshot, 0 = none
+} ppg_fifo_t;
+
+/**
+ * @brief Start over, as after the FIFO pointers are cleared
+ *
+ * @param f Bookkeeping
+ * @param rate FIFO sample rate (Hz)
+ */
+void ppg_fifo_reset(ppg_fifo_t *f, uint32_t rate);
+
+/**
+ * @brief Account for a status snapshot
+ *
+ * @param f Bookkeeping
+ * @param regs Pointers just read
+ * @param now_us Time they were read
+ * @param burst Filled in
+ */
+void ppg_fifo_status(ppg_fifo_t *f, const ppg_fifo_regs_t *regs, int64_t now_us,
+                     ppg_fifo_burst_t *burst);
+
+/**
+ * @brief A burst read of count samples was started
+ *
+ * @param f Bookkeeping
+ * @param count Samples requested
+ * @param started false the transfer was refused
+ */
+void ppg_fifo_read_start(ppg_fifo_t *f, int count, bool started);
+
+/**
+ * @brief The burst read completed
+ *
+ * @param f Bookkeeping
+ * @param ok false the data did not arrive
+ */
+void ppg_fifo_read_done(ppg_fifo_t *f, bool ok);
+
+#endif // PPG_FIFO_H
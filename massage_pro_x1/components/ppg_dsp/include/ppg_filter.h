@@ -0,0 +1,63 @@
+#ifndef PPG_FILTER_H
+#define PPG_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Stage 0: DC blocker, stage 1: 0.5Hz high-pass, stage 2: 5Hz low-pass
+#define PPG_FILTER_STAGES       3
+#define PPG_FILTER_HP_HZ        0.5f
+#define PPG_FILTER_LP_HZ        5.0f
+#define PPG_FILTER_DC_POLE      0.995f
+#define PPG_FILTER_BLOCK        32      // Samples filtered per kernel call
+
+/**
+ * @brief PPG band-pass filter state
+ *
+ * Biquads use the esp-dsp layout: coef = {b0, b1, b2, a1, a2}, w = 2 delay
+ * elements (direct form II).
+ */
+typedef struct {
+    float coef[PPG_FILTER_STAGES][5];
+    float w[PPG_FILTER_STAGES][2];
+    int32_t offset;     // First raw sample, keeps float inputs small
+    bool primed;
+} ppg_filter_t;
+
+/**
+ * @brief Design the filter for a sample rate and clear its state
+ *
+ * @param f Filter
+ * @param sample_rate_hz Input sample rate
+ */
+void ppg_filter_init(ppg_filter_t *f, uint32_t sample_rate_hz);
+
+/**
+ * @brief Clear filter state (next sample restarts the filter)
+ *
+ * @param f Filter
+ */
+void ppg_filter_reset(ppg_filter_t *f);
+
+/**
+ * @brief Scale the filter state for an input gain change
+ *
+ * After a step of the input by 'gain' the output continues as if the whole
+ * history had been scaled, so the band-pass does not ring on the step.
+ *
+ * @param f Filter
+ * @param gain New input scale relative to the old one
+ */
+void ppg_filter_rescale(ppg_filter_t *f, float gain);
+
+/**
+ * @brief Filter a block of raw samples
+ *
+ * @param f Filter
+ * @param in Raw sensor samples
+ * @param out Band-passed output, same length
+ * @param len Number of samples
+ */
+void ppg_filter_process(ppg_filter_t *f, const uint32_t *in, float *out, int len);
+
+#endif // PPG_FILTER_H
@@ -0,0 +1,69 @@
+#ifndef PPG_RING_H
+#define PPG_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * @brief Lock-free single-producer / single-consumer ring of fixed-size slots
+ *
+ * The producer fills a slot in place (claim, write, publish) and the
+ * consumer reads it in place (peek, read, release), so a block is never
+ * copied. Each index is written by one side only; the release store that
+ * moves it and the acquire load on the other side order the slot
+ * contents, so no lock or critical section is needed between cores.
+ *
+ * Occupancy counters are kept by the producer, which sees the ring at its
+ * fullest.
+ */
+typedef struct {
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t capacity;          // Power of two
+    _Atomic uint32_t head;      // Slots published, producer only
+    _Atomic uint32_t tail;      // Slots released, consumer only
+    uint32_t high_water;        // Most slots in use at a publish
+    uint32_t overruns;          // Claims refused because the ring was full
+} ppg_ring_t;
+
+/**
+ * @brief Initialize over caller storage
+ *
+ * @param r Ring
+ * @param storage capacity * slot_size bytes
+ * @param slot_size Bytes per slot
+ * @param capacity Slots, a power of two
+ * @return false capacity is not a power of two
+ */
+bool ppg_ring_init(ppg_ring_t *r, void *storage, size_t slot_size, uint32_t capacity);
+
+/**
+ * @brief Producer: slot to fill, NULL (and an overrun counted) if full
+ *
+ * The same slot is returned until it is published.
+ */
+void *ppg_ring_claim(ppg_ring_t *r);
+
+/**
+ * @brief Producer: hand the claimed slot to the consumer
+ */
+void ppg_ring_publish(ppg_ring_t *r);
+
+/**
+ * @brief Consumer: oldest published slot, NULL if empty
+ */
+const void *ppg_ring_peek(ppg_ring_t *r);
+
+/**
+ * @brief Consumer: return the peeked slot to the producer
+ */
+void ppg_ring_release(ppg_ring_t *r);
+
+/**
+ * @brief Slots published and not yet released; either side, a snapshot
+ */
+uint32_t ppg_ring_count(const ppg_ring_t *r);
+
+#endif // PPG_RING_H
@@ -0,0 +1,96 @@
+#ifndef PPG_SQI_H
+#define PPG_SQI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Beat template, in processing-rate samples around the peak
+#define PPG_SQI_TEMPLATE_PRE    24      // Upstroke before the peak
+#define PPG_SQI_TEMPLATE_POST   5       // Samples after it
+#define PPG_SQI_TEMPLATE_LEN    (PPG_SQI_TEMPLATE_PRE + 1 + PPG_SQI_TEMPLATE_POST)
+#define PPG_SQI_BEAT_CORR       0.6f    // Below: the beat is an artifact
+#define PPG_SQI_CORR_GOOD       0.9f    // Template score is 1 from here
+#define PPG_SQI_RELEARN_REJECTS 4       // Consecutive rejects before the template is replaced
+
+// Perfusion index: IR AC / DC over the SpO2 window
+#define PPG_SQI_PI_MIN          0.001f  // Score 0 (0.1%)
+#define PPG_SQI_PI_GOOD         0.005f  // Score 1 (0.5%)
+
+// Beat interval spread: coefficient of variation of the intervals averaged for HR
+#define PPG_SQI_CV_GOOD         0.05f   // Score 1
+#define PPG_SQI_CV_BAD          0.25f   // Score 0
+#define PPG_SQI_BEAT_GAP_MS     3000    // No clean beat for this long (40 BPM + detection lag): score 0
+
+// Motion: the finger moving on the sensor swings the DC level and the
+// band-passed signal far beyond a pulse
+#define PPG_SQI_MOTION_PI       0.15f   // Window peak-to-peak / DC
+#define PPG_SQI_MOTION_RATIO    3.0f    // Band-passed excursion / pulse amplitude
+#define PPG_SQI_MOTION_HOLD     200     // Samples the flag holds after the last hit (2s)
+
+#define PPG_SQI_MIN_QUALITY     50      // Readings below are suppressed
+
+/**
+ * @brief Signal quality state, updated per sample and per beat
+ *
+ * Quality is the weakest of three scores: perfusion, correlation of recent
+ * beats with a learned beat template, and consistency of the beat
+ * intervals. Motion forces it to 0.
+ */
+typedef struct {
+    float shape[PPG_SQI_TEMPLATE_LEN];      // Template, zero mean and unit variance
+    bool has_shape;
+    int reject_run;
+    float corr;                 // Smoothed beat correlation
+    float pulse_amp;            // Smoothed band-passed peak height of clean beats
+    uint32_t motion_until;      // Sample index the motion flag holds to
+    bool motion;
+} ppg_sqi_t;
+
+/**
+ * @brief Forget the template and motion state (new finger placement)
+ */
+void ppg_sqi_reset(ppg_sqi_t *q);
+
+/**
+ * @brief Motion check for one sample
+ *
+ * @param q State
+ * @param ir_ac Band-passed IR sample
+ * @param ir_p2p IR peak-to-peak over the SpO2 window
+ * @param ir_dc IR mean over the SpO2 window
+ * @param index Processing-rate sample index
+ * @return true while motion is flagged
+ */
+bool ppg_sqi_sample(ppg_sqi_t *q, int32_t ir_ac, uint32_t ir_p2p, uint32_t ir_dc, uint32_t index);
+
+/**
+ * @brief Score a detected beat against the template
+ *
+ * Clean beats refine the template and the pulse amplitude. After
+ * PPG_SQI_RELEARN_REJECTS rejects in a row the template was learned from
+ * an artifact and is replaced by the current beat.
+ *
+ * @param q State
+ * @param segment Band-passed samples PPG_SQI_TEMPLATE_PRE before to
+ *                PPG_SQI_TEMPLATE_POST after the peak, NULL if unavailable
+ * @param peak Band-passed value at the peak
+ * @return false the beat does not match the template
+ */
+bool ppg_sqi_beat(ppg_sqi_t *q, const int32_t *segment, int32_t peak);
+
+/**
+ * @brief Quality of the current window
+ *
+ * @param q State
+ * @param perfusion IR AC / DC
+ * @param interval_cv Coefficient of variation of recent beat intervals, < 0 if unknown
+ * @return 0-100
+ */
+uint8_t ppg_sqi_quality(const ppg_sqi_t *q, float perfusion, float interval_cv);
+
+/**
+ * @brief Follow an IR LED current step (gain = new / old)
+ */
+void ppg_sqi_rescale(ppg_sqi_t *q, float gain);
+
+#endif // PPG_SQI_H
@@ -0,0 +1,32 @@
+#ifndef PPG_SYNTH_H
+#define PPG_SYNTH_H
+
+#include <stdint.h>
+
+// Generated trace shape
+#define PPG_SYNTH_IR_DC         120000.0f
+#define PPG_SYNTH_RED_DC        100000.0f
+#define PPG_SYNTH_IR_AC         6000.0f     // Peak-to-peak
+#define PPG_SYNTH_NOISE         150.0f      // Peak-to-peak, uniform
+#define PPG_SYNTH_WANDER        0.02f       // Baseline wander, fraction of DC
+#define PPG_SYNTH_WANDER_HZ     0.15f
+
+/**
+ * @brief Deterministic PPG generator with a known heart rate and SpO2
+ *
+ * Red AC is scaled so R matches SPO2_CAL_DEFAULT at the requested SpO2.
+ * The same seed gives the same samples on host and target.
+ */
+typedef struct {
+    float heart_rate;       // BPM
+    float spo2;             // Percent
+    uint32_t rate;          // Sample rate (Hz)
+    uint32_t rng;
+    float phase;            // Fraction of the current beat
+    uint32_t index;
+} ppg_synth_t;
+
+void ppg_synth_init(ppg_synth_t *s, float heart_rate, float spo2, uint32_t rate, uint32_t seed);
+void ppg_synth_generate(ppg_synth_t *s, uint32_t *red, uint32_t *ir, int count);
+
+#endif // PPG_SYNTH_H
@@ -0,0 +1,87 @@
+#ifndef PPG_WAVEPACK_H
+#define PPG_WAVEPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Waveform compression: the first sample of a packet is a 24-bit big endian
+// key, the rest are zig-zag prediction residuals bit-packed in groups. Each
+// group is one header byte followed by its residuals in W bits each, MSB
+// first, padded to a whole byte. Header bits 0-4 are W, bit 7 selects the
+// predictor: 0 the previous sample (delta), 1 the linear extrapolation of
+// the previous two (2 * x[n-1] - x[n-2]; the key counts as x[-1] for the
+// first residual). The encoder picks whichever gives the narrower group.
+// Header bits 5-6 are the low sample bits the encoder dropped: residuals are
+// in steps of 1 << drop, and the key and every decoded sample sit in the
+// middle of their step. 0 is lossless.
+// Packets decode on their own, so a lost one costs only its samples.
+#define PPG_WAVEPACK_GROUP      8       // Residuals per header byte
+#define PPG_WAVEPACK_KEY_LEN    3
+#define PPG_WAVEPACK_WIDTH_MASK 0x1F
+#define PPG_WAVEPACK_DROP_SHIFT 5
+#define PPG_WAVEPACK_DROP_MASK  0x60    // Header field: low bits dropped
+#define PPG_WAVEPACK_MAX_DROP   3
+#define PPG_WAVEPACK_LINEAR     0x80    // Header flag: second order predictor
+#define PPG_WAVEPACK_MAX_WIDTH  26      // Zig-zag of a second difference of 24-bit values
+
+/**
+ * @brief Encoder for one packet payload
+ *
+ * A group's width and predictor are only known when it closes, so its bytes
+ * are written then; the size check in ppg_wavepack_add accounts for the open
+ * group as it would close.
+ */
+typedef struct {
+    uint8_t *out;
+    size_t capacity;
+    size_t len;                 // Bytes of the key and closed groups
+    int count;                  // Samples accepted, key included
+    uint32_t last;
+    uint32_t last2;             // Sample before last
+    uint32_t delta[PPG_WAVEPACK_GROUP];     // Zig-zag residuals of the open group, per predictor
+    uint32_t linear[PPG_WAVEPACK_GROUP];
+    int group_count;
+    uint8_t delta_width;
+    uint8_t linear_width;
+    uint8_t drop;               // Low sample bits dropped
+} ppg_wavepack_t;
+
+/**
+ * @brief Start a payload
+ *
+ * @param w Encoder
+ * @param out Payload buffer
+ * @param capacity Bytes available in out
+ * @param drop Low sample bits to drop, 0 (lossless) to PPG_WAVEPACK_MAX_DROP
+ */
+void ppg_wavepack_init(ppg_wavepack_t *w, uint8_t *out, size_t capacity, uint8_t drop);
+
+/**
+ * @brief Append a sample
+ *
+ * @param w Encoder
+ * @param sample Value, 24 bits at most
+ * @return false it does not fit; the payload is unchanged and complete
+ */
+bool ppg_wavepack_add(ppg_wavepack_t *w, uint32_t sample);
+
+/**
+ * @brief Close the open group
+ *
+ * @return Payload length in bytes
+ */
+size_t ppg_wavepack_finish(ppg_wavepack_t *w);
+
+/**
+ * @brief Decode a payload
+ *
+ * @param in Payload
+ * @param len Payload length
+ * @param count Samples it holds
+ * @param out count samples
+ * @return false the payload is shorter than count samples need
+ */
+bool ppg_wavepack_decode(const uint8_t *in, size_t len, int count, uint32_t *out);
+
+#endif // PPG_WAVEPACK_H
@@ -0,0 +1,67 @@
+#ifndef SPO2_LUT_H
+#define SPO2_LUT_H
+
+#include <stdint.h>
+
+// R = (Red_AC/Red_DC) / (IR_AC/IR_DC) is carried as unsigned Q16
+#define SPO2_R_FRAC_BITS    16
+#define SPO2_R_ONE          (1UL << SPO2_R_FRAC_BITS)
+
+// Table covers R in [0, 2) in steps of 1/128; larger R uses the last entry
+#define SPO2_LUT_BITS       8
+#define SPO2_LUT_SIZE       (1 << SPO2_LUT_BITS)
+#define SPO2_LUT_SHIFT      (SPO2_R_FRAC_BITS + 1 - SPO2_LUT_BITS)
+
+#define SPO2_MIN            70
+#define SPO2_MAX            100
+
+/**
+ * @brief Calibration curve SpO2 = a + b*R + c*R^2, coefficients in Q16
+ */
+typedef struct {
+    int32_t a;
+    int32_t b;
+    int32_t c;
+} spo2_cal_t;
+
+// SpO2 = 110 - 25*R, the common MAX30102 approximation
+#define SPO2_CAL_DEFAULT    { .a = 110 * 65536, .b = -25 * 65536, .c = 0 }
+
+/**
+ * @brief R -> SpO2 table built from one calibration curve
+ */
+typedef struct {
+    uint8_t table[SPO2_LUT_SIZE];
+} spo2_lut_t;
+
+/**
+ * @brief Fill the R -> SpO2 table from a calibration curve
+ *
+ * Integer-only, so the table is bit-identical on host and target.
+ *
+ * @param lut Table to fill
+ * @param cal Calibration coefficients
+ */
+void spo2_lut_build(spo2_lut_t *lut, const spo2_cal_t *cal);
+
+/**
+ * @brief Ratio of ratios in Q16 (0 if either AC or DC term is zero)
+ *
+ * @param red_ac Red peak-to-peak
+ * @param red_dc Red mean
+ * @param ir_ac IR peak-to-peak
+ * @param ir_dc IR mean
+ * @return uint32_t R in Q16, saturated at UINT32_MAX
+ */
+uint32_t spo2_ratio_q16(uint32_t red_ac, uint32_t red_dc, uint32_t ir_ac, uint32_t ir_dc);
+
+/**
+ * @brief Look up SpO2 for a Q16 ratio
+ *
+ * @param lut Calibration table
+ * @param r_q16 Ratio of ratios in Q16
+ * @return uint8_t SpO2 percentage (SPO2_MIN-SPO2_MAX)
+ */
+uint8_t spo2_lookup(const spo2_lut_t *lut, uint32_t r_q16);
+
+#endif // SPO2_LUT_H
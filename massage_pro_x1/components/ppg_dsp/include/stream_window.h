@@ -0,0 +1,95 @@
+#ifndef STREAM_WINDOW_H
+#define STREAM_WINDOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Ring capacity, must be a power of two and >= the longest window used
+#define STREAM_WINDOW_CAPACITY  64
+#define STREAM_WINDOW_MASK      (STREAM_WINDOW_CAPACITY - 1)
+
+/**
+ * @brief Sliding window over a sample stream
+ *
+ * Keeps a running sum and monotonic min/max deques so that push, mean,
+ * min and max are all O(1). The window is never rescanned.
+ */
+typedef struct {
+    uint32_t data[STREAM_WINDOW_CAPACITY];
+    uint32_t max_q[STREAM_WINDOW_CAPACITY];   // Sample indices, values decreasing
+    uint32_t min_q[STREAM_WINDOW_CAPACITY];   // Sample indices, values increasing
+    uint64_t sum;
+    uint32_t length;                          // Window length in samples
+    uint32_t count;                           // Samples held (saturates at length)
+    uint32_t seq;                             // Free-running index of next sample
+    uint32_t max_head, max_tail;
+    uint32_t min_head, min_tail;
+    bool track_extrema;                       // Maintain min/max deques
+} stream_window_t;
+
+/**
+ * @brief Initialize a window
+ *
+ * @param w Window to initialize
+ * @param length Window length (1 to STREAM_WINDOW_CAPACITY)
+ * @param track_extrema true if stream_window_min/max will be used
+ */
+void stream_window_init(stream_window_t *w, uint32_t length, bool track_extrema);
+
+/**
+ * @brief Drop all samples, keeping the configured length
+ *
+ * @param w Window to reset
+ */
+void stream_window_reset(stream_window_t *w);
+
+/**
+ * @brief Append a sample, evicting the oldest once the window is full
+ *
+ * @param w Window
+ * @param value New sample
+ */
+void stream_window_push(stream_window_t *w, uint32_t value);
+
+/**
+ * @brief Scale every held sample, e.g. after a sensor gain change
+ *
+ * O(count); positive scaling keeps the min/max deques in order.
+ *
+ * @param w Window
+ * @param gain Scale factor (> 0)
+ */
+void stream_window_rescale(stream_window_t *w, float gain);
+
+/**
+ * @brief Check if the window holds 'length' samples
+ */
+static inline bool stream_window_full(const stream_window_t *w) {
+    return w->count >= w->length;
+}
+
+/**
+ * @brief Mean of the samples in the window (0 until full)
+ */
+static inline uint32_t stream_window_mean(const stream_window_t *w) {
+    if (!stream_window_full(w)) {
+        return 0;
+    }
+    return (uint32_t)(w->sum / w->length);
+}
+
+/**
+ * @brief Largest sample in the window (non-empty, extrema tracked)
+ */
+static inline uint32_t stream_window_max(const stream_window_t *w) {
+    return w->data[w->max_q[w->max_head & STREAM_WINDOW_MASK] & STREAM_WINDOW_MASK];
+}
+
+/**
+ * @brief Smallest sample in the window (non-empty, extrema tracked)
+ */
+static inline uint32_t stream_window_min(const stream_window_t *w) {
+    return w->data[w->min_q[w->min_head & STREAM_WINDOW_MASK] & STREAM_WINDOW_MASK];
+}
+
+#endif // STREAM_WINDOW_H
@@ -0,0 +1,84 @@
+/*
+ * PPG AGC Module
+ * Closed-loop LED current control keeping the raw DC in range
+ */
+
+#include "ppg_agc.h"
+
+void ppg_agc_init(ppg_agc_t *agc) {
+    agc->pa[PPG_AGC_RED] = PPG_AGC_PA_DEFAULT;
+    agc->pa[PPG_AGC_IR] = PPG_AGC_PA_DEFAULT;
+    agc->settle = 0;
+    agc->steps = 0;
+}
+
+// New setting for one LED from its block-mean DC
+static uint8_t agc_step(uint8_t pa, uint32_t dc) {
+    uint32_t next;
+
+    if (dc >= PPG_AGC_SATURATED) {
+        // Clipped: the mean underestimates, so just halve
+        next = pa / 2;
+    } else if (dc < PPG_AGC_LOW || dc > PPG_AGC_HIGH) {
+        // Signal is proportional to LED current
+        next = (uint32_t)(((uint64_t)pa * PPG_AGC_TARGET + dc / 2) / (dc ? dc : 1));
+    } else {
+        return pa;
+    }
+
+    if (next < PPG_AGC_PA_MIN) {
+        next = PPG_AGC_PA_MIN;
+    } else if (next > PPG_AGC_PA_MAX) {
+        next = PPG_AGC_PA_MAX;
+    }
+    return (uint8_t)next;
+}
+
+bool ppg_agc_update(ppg_agc_t *agc, const uint32_t *red, const uint32_t *ir, int count,
+                    const uint8_t block_pa[2]) {
+    if (count <= 0 ||
+        block_pa[PPG_AGC_RED] != agc->pa[PPG_AGC_RED] ||
+        block_pa[PPG_AGC_IR] != agc->pa[PPG_AGC_IR]) {
+        return false;   // Taken before the last step
+    }
+
+    // Skip the samples straddling the step
+    int first = 0;
+    if (agc->settle > 0) {
+        first = (agc->settle < (uint32_t)count) ? (int)agc->settle : count;
+        agc->settle -= first;
+        if (first == count) {
+            return false;
+        }
+    }
+
+    uint64_t red_sum = 0;
+    uint64_t ir_sum = 0;
+    for (int i = first; i < count; i++) {
+        red_sum += red[i];
+        ir_sum += ir[i];
+    }
+    uint32_t n = (uint32_t)(count - first);
+    uint32_t red_dc = (uint32_t)(red_sum / n);
+    uint32_t ir_dc = (uint32_t)(ir_sum / n);
+
+    uint8_t next[2];
+    if (ir_dc < PPG_AGC_NO_FINGER) {
+        // Nothing on the sensor: don't drive the LEDs to full power
+        next[PPG_AGC_RED] = PPG_AGC_PA_DEFAULT;
+        next[PPG_AGC_IR] = PPG_AGC_PA_DEFAULT;
+    } else {
+        next[PPG_AGC_RED] = agc_step(agc->pa[PPG_AGC_RED], red_dc);
+        next[PPG_AGC_IR] = agc_step(agc->pa[PPG_AGC_IR], ir_dc);
+    }
+
+    if (next[PPG_AGC_RED] == agc->pa[PPG_AGC_RED] && next[PPG_AGC_IR] == agc->pa[PPG_AGC_IR]) {
+        return false;
+    }
+
+    agc->pa[PPG_AGC_RED] = next[PPG_AGC_RED];
+    agc->pa[PPG_AGC_IR] = next[PPG_AGC_IR];
+    agc->settle = PPG_AGC_SETTLE_SAMPLES;
+    agc->steps++;
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * PPG Clock Module
+ * Sample index to esp_timer time, tracking the sensor's oscillator
+ */
+
+#include "ppg_clock.h"
+#include <math.h>
+
+// Forget the anchors and start a new fit at this one
+static void clock_restart(ppg_clock_t *c, uint64_t index, int64_t t_us) {
+    c->start_index = index;
+    c->origin_index = index;
+    c->origin_us = (double)t_us;
+    c->w = 1.0;
+    c->sx = c->sy = c->sxx = c->sxy = 0.0;
+    c->period_us = c->nominal_period_us;
+    c->offset_us = 0.0;
+    c->anchored = true;
+    c->measured = false;
+}
+
+void ppg_clock_init(ppg_clock_t *c, uint32_t rate) {
+    c->nominal_period_us = 1e6 / rate;
+    c->period_us = c->nominal_period_us;
+    c->offset_us = 0.0;
+    c->start_index = 0;
+    c->origin_index = 0;
+    c->origin_us = 0.0;
+    c->w = c->sx = c->sy = c->sxx = c->sxy = 0.0;
+    c->anchored = false;
+    c->measured = false;
+}
+
+void ppg_clock_anchor(ppg_clock_t *c, uint64_t index, int64_t t_us) {
+    if (!c->anchored || index < c->origin_index) {
+        clock_restart(c, index, t_us);
+        return;
+    }
+
+    // A stall or lost samples: the anchor is nowhere near the line
+    double residual = (double)t_us - ppg_clock_time_us(c, (double)index);
+    if (fabs(residual) > PPG_CLOCK_TOLERANCE * PPG_CLOCK_MIN_SPAN_S * 1e6) {
+        clock_restart(c, index, t_us);
+        return;
+    }
+
+    // Move the origin of the sums to this anchor, so they stay small and
+    // this anchor is (0, 0)
+    double d = (double)(index - c->origin_index);
+    double e = (double)t_us - c->origin_us;
+    c->sxx += c->w * d * d - 2.0 * d * c->sx;
+    c->sxy += c->w * d * e - d * c->sy - e * c->sx;
+    c->sx -= c->w * d;
+    c->sy -= c->w * e;
+    c->origin_index = index;
+    c->origin_us = (double)t_us;
+
+    // Older anchors fade out over PPG_CLOCK_MEMORY_S, so drift is followed
+    double fade = exp(-d * c->nominal_period_us / (PPG_CLOCK_MEMORY_S * 1e6));
+    c->w = c->w * fade + 1.0;
+    c->sx *= fade;
+    c->sy *= fade;
+    c->sxx *= fade;
+    c->sxy *= fade;
+
+    double period = c->nominal_period_us;
+    if ((double)(index - c->start_index) * c->nominal_period_us >= PPG_CLOCK_MIN_SPAN_S * 1e6) {
+        period = (c->w * c->sxy - c->sx * c->sy) / (c->w * c->sxx - c->sx * c->sx);
+        double limit = c->nominal_period_us * PPG_CLOCK_TOLERANCE;
+        if (period < c->nominal_period_us - limit || period > c->nominal_period_us + limit) {
+            // Not a clock error: the timeline broke; restart the fit
+            clock_restart(c, index, t_us);
+            return;
+        }
+        c->measured = true;
+    }
+    c->period_us = period;
+    c->offset_us = (c->sy - period * c->sx) / c->w;
+}
+
+double ppg_clock_time_us(const ppg_clock_t *c, double index) {
+    return c->origin_us + c->offset_us + (index - (double)c->origin_index) * c->period_us;
+}
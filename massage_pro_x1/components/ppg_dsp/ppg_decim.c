@@ -0,0 +1,148 @@
+/*
+ * PPG Decimator Module
+ * Polyphase anti-alias FIR from the sensor rate down to the processing rate
+ */
+
+#include "ppg_decim.h"
+#include <math.h>
+#include <string.h>
+
+#define DECIM_PI    3.14159265358979f
+
+// Windowed sinc (Hamming), normalized to unity DC gain
+static void decim_design(float *h, int taps, int factor) {
+    float fc = PPG_DECIM_CUTOFF / factor;     // Cycles per input sample
+    float center = (taps - 1) / 2.0f;
+    float sum = 0.0f;
+
+    for (int k = 0; k < taps; k++) {
+        float t = k - center;
+        float sinc = (t == 0.0f) ? 2.0f * fc : sinf(2.0f * DECIM_PI * fc * t) / (DECIM_PI * t);
+        float window = 0.54f - 0.46f * cosf(2.0f * DECIM_PI * k / (taps - 1));
+        h[k] = sinc * window;
+        sum += h[k];
+    }
+    for (int k = 0; k < taps; k++) {
+        h[k] /= sum;
+    }
+}
+
+// Sidelobes can undershoot below zero on a finger-off step
+static inline uint32_t decim_sample(float acc) {
+    return (acc > 0.0f) ? (uint32_t)lroundf(acc) : 0;
+}
+
+// Output head + j has seen every input older than tap (j + 1) * factor,
+// plus the `phase` inputs of the current period
+static void ppg_decim_prime(ppg_decim_t *d, float red, float ir) {
+    for (int j = 0; j < PPG_DECIM_TAPS_PER_PHASE; j++) {
+        float seen = 0.0f;
+        for (int k = j + 1; k < PPG_DECIM_TAPS_PER_PHASE; k++) {
+            for (int r = 0; r < d->factor; r++) {
+                seen += d->coef[r * PPG_DECIM_TAPS_PER_PHASE + k];
+            }
+        }
+        for (int q = 0; q < d->phase; q++) {
+            seen += d->coef[(d->factor - 1 - q) * PPG_DECIM_TAPS_PER_PHASE + j];
+        }
+        int slot = (d->head + j) & (PPG_DECIM_TAPS_PER_PHASE - 1);
+        d->acc[0][slot] = seen * red;
+        d->acc[1][slot] = seen * ir;
+    }
+    d->primed = true;
+}
+
+bool ppg_decim_init(ppg_decim_t *d, int factor) {
+    bool valid = factor >= 1 && factor <= PPG_DECIM_MAX_FACTOR;
+
+    d->factor = valid ? factor : 1;
+    if (d->factor > 1) {
+        float h[PPG_DECIM_MAX_TAPS];
+        decim_design(h, d->factor * PPG_DECIM_TAPS_PER_PHASE, d->factor);
+
+        // y[m] = sum_k h[k] x[mD - k]; input x[qD - r] feeds y[q + j]
+        // through h[jD + r], so store phase r contiguously
+        for (int r = 0; r < d->factor; r++) {
+            for (int j = 0; j < PPG_DECIM_TAPS_PER_PHASE; j++) {
+                d->coef[r * PPG_DECIM_TAPS_PER_PHASE + j] = h[j * d->factor + r];
+            }
+        }
+    }
+
+    ppg_decim_reset(d);
+    return valid;
+}
+
+void ppg_decim_reset(ppg_decim_t *d) {
+    memset(d->acc, 0, sizeof(d->acc));
+    d->head = 0;
+    d->phase = 0;
+    d->primed = false;
+}
+
+uint32_t ppg_decim_skip(ppg_decim_t *d, uint32_t lost) {
+    if (d->factor == 1) {
+        return lost;
+    }
+
+    uint32_t inputs = (uint32_t)d->phase + lost;
+    ppg_decim_reset(d);
+    d->phase = (int)(inputs % d->factor);
+    return inputs / d->factor;
+}
+
+float ppg_decim_delay(const ppg_decim_t *d) {
+    if (d->factor == 1) {
+        return 0.0f;
+    }
+    return (d->factor - 1) - (d->factor * PPG_DECIM_TAPS_PER_PHASE - 1) / 2.0f;
+}
+
+void ppg_decim_rescale(ppg_decim_t *d, float red_gain, float ir_gain) {
+    for (int j = 0; j < PPG_DECIM_TAPS_PER_PHASE; j++) {
+        d->acc[0][j] *= red_gain;
+        d->acc[1][j] *= ir_gain;
+    }
+}
+
+int ppg_decim_process(ppg_decim_t *d, const uint32_t *red_in, const uint32_t *ir_in, int count,
+                      uint32_t *red_out, uint32_t *ir_out) {
+    if (d->factor == 1) {
+        memcpy(red_out, red_in, count * sizeof(uint32_t));
+        memcpy(ir_out, ir_in, count * sizeof(uint32_t));
+        return count;
+    }
+
+    // Start as if the first sample had been present forever, so the output
+    // begins at the signal level instead of ramping up from zero
+    if (count > 0 && !d->primed) {
+        ppg_decim_prime(d, (float)red_in[0], (float)ir_in[0]);
+    }
+
+    int produced = 0;
+    for (int n = 0; n < count; n++) {
+        // r counts down to 0, at which point output 'head' is complete
+        int r = (d->factor - 1 - d->phase);
+        const float *c = &d->coef[r * PPG_DECIM_TAPS_PER_PHASE];
+        float red = (float)red_in[n];
+        float ir = (float)ir_in[n];
+
+        for (int j = 0; j < PPG_DECIM_TAPS_PER_PHASE; j++) {
+            int slot = (d->head + j) & (PPG_DECIM_TAPS_PER_PHASE - 1);
+            d->acc[0][slot] += c[j] * red;
+            d->acc[1][slot] += c[j] * ir;
+        }
+
+        if (++d->phase == d->factor) {
+            d->phase = 0;
+            red_out[produced] = decim_sample(d->acc[0][d->head]);
+            ir_out[produced] = decim_sample(d->acc[1][d->head]);
+            produced++;
+            d->acc[0][d->head] = 0.0f;
+            d->acc[1][d->head] = 0.0f;
+            d->head = (d->head + 1) & (PPG_DECIM_TAPS_PER_PHASE - 1);
+        }
+    }
+
+    return produced;
+}
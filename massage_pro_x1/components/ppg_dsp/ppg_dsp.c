@@ -0,0 +1,584 @@
+/*
+ * PPG DSP Module
+ * Filtering, beat detection, heart rate and SpO2 for red/IR PPG samples
+ */
+
+#include "ppg_dsp.h"
+#include <math.h>
+#include <string.h>
+
+#define PROCESS_CHUNK   PPG_FILTER_BLOCK
+
+//-----------------------------------------------------------------------------
+// Heart Rate / SpO2
+//-----------------------------------------------------------------------------
+
+// Time of a (fractional) processing-rate sample index
+static double sample_time_us(const ppg_dsp_t *dsp, double index) {
+    return ppg_clock_time_us(&dsp->clock, index * dsp->decim.factor + dsp->decim_delay);
+}
+
+// Vertex of a least-squares parabola over PPG_PEAK_FIT_HALF samples either
+// side of the peak sample, in samples relative to it. A three-point fit
+// follows the noise on a broad, slow peak; the wider fit averages it out.
+static float peak_offset(const ppg_dsp_t *dsp, uint32_t peak) {
+    const int k = PPG_PEAK_FIT_HALF;
+    const float m2 = k * (k + 1) / 3.0f;        // Mean of x^2 over -k..k
+    float s1 = 0.0f, s2 = 0.0f, n1 = 0.0f, n2 = 0.0f;
+
+    for (int x = -k; x <= k; x++) {
+        float y = (float)dsp->beat_hist[(peak + x) & PPG_BEAT_HIST_MASK];
+        float c = x * x - m2;
+        s1 += x * y;
+        n1 += x * x;
+        s2 += c * y;
+        n2 += c * c;
+    }
+
+    float a1 = s1 / n1;
+    float a2 = s2 / n2;
+    if (a2 >= 0.0f) {
+        return 0.0f;    // Not a maximum
+    }
+
+    float offset = -a1 / (2.0f * a2);
+    return (offset < -k) ? -k : (offset > k) ? k : offset;
+}
+
+// Whether the timing template window around a sample is all in the
+// history and in the current run
+static bool shape_window(const ppg_dsp_t *dsp, uint32_t centre, uint32_t index) {
+    uint32_t age = index - centre;
+
+    return (int32_t)age >= PPG_BEAT_SHAPE_POST && age + PPG_BEAT_SHAPE_PRE < PPG_BEAT_HIST &&
+           (int32_t)(centre - dsp->run_start) >= PPG_BEAT_SHAPE_PRE;
+}
+
+// Correlation of the timing template with the samples around a sample.
+// The template has zero mean, so a constant or a linear baseline under
+// the window adds the same to every position and cannot move the best one
+static float shape_corr(const ppg_dsp_t *dsp, uint32_t centre) {
+    uint32_t first = centre - PPG_BEAT_SHAPE_PRE;
+    float acc = 0.0f;
+
+    for (int i = 0; i < PPG_BEAT_SHAPE_LEN; i++) {
+        acc += (float)dsp->beat_hist[(first + i) & PPG_BEAT_HIST_MASK] * dsp->beat_shape[i];
+    }
+    return acc;
+}
+
+// Offset of a beat from its peak sample, in samples, by matching the
+// timing template. The whole rise into the peak takes part, so noise and
+// respiratory wander move it far less than they move the top of a slow,
+// broad pulse.
+// False without a template or when the best match is at the edge of the
+// search (not the same shape)
+static bool shape_offset(const ppg_dsp_t *dsp, uint32_t peak, uint32_t index, float *offset) {
+    float corr[2 * PPG_BEAT_SHAPE_LAG + 1];
+    int first = -PPG_BEAT_SHAPE_LAG;
+    int last = PPG_BEAT_SHAPE_LAG;
+
+    if (dsp->beat_shape_count == 0) {
+        return false;
+    }
+    // Only shifts whose window is complete; the newest samples are the
+    // drop that confirmed the beat
+    while (first <= last && !shape_window(dsp, peak + first, index)) {
+        first++;
+    }
+    while (last >= first && !shape_window(dsp, peak + last, index)) {
+        last--;
+    }
+    if (last - first < 2) {
+        return false;
+    }
+
+    int best = first;
+    for (int lag = first; lag <= last; lag++) {
+        corr[lag + PPG_BEAT_SHAPE_LAG] = shape_corr(dsp, peak + lag);
+        if (corr[lag + PPG_BEAT_SHAPE_LAG] > corr[best + PPG_BEAT_SHAPE_LAG]) {
+            best = lag;
+        }
+    }
+    if (best == first || best == last) {
+        return false;
+    }
+
+    // Parabola through the best shift and its neighbours
+    float y0 = corr[best + PPG_BEAT_SHAPE_LAG - 1];
+    float y1 = corr[best + PPG_BEAT_SHAPE_LAG];
+    float y2 = corr[best + PPG_BEAT_SHAPE_LAG + 1];
+    float den = y0 - 2.0f * y1 + y2;
+    *offset = best + ((den < 0.0f) ? 0.5f * (y0 - y2) / den : 0.0f);
+    return true;
+}
+
+// Teach the timing template a clean beat, aligned on its peak sample.
+// The template's reference point is then the average position of the
+// peak sample, which does not depend on earlier matches; aligning on the
+// matched time instead lets any bias of the match walk the reference,
+// and every later beat time with it. Plain average over the first beats,
+// then an exponential one
+static void shape_learn(ppg_dsp_t *dsp, uint32_t peak, uint32_t index) {
+    uint32_t first = peak - PPG_BEAT_SHAPE_PRE;
+    float mean = 0.0f;
+
+    if (!shape_window(dsp, peak, index)) {
+        return;
+    }
+    for (int i = 0; i < PPG_BEAT_SHAPE_LEN; i++) {
+        mean += (float)dsp->beat_hist[(first + i) & PPG_BEAT_HIST_MASK];
+    }
+    mean /= PPG_BEAT_SHAPE_LEN;
+
+    dsp->beat_shape_count++;
+    float alpha = 1.0f / dsp->beat_shape_count;
+    if (alpha < PPG_BEAT_SHAPE_ALPHA) {
+        alpha = PPG_BEAT_SHAPE_ALPHA;
+    }
+    for (int i = 0; i < PPG_BEAT_SHAPE_LEN; i++) {
+        float x = (float)dsp->beat_hist[(first + i) & PPG_BEAT_HIST_MASK] - mean;
+        dsp->beat_shape[i] += alpha * (x - dsp->beat_shape[i]);
+    }
+}
+
+// Band-passed samples around a peak for the template check, NULL if they
+// are not all in the history
+static const int32_t *beat_segment(const ppg_dsp_t *dsp, uint32_t peak, uint32_t index,
+                                   int32_t *out) {
+    uint32_t age = index - peak;
+
+    if (age < PPG_SQI_TEMPLATE_POST || age + PPG_SQI_TEMPLATE_PRE >= PPG_BEAT_HIST) {
+        return NULL;
+    }
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        out[i] = dsp->beat_hist[(peak - PPG_SQI_TEMPLATE_PRE + i) & PPG_BEAT_HIST_MASK];
+    }
+    return out;
+}
+
+// Detect heartbeat using peak detection; on a beat, *beat_us is the
+// interpolated time of the peak, *clean whether it passed the quality
+// checks and *timed whether a settled timing template placed it
+static bool detect_beat(ppg_dsp_t *dsp, int32_t ir_ac, uint32_t index, double *beat_us,
+                        bool *clean, bool *timed) {
+    // Track if we're in rising phase
+    if (ir_ac > dsp->beat_last_value) {
+        dsp->beat_rising = true;
+        if (ir_ac > dsp->beat_max_value) {
+            dsp->beat_max_value = ir_ac;
+            dsp->beat_max_index = index;
+        }
+    } else if (dsp->beat_rising && (dsp->beat_max_value - ir_ac) > PPG_BEAT_THRESHOLD) {
+        // Detected a peak (transition from rising to falling)
+        uint32_t age = index - dsp->beat_max_index;
+        bool edge = dsp->beat_max_index < dsp->run_start + PPG_SPO2_WINDOW - 1 + PPG_PEAK_FIT_HALF;
+        float offset = 0.0f;
+        bool matched = !edge && shape_offset(dsp, dsp->beat_max_index, index, &offset);
+        if (!edge && !matched && age >= PPG_PEAK_FIT_HALF && age + PPG_PEAK_FIT_HALF < PPG_BEAT_HIST) {
+            offset = peak_offset(dsp, dsp->beat_max_index);
+        }
+        *timed = matched && dsp->beat_shape_count >= PPG_BEAT_SHAPE_SETTLE;
+        *beat_us = sample_time_us(dsp, dsp->beat_max_index + offset);
+
+        uint32_t peak = dsp->beat_max_index;
+        int32_t peak_value = dsp->beat_max_value;
+        dsp->beat_rising = false;
+        dsp->beat_last_value = ir_ac;
+        dsp->beat_max_value = 0;
+
+        // A maximum right where detection started is the edge of the
+        // data, not a peak; its time would be wrong
+        if (edge) {
+            return false;
+        }
+
+        // Check if enough time passed since last beat
+        if (dsp->beat_count == 0 || *beat_us - dsp->last_beat_us > PPG_MIN_BEAT_MS * 1000.0) {
+            // A beat during motion is not trusted and must not teach the template
+            int32_t segment[PPG_SQI_TEMPLATE_LEN];
+            *clean = !dsp->sqi.motion &&
+                     ppg_sqi_beat(&dsp->sqi, beat_segment(dsp, peak, index, segment), peak_value);
+            if (*clean) {
+                shape_learn(dsp, peak, index);
+            }
+            return true;
+        }
+    }
+
+    dsp->beat_last_value = ir_ac;
+    return false;
+}
+
+static void record_beat(ppg_dsp_t *dsp, double beat_us, bool clean, bool timed) {
+    // An interval only counts between two clean beats; a reset, motion or
+    // an artifact breaks the chain
+    if (clean && dsp->beat_clean) {
+        uint32_t interval_us = (uint32_t)(beat_us - dsp->last_beat_us + 0.5);
+
+        // Order does not matter for the average, so overwrite the oldest
+        dsp->beat_intervals[dsp->interval_count & 3] = interval_us;
+        dsp->interval_count++;
+
+        // Peak-fitted beats are ms off on a slow pulse, and a young template
+        // still moves; HRV only takes intervals timed by a settled one
+        if (timed && dsp->beat_timed) {
+            hrv_push(&dsp->hrv, (interval_us + 500) / 1000);
+        } else {
+            hrv_break(&dsp->hrv);
+        }
+    } else if (!clean) {
+        hrv_break(&dsp->hrv);
+    }
+
+    dsp->beat_clean = clean;
+    dsp->beat_timed = timed;
+    dsp->beat_count++;
+    dsp->last_beat_us = beat_us;
+}
+
+// Calculate heart rate from beat intervals
+static uint8_t calculate_heart_rate(const ppg_dsp_t *dsp) {
+    if (dsp->interval_count < 1) {
+        return 0;  // Need at least 2 beats
+    }
+
+    // Average the last beat intervals (us)
+    uint32_t sum = 0;
+    int count = (dsp->interval_count < 4) ? (int)dsp->interval_count : 4;
+
+    for (int i = 0; i < count; i++) {
+        sum += dsp->beat_intervals[i];
+    }
+
+    uint32_t avg_interval = sum / count;
+
+    // Convert to BPM, rounded: 60000000 us / interval
+    uint16_t bpm = (60000000 + avg_interval / 2) / avg_interval;
+
+    // Sanity check: valid range 40-200 BPM
+    if (bpm < 40 || bpm > 200) {
+        return 0;
+    }
+
+    return (uint8_t)bpm;
+}
+
+// Coefficient of variation of the intervals the heart rate averages, -1
+// with fewer than two or when the last clean beat is too old
+static float interval_cv(const ppg_dsp_t *dsp, uint32_t index) {
+    if (dsp->interval_count < 2 || !dsp->beat_clean ||
+        sample_time_us(dsp, index) - dsp->last_beat_us > PPG_SQI_BEAT_GAP_MS * 1000.0) {
+        return -1.0f;
+    }
+
+    int count = (dsp->interval_count < 4) ? (int)dsp->interval_count : 4;
+    float mean = 0.0f;
+    for (int i = 0; i < count; i++) {
+        mean += (float)dsp->beat_intervals[i];
+    }
+    mean /= count;
+
+    float var = 0.0f;
+    for (int i = 0; i < count; i++) {
+        float d = (float)dsp->beat_intervals[i] - mean;
+        var += d * d;
+    }
+    return sqrtf(var / (count - 1)) / mean;
+}
+
+// Calculate SpO2 using red/IR ratio
+static uint8_t calculate_spo2(const ppg_dsp_t *dsp) {
+    if (!stream_window_full(&dsp->ir)) {
+        return 0;
+    }
+
+    // Get AC and DC components
+    uint32_t red_dc = stream_window_mean(&dsp->red);
+    uint32_t ir_dc = stream_window_mean(&dsp->ir);
+
+    if (red_dc == 0 || ir_dc == 0) {
+        return 0;
+    }
+
+    // Calculate AC components (peak-to-peak)
+    uint32_t red_ac = stream_window_max(&dsp->red) - stream_window_min(&dsp->red);
+    uint32_t ir_ac = stream_window_max(&dsp->ir) - stream_window_min(&dsp->ir);
+
+    if (ir_ac == 0) {
+        return 0;
+    }
+
+    // R = (Red_AC/Red_DC) / (IR_AC/IR_DC) in Q16, then the calibration table
+    uint32_t r_q16 = spo2_ratio_q16(red_ac, red_dc, ir_ac, ir_dc);
+    return spo2_lookup(&dsp->spo2_lut, r_q16);
+}
+
+//-----------------------------------------------------------------------------
+// Pipeline
+//-----------------------------------------------------------------------------
+
+static uint32_t sample_time_ms(uint32_t sample_index) {
+    return (uint32_t)((uint64_t)sample_index * 1000 / PPG_DSP_SAMPLE_RATE);
+}
+
+static void emit_result(ppg_dsp_t *dsp, uint8_t hr, uint8_t spo2, bool finger) {
+    if (dsp->cfg.on_result == NULL) {
+        return;
+    }
+
+    ppg_result_t result = {
+        .time_ms = (uint32_t)(sample_time_us(dsp, dsp->sample_index - 1) / 1000),
+        .heart_rate = hr,
+        .spo2 = spo2,
+        .beat_count = dsp->beat_count,
+        .finger = finger,
+        .quality = finger ? dsp->quality : 0,
+        .motion = finger && dsp->sqi.motion,
+    };
+    hrv_get(&dsp->hrv, &result.hrv);
+    dsp->cfg.on_result(&result, dsp->cfg.ctx);
+}
+
+// No finger or sensor saturated: drop everything collected so far
+static void finger_lost(ppg_dsp_t *dsp) {
+    if (dsp->ir.count > 0) {
+        emit_result(dsp, 0, 0, false);
+    }
+    ppg_dsp_reset(dsp);
+}
+
+// Run one filtered sample through the beat / HR pipeline
+static void process_sample(ppg_dsp_t *dsp, uint32_t red_raw, uint32_t ir_raw,
+                           int32_t ir_ac, uint32_t index) {
+    uint32_t current_time = sample_time_ms(index);     // Nominal, for the result cadence
+    double beat_us;
+    bool clean;
+    bool timed;
+
+    stream_window_push(&dsp->red, red_raw);
+    stream_window_push(&dsp->ir, ir_raw);
+    dsp->beat_hist[index & PPG_BEAT_HIST_MASK] = ir_ac;
+
+    // Need enough samples before processing
+    if (!stream_window_full(&dsp->ir)) {
+        return;
+    }
+
+    if (dsp->cfg.hr_engine == HR_ENGINE_AUTOCORR) {
+        hr_autocorr_push(&dsp->hr_ac, ir_ac);
+    }
+
+    uint32_t ir_dc = stream_window_mean(&dsp->ir);
+    uint32_t ir_p2p = stream_window_max(&dsp->ir) - stream_window_min(&dsp->ir);
+    ppg_sqi_sample(&dsp->sqi, ir_ac, ir_p2p, ir_dc, index);
+
+    if (detect_beat(dsp, ir_ac, index, &beat_us, &clean, &timed)) {
+        record_beat(dsp, beat_us, clean, timed);
+    }
+
+    // Calculate heart rate
+    if (current_time - dsp->last_calc_time > PPG_RESULT_PERIOD_MS) {
+        uint8_t hr = (dsp->cfg.hr_engine == HR_ENGINE_AUTOCORR) ?
+                     hr_autocorr_bpm(&dsp->hr_ac) : calculate_heart_rate(dsp);
+        uint8_t spo2 = calculate_spo2(dsp);
+        float perfusion = ir_dc ? (float)ir_p2p / ir_dc : 0.0f;
+        dsp->quality = ppg_sqi_quality(&dsp->sqi, perfusion, interval_cv(dsp, index));
+
+        // Only report a reading once both values are valid and the signal
+        // can be trusted
+        if (hr > 0 && spo2 > 0 && dsp->quality >= PPG_SQI_MIN_QUALITY) {
+            emit_result(dsp, hr, spo2, true);
+        } else {
+            emit_result(dsp, 0, 0, true);
+        }
+
+        dsp->last_calc_time = current_time;
+    }
+}
+
+// Band-pass a run of valid samples as one block, then walk it sample by sample
+static void process_run(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count) {
+    float ir_bp[PROCESS_CHUNK];
+
+    for (int done = 0; done < count; done += PROCESS_CHUNK) {
+        int n = (count - done < PROCESS_CHUNK) ? (count - done) : PROCESS_CHUNK;
+
+        ppg_filter_process(&dsp->ir_filter, &ir[done], ir_bp, n);
+
+        for (int i = 0; i < n; i++) {
+            uint32_t index = dsp->sample_index++;
+            process_sample(dsp, red[done + i], ir[done + i], (int32_t)ir_bp[i], index);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+bool ppg_dsp_init(ppg_dsp_t *dsp, const ppg_dsp_config_t *cfg) {
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->cfg = *cfg;
+
+    uint32_t rate = cfg->input_rate ? cfg->input_rate : PPG_DSP_SAMPLE_RATE;
+    int factor = (int)(rate / PPG_DSP_SAMPLE_RATE);
+    bool valid = rate % PPG_DSP_SAMPLE_RATE == 0 && ppg_decim_init(&dsp->decim, factor);
+    if (!valid) {
+        ppg_decim_init(&dsp->decim, 1);
+    }
+    dsp->cfg.input_rate = PPG_DSP_SAMPLE_RATE * dsp->decim.factor;
+    dsp->decim_delay = ppg_decim_delay(&dsp->decim);
+    ppg_clock_init(&dsp->clock, dsp->cfg.input_rate);
+
+    stream_window_init(&dsp->red, PPG_SPO2_WINDOW, true);
+    stream_window_init(&dsp->ir, PPG_SPO2_WINDOW, true);
+    ppg_filter_init(&dsp->ir_filter, PPG_DSP_SAMPLE_RATE);
+    hr_autocorr_reset(&dsp->hr_ac);
+    hrv_init(&dsp->hrv);
+    spo2_lut_build(&dsp->spo2_lut, &cfg->spo2_cal);
+    dsp->led_pa[PPG_AGC_RED] = PPG_AGC_PA_DEFAULT;
+    dsp->led_pa[PPG_AGC_IR] = PPG_AGC_PA_DEFAULT;
+    return valid;
+}
+
+void ppg_dsp_reset(ppg_dsp_t *dsp) {
+    stream_window_reset(&dsp->red);
+    stream_window_reset(&dsp->ir);
+    ppg_filter_reset(&dsp->ir_filter);
+    hr_autocorr_reset(&dsp->hr_ac);
+
+    dsp->beat_last_value = 0;
+    dsp->beat_max_value = 0;
+    dsp->beat_rising = false;
+    dsp->beat_shape_count = 0;
+    memset(dsp->beat_shape, 0, sizeof(dsp->beat_shape));
+    dsp->beat_count = 0;
+    dsp->beat_clean = false;
+    dsp->interval_count = 0;
+    dsp->run_start = dsp->sample_index;
+    hrv_break(&dsp->hrv);
+    ppg_sqi_reset(&dsp->sqi);
+    dsp->quality = 0;
+}
+
+void ppg_dsp_anchor(ppg_dsp_t *dsp, uint64_t input_index, int64_t t_us) {
+    ppg_clock_anchor(&dsp->clock, input_index, t_us);
+}
+
+void ppg_dsp_gap(ppg_dsp_t *dsp, uint32_t lost) {
+    if (lost == 0) {
+        return;
+    }
+
+    // Whatever the gap hid, the interval across it is not a beat interval
+    dsp->beat_clean = false;
+    hrv_break(&dsp->hrv);
+
+    if (dsp->input_count > 0 &&
+        (uint64_t)lost * 1000 <= (uint64_t)PPG_GAP_BRIDGE_MS * dsp->cfg.input_rate) {
+        uint32_t red[PROCESS_CHUNK];
+        uint32_t ir[PROCESS_CHUNK];
+        for (int i = 0; i < PROCESS_CHUNK; i++) {
+            red[i] = dsp->last_red;
+            ir[i] = dsp->last_ir;
+        }
+        while (lost > 0) {
+            int n = (lost < PROCESS_CHUNK) ? (int)lost : PROCESS_CHUNK;
+            ppg_dsp_process(dsp, red, ir, n);
+            lost -= n;
+        }
+
+        // Nor is one ending at a beat found in the held samples
+        dsp->beat_clean = false;
+        return;
+    }
+
+    dsp->input_count += lost;
+    dsp->sample_index += ppg_decim_skip(&dsp->decim, lost);
+    ppg_dsp_reset(dsp);
+}
+
+void ppg_dsp_reset_hrv(ppg_dsp_t *dsp) {
+    hrv_init(&dsp->hrv);
+}
+
+void ppg_dsp_set_hr_engine(ppg_dsp_t *dsp, hr_engine_t engine) {
+    if (dsp->cfg.hr_engine != engine) {
+        dsp->cfg.hr_engine = engine;
+        hr_autocorr_reset(&dsp->hr_ac);
+    }
+}
+
+void ppg_dsp_set_led(ppg_dsp_t *dsp, const uint8_t led_pa[2]) {
+    if (led_pa[PPG_AGC_RED] == dsp->led_pa[PPG_AGC_RED] &&
+        led_pa[PPG_AGC_IR] == dsp->led_pa[PPG_AGC_IR]) {
+        return;
+    }
+
+    // Sensor output is proportional to LED current
+    float red_gain = (float)led_pa[PPG_AGC_RED] / dsp->led_pa[PPG_AGC_RED];
+    float ir_gain = (float)led_pa[PPG_AGC_IR] / dsp->led_pa[PPG_AGC_IR];
+
+    ppg_decim_rescale(&dsp->decim, red_gain, ir_gain);
+    dsp->last_red = (uint32_t)(dsp->last_red * red_gain);
+    dsp->last_ir = (uint32_t)(dsp->last_ir * ir_gain);
+    stream_window_rescale(&dsp->red, red_gain);
+    stream_window_rescale(&dsp->ir, ir_gain);
+    ppg_filter_rescale(&dsp->ir_filter, ir_gain);
+    dsp->beat_last_value = (int32_t)(dsp->beat_last_value * ir_gain);
+    dsp->beat_max_value = (int32_t)(dsp->beat_max_value * ir_gain);
+    for (int i = 0; i < PPG_BEAT_HIST; i++) {
+        dsp->beat_hist[i] = (int32_t)(dsp->beat_hist[i] * ir_gain);
+    }
+    // The timing template is only matched against, so its scale does not matter
+    ppg_sqi_rescale(&dsp->sqi, ir_gain);
+    // hr_autocorr normalizes by window energy; a mid-window step only
+    // changes the weighting, not the period, so it is left as is
+
+    dsp->led_pa[PPG_AGC_RED] = led_pa[PPG_AGC_RED];
+    dsp->led_pa[PPG_AGC_IR] = led_pa[PPG_AGC_IR];
+}
+
+// Samples at PPG_DSP_SAMPLE_RATE
+static void process_decimated(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count) {
+    // Split the block into runs of finger-present samples
+    int run_start = 0;
+    for (int i = 0; i <= count; i++) {
+        if (i < count && ir[i] >= PPG_MIN_VALID_IR && ir[i] <= PPG_MAX_VALID_IR) {
+            continue;
+        }
+        if (i > run_start) {
+            process_run(dsp, &red[run_start], &ir[run_start], i - run_start);
+        }
+        if (i < count) {
+            dsp->sample_index++;
+            finger_lost(dsp);
+        }
+        run_start = i + 1;
+    }
+}
+
+void ppg_dsp_process(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count) {
+    uint32_t red_out[PROCESS_CHUNK];
+    uint32_t ir_out[PROCESS_CHUNK];
+
+    if (count <= 0) {
+        return;
+    }
+    dsp->input_count += count;
+    dsp->last_red = red[count - 1];
+    dsp->last_ir = ir[count - 1];
+    if (dsp->decim.factor == 1) {
+        process_decimated(dsp, red, ir, count);
+        return;
+    }
+
+    // Whole output periods per chunk, so each call yields at most PROCESS_CHUNK
+    const int chunk = (PROCESS_CHUNK - 1) * dsp->decim.factor;
+    for (int done = 0; done < count; done += chunk) {
+        int n = (count - done < chunk) ? (count - done) : chunk;
+        int out = ppg_decim_process(&dsp->decim, &red[done], &ir[done], n, red_out, ir_out);
+        process_decimated(dsp, red_out, ir_out, out);
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * PPG FIFO Bookkeeping Module
+ * Gaps and repeats on the sample timeline from the MAX30102 FIFO pointers
+ */
+
+#include "ppg_fifo.h"
+
+void ppg_fifo_reset(ppg_fifo_t *f, uint32_t rate) {
+    f->rate = rate;
+    f->rd_known = false;
+    f->rd_ptr = 0;
+    f->delivered = 0;
+    f->read_count = 0;
+    f->lost_after = 0;
+    f->status_us = 0;
+}
+
+void ppg_fifo_status(ppg_fifo_t *f, const ppg_fifo_regs_t *regs, int64_t now_us,
+                     ppg_fifo_burst_t *burst) {
+    uint8_t wr_ptr = regs->wr_ptr & PPG_FIFO_PTR_MASK;
+    uint8_t rd_ptr = regs->rd_ptr & PPG_FIFO_PTR_MASK;
+    uint8_t ovf = regs->ovf & PPG_FIFO_OVF_MAX;
+
+    int duplicates = 0;
+
+    burst->lost = f->lost_after;
+    burst->overflow = 0;
+    f->lost_after = 0;
+    if (f->rd_known) {
+        int popped = (rd_ptr - f->rd_ptr) & PPG_FIFO_PTR_MASK;
+        if (popped == 0 && f->delivered == PPG_FIFO_DEPTH) {
+            popped = PPG_FIFO_DEPTH;
+        }
+        if (popped > f->delivered) {
+            burst->lost += popped - f->delivered;
+        } else {
+            duplicates = f->delivered - popped;
+        }
+    }
+
+    if (ovf > 0) {
+        // A saturated counter only says "at least"; the time since the last
+        // snapshot, when the FIFO was drained, bounds the real loss
+        uint32_t lost = ovf;
+        if (ovf == PPG_FIFO_OVF_MAX && f->status_us > 0) {
+            uint32_t produced = (uint32_t)((now_us - f->status_us) * f->rate / 1000000);
+            if (produced > PPG_FIFO_DEPTH + lost) {
+                lost = produced - PPG_FIFO_DEPTH;
+            }
+        }
+        f->lost_after = lost;
+        burst->overflow = lost;
+
+        // All 32 slots hold valid data (WR_PTR == RD_PTR)
+        burst->count = PPG_FIFO_DEPTH;
+    } else if (wr_ptr == rd_ptr && duplicates > 0) {
+        // Empty and full look alike; samples still waiting to be popped
+        // mean full
+        burst->count = PPG_FIFO_DEPTH;
+    } else {
+        burst->count = (wr_ptr - rd_ptr) & PPG_FIFO_PTR_MASK;
+    }
+
+    // The rest are skipped in a later burst
+    burst->duplicates = (duplicates < burst->count) ? duplicates : burst->count;
+    f->rd_ptr = rd_ptr;
+    f->delivered = duplicates;
+    f->read_count = 0;
+    f->rd_known = true;
+    f->status_us = now_us;
+}
+
+void ppg_fifo_read_start(ppg_fifo_t *f, int count, bool started) {
+    // A refused transfer pops nothing and delivers nothing
+    f->read_count = started ? count : 0;
+}
+
+void ppg_fifo_read_done(ppg_fifo_t *f, bool ok) {
+    if (ok && f->read_count > f->delivered) {
+        f->delivered = f->read_count;
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * PPG Filter Module
+ * DC blocker + 0.5-5Hz biquad band-pass, run over blocks of samples
+ */
+
+#include "ppg_filter.h"
+#include <math.h>
+#include <string.h>
+
+// esp-dsp provides optimized biquad kernels and is required in ESP-IDF
+// builds (idf_component.yml); the reference implementation below computes
+// the same recurrence and is only for host builds such as tools/ppg_bench
+#if __has_include("dsps_biquad.h")
+#include "dsps_biquad.h"
+#define PPG_USE_ESP_DSP 1
+#elif defined(ESP_PLATFORM)
+#error "esp-dsp not found: check the espressif/esp-dsp dependency in idf_component.yml"
+#else
+#define PPG_USE_ESP_DSP 0
+#endif
+
+#if !PPG_USE_ESP_DSP
+static void biquad_f32(const float *input, float *output, int len, const float *coef, float *w) {
+    for (int i = 0; i < len; i++) {
+        float d0 = input[i] - coef[3] * w[0] - coef[4] * w[1];
+        output[i] = coef[0] * d0 + coef[1] * w[0] + coef[2] * w[1];
+        w[1] = w[0];
+        w[0] = d0;
+    }
+}
+#endif
+
+// RBJ cookbook designs, f = cutoff / sample rate
+static void biquad_gen_lpf(float *coef, float f, float q) {
+    float w0 = 2 * (float)M_PI * f;
+    float c = cosf(w0);
+    float alpha = sinf(w0) / (2 * q);
+    float a0 = 1 + alpha;
+
+    coef[0] = (1 - c) / 2 / a0;
+    coef[1] = (1 - c) / a0;
+    coef[2] = coef[0];
+    coef[3] = -2 * c / a0;
+    coef[4] = (1 - alpha) / a0;
+}
+
+static void biquad_gen_hpf(float *coef, float f, float q) {
+    float w0 = 2 * (float)M_PI * f;
+    float c = cosf(w0);
+    float alpha = sinf(w0) / (2 * q);
+    float a0 = 1 + alpha;
+
+    coef[0] = (1 + c) / 2 / a0;
+    coef[1] = -(1 + c) / a0;
+    coef[2] = coef[0];
+    coef[3] = -2 * c / a0;
+    coef[4] = (1 - alpha) / a0;
+}
+
+void ppg_filter_init(ppg_filter_t *f, uint32_t sample_rate_hz) {
+    const float q = 0.70710678f;    // Butterworth
+
+    // y[n] = x[n] - x[n-1] + p*y[n-1]
+    f->coef[0][0] = 1.0f;
+    f->coef[0][1] = -1.0f;
+    f->coef[0][2] = 0.0f;
+    f->coef[0][3] = -PPG_FILTER_DC_POLE;
+    f->coef[0][4] = 0.0f;
+
+    biquad_gen_hpf(f->coef[1], PPG_FILTER_HP_HZ / sample_rate_hz, q);
+    biquad_gen_lpf(f->coef[2], PPG_FILTER_LP_HZ / sample_rate_hz, q);
+
+    ppg_filter_reset(f);
+}
+
+void ppg_filter_reset(ppg_filter_t *f) {
+    memset(f->w, 0, sizeof(f->w));
+    f->offset = 0;
+    f->primed = false;
+}
+
+void ppg_filter_rescale(ppg_filter_t *f, float gain) {
+    if (!f->primed) {
+        return;
+    }
+
+    // Linear stages: scaled state + scaled offset == scaled history
+    for (int s = 0; s < PPG_FILTER_STAGES; s++) {
+        f->w[s][0] *= gain;
+        f->w[s][1] *= gain;
+    }
+    f->offset = (int32_t)lroundf((float)f->offset * gain);
+}
+
+void ppg_filter_process(ppg_filter_t *f, const uint32_t *in, float *out, int len) {
+    float scratch[PPG_FILTER_BLOCK];
+
+    if (len > 0 && !f->primed) {
+        f->offset = (int32_t)in[0];
+        f->primed = true;
+    }
+
+    for (int done = 0; done < len; done += PPG_FILTER_BLOCK) {
+        int n = (len - done < PPG_FILTER_BLOCK) ? (len - done) : PPG_FILTER_BLOCK;
+        float *dst = &out[done];
+
+        for (int i = 0; i < n; i++) {
+            scratch[i] = (float)((int32_t)in[done + i] - f->offset);
+        }
+
+        // Ping-pong between scratch and the output so no kernel runs in place
+#if PPG_USE_ESP_DSP
+        dsps_biquad_f32(scratch, dst, n, f->coef[0], f->w[0]);
+        dsps_biquad_f32(dst, scratch, n, f->coef[1], f->w[1]);
+        dsps_biquad_f32(scratch, dst, n, f->coef[2], f->w[2]);
+#else
+        biquad_f32(scratch, dst, n, f->coef[0], f->w[0]);
+        biquad_f32(dst, scratch, n, f->coef[1], f->w[1]);
+        biquad_f32(scratch, dst, n, f->coef[2], f->w[2]);
+#endif
+    }
+}
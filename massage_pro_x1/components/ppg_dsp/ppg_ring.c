@@ -0,0 +1,64 @@
+/*
+ * PPG Sample Ring Module
+ * Lock-free SPSC handoff from the acquisition task to the processing task
+ */
+
+#include "ppg_ring.h"
+
+bool ppg_ring_init(ppg_ring_t *r, void *storage, size_t slot_size, uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+
+    r->slots = storage;
+    r->slot_size = slot_size;
+    r->capacity = capacity;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->high_water = 0;
+    r->overruns = 0;
+    return true;
+}
+
+// Indices run freely and wrap at 2^32; the difference is the fill level
+void *ppg_ring_claim(ppg_ring_t *r) {
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail >= r->capacity) {
+        r->overruns++;
+        return NULL;
+    }
+    return &r->slots[(head & (r->capacity - 1)) * r->slot_size];
+}
+
+void ppg_ring_publish(ppg_ring_t *r) {
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed) + 1;
+    uint32_t used = head - atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (used > r->high_water) {
+        r->high_water = used;
+    }
+    atomic_store_explicit(&r->head, head, memory_order_release);
+}
+
+const void *ppg_ring_peek(ppg_ring_t *r) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return &r->slots[(tail & (r->capacity - 1)) * r->slot_size];
+}
+
+void ppg_ring_release(ppg_ring_t *r) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+uint32_t ppg_ring_count(const ppg_ring_t *r) {
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return head - tail;
+}
@@ -0,0 +1,132 @@
+/*
+ * PPG Signal Quality Module
+ * Perfusion, beat template correlation, interval consistency and motion
+ */
+
+#include "ppg_sqi.h"
+#include <math.h>
+#include <string.h>
+
+#define SHAPE_ALPHA     0.125f  // Template update per clean beat
+#define CORR_ALPHA      0.25f   // Correlation smoothing per beat
+#define AMP_ALPHA       0.125f  // Pulse amplitude smoothing per clean beat
+
+// Score 0 at `bad`, 1 at `good`, linear in between
+static float ramp(float x, float bad, float good) {
+    float s = (x - bad) / (good - bad);
+    return (s < 0.0f) ? 0.0f : (s > 1.0f) ? 1.0f : s;
+}
+
+// Zero mean, unit variance in place; false for a flat segment
+static bool standardize(float *v) {
+    float mean = 0.0f;
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        mean += v[i];
+    }
+    mean /= PPG_SQI_TEMPLATE_LEN;
+
+    float energy = 0.0f;
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        v[i] -= mean;
+        energy += v[i] * v[i];
+    }
+    if (energy <= 0.0f) {
+        return false;
+    }
+
+    float scale = sqrtf(PPG_SQI_TEMPLATE_LEN / energy);
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        v[i] *= scale;
+    }
+    return true;
+}
+
+static void learn(ppg_sqi_t *q, const float *beat, int32_t peak) {
+    memcpy(q->shape, beat, sizeof(q->shape));
+    q->has_shape = true;
+    q->reject_run = 0;
+    q->pulse_amp = (float)peak;
+}
+
+void ppg_sqi_reset(ppg_sqi_t *q) {
+    memset(q, 0, sizeof(*q));
+}
+
+bool ppg_sqi_sample(ppg_sqi_t *q, int32_t ir_ac, uint32_t ir_p2p, uint32_t ir_dc, uint32_t index) {
+    bool hit = ir_dc > 0 && (float)ir_p2p > PPG_SQI_MOTION_PI * ir_dc;
+
+    if (q->pulse_amp > 0.0f && fabsf((float)ir_ac) > PPG_SQI_MOTION_RATIO * q->pulse_amp) {
+        hit = true;
+    }
+    if (hit) {
+        q->motion_until = index + PPG_SQI_MOTION_HOLD;
+        q->motion = true;
+    } else if (q->motion && (int32_t)(index - q->motion_until) >= 0) {
+        q->motion = false;
+    }
+    return q->motion;
+}
+
+bool ppg_sqi_beat(ppg_sqi_t *q, const int32_t *segment, int32_t peak) {
+    float beat[PPG_SQI_TEMPLATE_LEN];
+
+    // Nothing to compare: neither evidence for nor against the beat
+    if (segment == NULL) {
+        return true;
+    }
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        beat[i] = (float)segment[i];
+    }
+    if (!standardize(beat)) {
+        return true;
+    }
+    if (!q->has_shape) {
+        learn(q, beat, peak);
+        q->corr = 1.0f;
+        return true;
+    }
+
+    // Both have unit variance, so the mean product is the correlation
+    float corr = 0.0f;
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        corr += beat[i] * q->shape[i];
+    }
+    corr /= PPG_SQI_TEMPLATE_LEN;
+    q->corr += CORR_ALPHA * (((corr > 0.0f) ? corr : 0.0f) - q->corr);
+
+    if (corr < PPG_SQI_BEAT_CORR) {
+        if (++q->reject_run >= PPG_SQI_RELEARN_REJECTS) {
+            learn(q, beat, peak);
+        }
+        return false;
+    }
+
+    // Blending two shapes lowers the variance; restore it so the product
+    // above stays a correlation
+    for (int i = 0; i < PPG_SQI_TEMPLATE_LEN; i++) {
+        q->shape[i] += SHAPE_ALPHA * (beat[i] - q->shape[i]);
+    }
+    standardize(q->shape);
+    q->pulse_amp += AMP_ALPHA * ((float)peak - q->pulse_amp);
+    q->reject_run = 0;
+    return true;
+}
+
+uint8_t ppg_sqi_quality(const ppg_sqi_t *q, float perfusion, float interval_cv) {
+    if (q->motion || !q->has_shape || interval_cv < 0.0f) {
+        return 0;
+    }
+
+    float score = ramp(perfusion, PPG_SQI_PI_MIN, PPG_SQI_PI_GOOD);
+    float s = ramp(q->corr, PPG_SQI_BEAT_CORR, PPG_SQI_CORR_GOOD);
+    score = (s < score) ? s : score;
+    s = ramp(interval_cv, PPG_SQI_CV_BAD, PPG_SQI_CV_GOOD);
+    score = (s < score) ? s : score;
+
+    return (uint8_t)(score * 100.0f + 0.5f);
+}
+
+void ppg_sqi_rescale(ppg_sqi_t *q, float gain) {
+    // The template is normalized; only the amplitude is in sensor units
+    q->pulse_amp *= gain;
+}
@@ -0,0 +1,50 @@
+/*
+ * PPG Synthetic Signal Module
+ * Pulse generator used by the synthetic source and tools/ppg_bench
+ */
+
+#include "ppg_synth.h"
+#include <math.h>
+
+#define SYNTH_PI            3.14159265f
+#define SYNTH_WANDER_S      200     // 30 whole wander cycles; keeps t small in float
+
+void ppg_synth_init(ppg_synth_t *s, float heart_rate, float spo2, uint32_t rate, uint32_t seed) {
+    s->heart_rate = heart_rate;
+    s->spo2 = spo2;
+    s->rate = rate;
+    s->rng = seed ? seed : 1;
+    s->phase = 0.0f;
+    s->index = 0;
+}
+
+// xorshift32: deterministic across targets, unlike rand()
+static float synth_noise(ppg_synth_t *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return PPG_SYNTH_NOISE * ((float)(s->rng & 0xFFFF) / 65535.0f - 0.5f);
+}
+
+// Pulse with two harmonics (dicrotic shape), slow baseline wander and noise
+void ppg_synth_generate(ppg_synth_t *s, uint32_t *red, uint32_t *ir, int count) {
+    float ratio = (110.0f - s->spo2) / 25.0f;
+    float red_ac = ratio * PPG_SYNTH_IR_AC * PPG_SYNTH_RED_DC / PPG_SYNTH_IR_DC;
+    float step = s->heart_rate / 60.0f / s->rate;
+
+    for (int i = 0; i < count; i++) {
+        float t = (float)(s->index % (SYNTH_WANDER_S * s->rate)) / s->rate;
+        float x = 2.0f * SYNTH_PI * s->phase;
+        float pulse = 0.5f * (sinf(x) + 0.35f * sinf(2.0f * x) + 0.1f * sinf(3.0f * x)) / 1.2f;
+        float wander = PPG_SYNTH_WANDER * sinf(2.0f * SYNTH_PI * PPG_SYNTH_WANDER_HZ * t);
+
+        ir[i] = (uint32_t)(PPG_SYNTH_IR_DC * (1.0f + wander) - PPG_SYNTH_IR_AC * pulse + synth_noise(s));
+        red[i] = (uint32_t)(PPG_SYNTH_RED_DC * (1.0f + wander) - red_ac * pulse + synth_noise(s));
+
+        s->phase += step;
+        if (s->phase >= 1.0f) {
+            s->phase -= 1.0f;
+        }
+        s->index++;
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * PPG Waveform Packing Module
+ * Prediction + zig-zag + grouped bit packing for the BLE waveform stream
+ */
+
+#include "ppg_wavepack.h"
+
+// Bits needed for v, 0 for 0
+static uint8_t bit_width(uint32_t v) {
+    return v ? (uint8_t)(32 - __builtin_clz(v)) : 0;
+}
+
+static size_t group_bytes(int count, uint8_t width) {
+    return 1 + ((size_t)count * width + 7) / 8;
+}
+
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static void close_group(ppg_wavepack_t *w) {
+    bool linear = w->linear_width < w->delta_width;
+    const uint32_t *res = linear ? w->linear : w->delta;
+    uint8_t width = linear ? w->linear_width : w->delta_width;
+    uint8_t *p = &w->out[w->len];
+    uint64_t acc = 0;
+    int bits = 0;
+
+    *p++ = width | (w->drop << PPG_WAVEPACK_DROP_SHIFT) | (linear ? PPG_WAVEPACK_LINEAR : 0);
+    for (int i = 0; i < w->group_count; i++) {
+        acc = (acc << width) | res[i];
+        bits += width;
+        while (bits >= 8) {
+            bits -= 8;
+            *p++ = (uint8_t)(acc >> bits);
+        }
+    }
+    if (bits > 0) {
+        *p++ = (uint8_t)(acc << (8 - bits));
+    }
+
+    w->len = p - w->out;
+    w->group_count = 0;
+    w->delta_width = 0;
+    w->linear_width = 0;
+}
+
+void ppg_wavepack_init(ppg_wavepack_t *w, uint8_t *out, size_t capacity, uint8_t drop) {
+    w->out = out;
+    w->capacity = capacity;
+    w->len = 0;
+    w->count = 0;
+    w->last = 0;
+    w->last2 = 0;
+    w->group_count = 0;
+    w->delta_width = 0;
+    w->linear_width = 0;
+    w->drop = (drop < PPG_WAVEPACK_MAX_DROP) ? drop : PPG_WAVEPACK_MAX_DROP;
+}
+
+bool ppg_wavepack_add(ppg_wavepack_t *w, uint32_t sample) {
+    // The middle of the step the decoder will reproduce
+    if (w->drop > 0) {
+        sample = (sample >> w->drop << w->drop) | (1u << (w->drop - 1));
+    }
+
+    if (w->count == 0) {
+        if (w->capacity < PPG_WAVEPACK_KEY_LEN) {
+            return false;
+        }
+        w->out[0] = (sample >> 16) & 0xFF;
+        w->out[1] = (sample >> 8) & 0xFF;
+        w->out[2] = sample & 0xFF;
+        w->len = PPG_WAVEPACK_KEY_LEN;
+        w->last = sample;
+        w->last2 = sample;
+        w->count = 1;
+        return true;
+    }
+
+    // Small residuals of either sign become small unsigned values. All
+    // samples share their low bits, so residuals are exact multiples of the step.
+    int32_t delta = (int32_t)(sample - w->last) >> w->drop;
+    uint32_t zz_delta = zigzag(delta);
+    uint32_t zz_linear = zigzag(delta - ((int32_t)(w->last - w->last2) >> w->drop));
+    uint8_t delta_width = bit_width(zz_delta);
+    uint8_t linear_width = bit_width(zz_linear);
+    if (delta_width < w->delta_width) {
+        delta_width = w->delta_width;
+    }
+    if (linear_width < w->linear_width) {
+        linear_width = w->linear_width;
+    }
+
+    uint8_t width = (linear_width < delta_width) ? linear_width : delta_width;
+    if (w->len + group_bytes(w->group_count + 1, width) > w->capacity) {
+        return false;
+    }
+
+    w->delta[w->group_count] = zz_delta;
+    w->linear[w->group_count] = zz_linear;
+    w->group_count++;
+    w->delta_width = delta_width;
+    w->linear_width = linear_width;
+    w->last2 = w->last;
+    w->last = sample;
+    w->count++;
+    if (w->group_count == PPG_WAVEPACK_GROUP) {
+        close_group(w);
+    }
+    return true;
+}
+
+size_t ppg_wavepack_finish(ppg_wavepack_t *w) {
+    if (w->group_count > 0) {
+        close_group(w);
+    }
+    return w->len;
+}
+
+bool ppg_wavepack_decode(const uint8_t *in, size_t len, int count, uint32_t *out) {
+    if (count <= 0) {
+        return true;
+    }
+    if (len < PPG_WAVEPACK_KEY_LEN) {
+        return false;
+    }
+
+    const uint8_t *p = in + PPG_WAVEPACK_KEY_LEN;
+    const uint8_t *end = in + len;
+    uint32_t last = (uint32_t)in[0] << 16 | (uint32_t)in[1] << 8 | in[2];
+    uint32_t last2 = last;
+    out[0] = last;
+
+    for (int n = 1; n < count; ) {
+        if (p >= end) {
+            return false;
+        }
+        bool linear = (*p & PPG_WAVEPACK_LINEAR) != 0;
+        uint8_t drop = (*p & PPG_WAVEPACK_DROP_MASK) >> PPG_WAVEPACK_DROP_SHIFT;
+        uint8_t width = *p++ & PPG_WAVEPACK_WIDTH_MASK;
+        int group = (count - n < PPG_WAVEPACK_GROUP) ? (count - n) : PPG_WAVEPACK_GROUP;
+        if (width > PPG_WAVEPACK_MAX_WIDTH || (size_t)(end - p) < group_bytes(group, width) - 1) {
+            return false;
+        }
+
+        uint64_t acc = 0;
+        int bits = 0;
+        for (int i = 0; i < group; i++) {
+            while (bits < width) {
+                acc = (acc << 8) | *p++;
+                bits += 8;
+            }
+            bits -= width;
+            uint32_t zz = (uint32_t)(acc >> bits) & ((1u << width) - 1);
+            uint32_t sample = last + ((uint32_t)((zz >> 1) ^ -(zz & 1)) << drop);
+            if (linear) {
+                sample += last - last2;
+            }
+            last2 = last;
+            last = sample;
+            out[n++] = sample;
+        }
+    }
+    return true;
+}
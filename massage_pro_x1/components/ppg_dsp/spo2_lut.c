@@ -0,0 +1,48 @@
+/*
+ * SpO2 Lookup Module
+ * Fixed-point ratio of ratios and R -> SpO2 calibration table
+ */
+
+#include "spo2_lut.h"
+
+void spo2_lut_build(spo2_lut_t *lut, const spo2_cal_t *cal) {
+    for (int i = 0; i < SPO2_LUT_SIZE; i++) {
+        // Evaluate at the centre of each bin, R in Q16
+        int64_t r = ((int64_t)i << SPO2_LUT_SHIFT) + (1 << (SPO2_LUT_SHIFT - 1));
+
+        // Q16 + Q16*Q16>>16 + Q16*Q16*Q16>>32, all Q16
+        int64_t r2 = (r * r) >> SPO2_R_FRAC_BITS;
+        int64_t spo2 = (int64_t)cal->a
+                     + (((int64_t)cal->b * r) >> SPO2_R_FRAC_BITS)
+                     + (((int64_t)cal->c * r2) >> SPO2_R_FRAC_BITS);
+
+        // Truncate to whole percent, clamp to valid range
+        spo2 >>= SPO2_R_FRAC_BITS;
+        if (spo2 > SPO2_MAX) spo2 = SPO2_MAX;
+        if (spo2 < SPO2_MIN) spo2 = SPO2_MIN;
+
+        lut->table[i] = (uint8_t)spo2;
+    }
+}
+
+uint32_t spo2_ratio_q16(uint32_t red_ac, uint32_t red_dc, uint32_t ir_ac, uint32_t ir_dc) {
+    // Inputs are 18-bit, so each product fits in 36 bits and the shifted
+    // numerator in 52 bits
+    uint64_t num = ((uint64_t)red_ac * ir_dc) << SPO2_R_FRAC_BITS;
+    uint64_t den = (uint64_t)ir_ac * red_dc;
+
+    if (num == 0 || den == 0) {
+        return 0;
+    }
+
+    uint64_t r = num / den;
+    return (r > UINT32_MAX) ? UINT32_MAX : (uint32_t)r;
+}
+
+uint8_t spo2_lookup(const spo2_lut_t *lut, uint32_t r_q16) {
+    uint32_t idx = r_q16 >> SPO2_LUT_SHIFT;
+    if (idx >= SPO2_LUT_SIZE) {
+        idx = SPO2_LUT_SIZE - 1;
+    }
+    return lut->table[idx];
+}
@@ -0,0 +1,79 @@
+/*
+ * Streaming Window Module
+ * O(1) sliding-window sum, mean, min and max over a sample stream
+ */
+
+#include "stream_window.h"
+#include <math.h>
+
+void stream_window_init(stream_window_t *w, uint32_t length, bool track_extrema) {
+    if (length < 1) {
+        length = 1;
+    } else if (length > STREAM_WINDOW_CAPACITY) {
+        length = STREAM_WINDOW_CAPACITY;
+    }
+
+    w->length = length;
+    w->track_extrema = track_extrema;
+    stream_window_reset(w);
+}
+
+void stream_window_reset(stream_window_t *w) {
+    w->sum = 0;
+    w->count = 0;
+    w->seq = 0;
+    w->max_head = w->max_tail = 0;
+    w->min_head = w->min_tail = 0;
+}
+
+void stream_window_push(stream_window_t *w, uint32_t value) {
+    uint32_t n = w->seq;
+
+    // Evict the sample leaving the window before its slot is reused
+    if (w->count >= w->length) {
+        uint32_t expired = n - w->length;
+        w->sum -= w->data[expired & STREAM_WINDOW_MASK];
+
+        if (w->track_extrema) {
+            if (w->max_q[w->max_head & STREAM_WINDOW_MASK] == expired) {
+                w->max_head++;
+            }
+            if (w->min_q[w->min_head & STREAM_WINDOW_MASK] == expired) {
+                w->min_head++;
+            }
+        }
+    } else {
+        w->count++;
+    }
+
+    w->data[n & STREAM_WINDOW_MASK] = value;
+    w->sum += value;
+    w->seq = n + 1;
+
+    if (!w->track_extrema) {
+        return;
+    }
+
+    // Drop entries the new sample dominates; each index enters and leaves
+    // each deque once, so this is amortized O(1)
+    while (w->max_tail != w->max_head &&
+           w->data[w->max_q[(w->max_tail - 1) & STREAM_WINDOW_MASK] & STREAM_WINDOW_MASK] <= value) {
+        w->max_tail--;
+    }
+    w->max_q[w->max_tail++ & STREAM_WINDOW_MASK] = n;
+
+    while (w->min_tail != w->min_head &&
+           w->data[w->min_q[(w->min_tail - 1) & STREAM_WINDOW_MASK] & STREAM_WINDOW_MASK] >= value) {
+        w->min_tail--;
+    }
+    w->min_q[w->min_tail++ & STREAM_WINDOW_MASK] = n;
+}
+
+void stream_window_rescale(stream_window_t *w, float gain) {
+    w->sum = 0;
+    for (uint32_t i = 0; i < w->count; i++) {
+        uint32_t slot = (w->seq - 1 - i) & STREAM_WINDOW_MASK;
+        w->data[slot] = (uint32_t)lroundf((float)w->data[slot] * gain);
+        w->sum += w->data[slot];
+    }
+}
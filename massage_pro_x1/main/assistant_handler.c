@@ -7,13 +7,19 @@
 #include "driver/ledc.h"
 #include "assistant_handler.h"
 #include "motor_control.h"  // Add this
+#include "max30102.h"
 #include "esp_log.h"
 #define TAG "ASSISTANT"
+#define STAY_STILL_PROMPT_S 15      // Minimum gap between "please stay still" prompts
 
 // External references (these should be in your main file)
 extern device_state_t device_state;
 extern assistant_config_t assistant_config;
 
+// Session HRV baseline, taken once the restarted ring has enough beats
+static hrv_metrics_t hrv_baseline;
+static volatile bool hrv_baseline_valid = false;
+
 
 
 esp_err_t assistant_start_session(uint8_t level, bool heat, uint16_t duration_min) {
@@ -44,6 +50,11 @@ esp_err_t assistant_start_session(uint8_t level, bool heat, uint16_t duration_mi
     assistant_config.duration_minutes = duration_min;
     assistant_config.start_time = xTaskGetTickCount() * portTICK_PERIOD_MS / 1000;
     assistant_config.active = 1;
+
+    // Score the session against HRV measured from its own start
+    hrv_baseline_valid = false;
+    max30102_set_session_active(true);
+    max30102_restart_hrv();
     
     // Apply settings
     device_state.intensity_level = level;
@@ -86,6 +97,7 @@ esp_err_t assistant_stop_session(void) {
     
     // Deactivate assistant
     assistant_config.active = 0;
+    max30102_set_session_active(false);
     
     // Stop motor
     device_state.intensity_level = 0;
@@ -131,28 +143,69 @@ bool assistant_is_active(void) {
     return assistant_config.active != 0;
 }
 
-static void assistant_timer_task(void *arg) {
+bool assistant_get_hrv(hrv_metrics_t *current, hrv_metrics_t *baseline) {
+    if (current != NULL) {
+        max30102_get_hrv(current);
+    }
+    if (baseline != NULL) {
+        *baseline = hrv_baseline;
+    }
+    return hrv_baseline_valid;
+}
+
+// Take the baseline from the first complete reading of the session
+static void assistant_track_hrv(void) {
+    hrv_metrics_t hrv;
+
+    if (hrv_baseline_valid) {
+        return;
+    }
+    max30102_get_hrv(&hrv);
+    if (hrv.intervals >= HRV_MIN_INTERVALS) {
+        hrv_baseline = hrv;
+        hrv_baseline_valid = true;
+        ESP_LOGI(TAG, "HRV baseline: RMSSD %.1f ms, SDNN %.1f ms, pNN50 %.0f%%",
+                 hrv.rmssd_ms, hrv.sdnn_ms, hrv.pnn50);
+    }
+}
+
+static void assistant_log_hrv(const char *when) {
+    hrv_metrics_t hrv;
+
+    if (!assistant_get_hrv(&hrv, NULL)) {
+        return;
+    }
+    ESP_LOGI(TAG, "HRV %s: RMSSD %.1f ms (baseline %.1f), SDNN %.1f ms, pNN50 %.0f%%, %u beats",
+             when, hrv.rmssd_ms, hrv_baseline.rmssd_ms, hrv.sdnn_ms, hrv.pnn50, hrv.intervals);
+}
+
+void assistant_timer_task(void *arg) {
     static bool one_minute_warning_sent = false;
     bool session_started_announced = false;
+    TickType_t last_still_prompt = 0;
+    bool still_prompted = false;
     
     ESP_LOGI(TAG, "Assistant timer task started");
     
     while (1) {
-        if (assistant_active && assistant_duration > 0) {
-            uint32_t elapsed = (esp_timer_get_time() - assistant_start_time) / 1000000;
-            uint32_t total = assistant_duration * 60;
+        if (assistant_config.active && assistant_config.duration_minutes > 0) {
+            uint32_t elapsed = assistant_get_elapsed_seconds();
+            uint32_t total = assistant_config.duration_minutes * 60;
             uint32_t remaining = (elapsed < total) ? (total - elapsed) : 0;
             
             // Announce session start (only once per session)
             if (elapsed == 0 && !session_started_announced) {
-                ESP_LOGI(TAG, "Starting therapy session: %lu minutes", assistant_duration);
+                ESP_LOGI(TAG, "Starting therapy session: %u minutes", assistant_config.duration_minutes);
                 audio_notify(AUDIO_NOTIFY_SESSION_START);
                 session_started_announced = true;
             }
             
+            assistant_track_hrv();
+
             // Check if session completed
             if (remaining == 0) {
                 ESP_LOGI(TAG, "Session completed!");
+                assistant_log_hrv("at end");
                 
                 // Play completion voice instead of double beep
                 audio_notify(AUDIO_NOTIFY_SESSION_COMPLETE);
@@ -171,12 +224,23 @@ static void assistant_timer_task(void *arg) {
             if (elapsed % 30 == 0 && elapsed > 0) {
                 ESP_LOGI(TAG, "Session status: %lu/%lu seconds (%lu remaining)",
                          elapsed, total, remaining);
+                assistant_log_hrv("now");
             }
         } else {
             // Reset flags when not active
             one_minute_warning_sent = false;
             session_started_announced = false;
         }
+
+        // Motion suppresses readings; prompt, but at most every STAY_STILL_PROMPT_S
+        if (max30102_motion_detected()) {
+            TickType_t now = xTaskGetTickCount();
+            if (!still_prompted || now - last_still_prompt >= pdMS_TO_TICKS(STAY_STILL_PROMPT_S * 1000)) {
+                audio_notify(AUDIO_NOTIFY_PLEASE_STAY_STILL);
+                last_still_prompt = now;
+                still_prompted = true;
+            }
+        }
         
         // Check every second
         vTaskDelay(pdMS_TO_TICKS(1000));
@@ -6,6 +6,7 @@
 #include "esp_err.h"
 #include "commands.h"
 #include "motor_control.h"
+#include "hrv.h"
 
 /**
  * @brief Start an assistant massage session
@@ -46,6 +47,15 @@ uint32_t assistant_get_remaining_seconds(void);
  */
 bool assistant_is_active(void);
 
+/**
+ * @brief HRV since the session started
+ *
+ * @param current Metrics now (may be NULL)
+ * @param baseline First complete metrics of the session (may be NULL)
+ * @return true baseline is available, so current vs baseline scores the session
+ */
+bool assistant_get_hrv(hrv_metrics_t *current, hrv_metrics_t *baseline);
+
 /**
  * @brief Background task for managing assistant timer
  * 
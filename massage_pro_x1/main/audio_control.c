@@ -6,6 +6,7 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <string.h>
 #include <sys/stat.h>
 
@@ -19,6 +20,7 @@ static bool audio_initialized = false;
 static sdmmc_card_t *card = NULL;
 static bool audio_playing = false;
 static i2s_chan_handle_t tx_handle = NULL;
+static SemaphoreHandle_t sd_mutex = NULL;
 
 // WAV file header structure
 typedef struct {
@@ -145,19 +147,43 @@ static esp_err_t init_sd_card(void) {
     slot_config.gpio_cs = SD_CS_PIN;
     slot_config.host_id = host.slot;
 
-    ret = esp_vfs_fat_sdspi_mount("/sdcard", &host, &slot_config, &mount_config, &card);
+    sd_mutex = xSemaphoreCreateMutex();
+    if (sd_mutex == NULL) {
+        spi_bus_free(host.slot);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ret = esp_vfs_fat_sdspi_mount(SD_MOUNT_POINT, &host, &slot_config, &mount_config, &card);
     if (ret != ESP_OK) {
         ESP_LOGE(AUDIO_TAG, "Failed to mount SD card: %s", esp_err_to_name(ret));
         spi_bus_free(host.slot);
+        vSemaphoreDelete(sd_mutex);
+        sd_mutex = NULL;
         return ret;
     }
 
     sdmmc_card_print_info(stdout, card);
-    ESP_LOGI(AUDIO_TAG, "SD card mounted at /sdcard");
+    ESP_LOGI(AUDIO_TAG, "SD card mounted at " SD_MOUNT_POINT);
     
     return ESP_OK;
 }
 
+bool sd_card_mounted(void) {
+    return card != NULL && sd_mutex != NULL;
+}
+
+bool sd_card_lock(uint32_t timeout_ms) {
+    if (sd_mutex == NULL) {
+        return false;
+    }
+    TickType_t ticks = (timeout_ms == SD_LOCK_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    return xSemaphoreTake(sd_mutex, ticks) == pdTRUE;
+}
+
+void sd_card_unlock(void) {
+    xSemaphoreGive(sd_mutex);
+}
+
 esp_err_t audio_init(void) {
     ESP_LOGI(AUDIO_TAG, "Initializing audio system...");
     
@@ -188,22 +214,29 @@ esp_err_t audio_play_file(const char* filepath) {
         return ESP_FAIL;
     }
 
+    // Card access is locked per operation so a recording can interleave
+    sd_card_lock(SD_LOCK_FOREVER);
+
     // Check if file exists
     struct stat st;
     if (stat(filepath, &st) != 0) {
+        sd_card_unlock();
         ESP_LOGW(AUDIO_TAG, "File not found: %s", filepath);
         return ESP_ERR_NOT_FOUND;
     }
 
     FILE* file = fopen(filepath, "rb");
     if (!file) {
+        sd_card_unlock();
         ESP_LOGE(AUDIO_TAG, "Failed to open file: %s", filepath);
         return ESP_FAIL;
     }
 
     // Read WAV header
     wav_header_t header;
-    if (fread(&header, sizeof(wav_header_t), 1, file) != 1) {
+    size_t header_read = fread(&header, sizeof(wav_header_t), 1, file);
+    sd_card_unlock();
+    if (header_read != 1) {
         ESP_LOGE(AUDIO_TAG, "Failed to read WAV header");
         fclose(file);
         return ESP_FAIL;
@@ -226,7 +259,9 @@ esp_err_t audio_play_file(const char* filepath) {
     audio_playing = true;
 
     while (audio_playing) {
+        sd_card_lock(SD_LOCK_FOREVER);
         size_t bytes_read = fread(buffer, 1, sizeof(buffer), file);
+        sd_card_unlock();
         if (bytes_read == 0) {
             break;  // End of file
         }
@@ -238,7 +273,9 @@ esp_err_t audio_play_file(const char* filepath) {
         }
     }
 
+    sd_card_lock(SD_LOCK_FOREVER);
     fclose(file);
+    sd_card_unlock();
     
     // Small delay to ensure audio finishes
     vTaskDelay(100 / portTICK_PERIOD_MS);
@@ -15,6 +15,7 @@
 #define SD_MOSI_PIN     23
 #define SD_SCK_PIN      18
 #define SD_CS_PIN       15
+#define SD_MOUNT_POINT  "/sdcard"
 
 // audio.h - Add new notification types
 typedef enum {
@@ -47,4 +48,11 @@ esp_err_t audio_notify(audio_notify_type_t type);
 void audio_stop(void);
 void audio_set_volume(uint8_t volume); // 0-21
 
+// SD card is shared with other writers (e.g. ppg_recorder); hold the lock
+// around each file access and keep it short
+#define SD_LOCK_FOREVER UINT32_MAX
+bool sd_card_mounted(void);
+bool sd_card_lock(uint32_t timeout_ms);
+void sd_card_unlock(void);
+
 #endif // AUDIO_CONTROL_H
@@ -1,352 +1,671 @@
 /*
  * BLE GATT Server Module
- * Handles all Bluetooth Low Energy communication
+ * Handles all Bluetooth Low Energy communication; the host stack specific
+ * part is in ble_server_bluedroid.c or ble_server_nimble.c
  */
 
 #include "ble_server.h"
+#include "ble_server_host.h"
 #include "esp_log.h"
-#include "esp_bt.h"
-#include "esp_bt_main.h"
-#include "esp_gap_ble_api.h"
-#include "esp_gatts_api.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "commands.h"
+#include "command_processor.h"
 #include "motor_control.h"
+#include "max30102.h"
+#include "assistant_handler.h"
+#include "ppg_recorder.h"
+#include "ppg_wavepack.h"
+#include <stddef.h>
 #include <string.h>
 
 #define TAG "BLE_SERVER"
 
-// Service ID (for service creation)
-// Service ID
-static esp_gatt_srvc_id_t service_id = {
-    .is_primary = true,
-    .id.inst_id = 0x00,
-    .id.uuid.len = ESP_UUID_LEN_128,
-    .id.uuid.uuid.uuid128 = {
-        0xF0, 0xDE, 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12,
-        0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12
-    }
-};
+// Subscription state of one notifying characteristic
+typedef struct {
+    volatile uint16_t cccd;     // BLE_CCCD_* bits, read by the sensor tasks
+} ble_sub_t;
 
-// Characteristic UUIDs
-static esp_bt_uuid_t char_write_uuid = {
-    .len = ESP_UUID_LEN_128,
-    .uuid = {
-        .uuid128 = {
-            0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12,
-            0x78, 0x56, 0x34, 0x12, 0x01, 0xef, 0xcd, 0xab
-        }
-    }
-};
+// Waveform packet layout
+#define WAVEFORM_PACKET_ID      0xF5    // Packed; 0xF4 was 3 bytes per sample
+#define WAVEFORM_HEADER_LEN     8       // ID, SEQ (2), T (4), N
+#define ATT_NOTIFY_OVERHEAD     3       // Opcode + handle
 
-static esp_bt_uuid_t char_notify_uuid = {
-    .len = ESP_UUID_LEN_128,
-    .uuid = {
-        .uuid128 = {
-            0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12,
-            0x78, 0x56, 0x34, 0x12, 0x02, 0xef, 0xcd, 0xab
-        }
-    }
-};// Advertising parameters
+// Status packet: [0xF6][LEVEL][FLAGS]
+#define STATUS_PACKET_ID        0xF6
+#define STATUS_REVERSE          0x01
+#define STATUS_HEAT             0x02
+#define STATUS_ASSISTANT        0x04
+#define STATUS_RECORDING        0x08
 
-// Advertising parameters
-static esp_ble_adv_params_t adv_params = {
-    .adv_int_min        = 0x20,
-    .adv_int_max        = 0x40,
-    .adv_type           = ADV_TYPE_IND,
-    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
-    .channel_map        = ADV_CHNL_ALL,
-    .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-};
+#define LINK_DEFAULTS { \
+    .mtu = BLE_ATT_MTU_DEFAULT, \
+    .data_len = BLE_LL_DATA_LEN_DEFAULT, \
+    .tx_phy = 1, \
+    .rx_phy = 1, \
+}
 
-// Advertising data
-static esp_ble_adv_data_t adv_data = {
-    .set_scan_rsp       = false,
-    .include_name       = true,
-    .include_txpower    = true,
-    .min_interval       = 0x0006,
-    .max_interval       = 0x0010,
-    .appearance         = 0x00,
-    .manufacturer_len   = 0,
-    .p_manufacturer_data = NULL,
-    .service_data_len   = 0,
-    .p_service_data     = NULL,
-    .service_uuid_len   = 0,
-    .p_service_uuid     = NULL,
-    .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
-};
+// Queued notification; bulk items hold a full MTU
+typedef struct {
+    uint16_t len;
+    uint8_t chr;                // ble_notify_char_t
+    uint8_t data[BLE_LINK_MTU - ATT_NOTIFY_OVERHEAD];
+} tx_packet_t;
+
+// High priority item: the same layout cut short, so the TX task receives
+// either class into a tx_packet_t
+typedef struct {
+    uint16_t len;
+    uint8_t chr;
+    uint8_t data[BLE_TX_HIGH_LEN];
+} tx_high_packet_t;
+
+_Static_assert(offsetof(tx_high_packet_t, chr) == offsetof(tx_packet_t, chr) &&
+               offsetof(tx_high_packet_t, data) == offsetof(tx_packet_t, data),
+               "TX item layouts differ");
 
 // BLE connection state
 static struct {
-    uint16_t conn_id;
-    uint16_t gatts_if;
-    uint16_t service_handle;
-    uint16_t char_write_handle;
-    uint16_t char_notify_handle;
-    esp_bd_addr_t remote_bda;
-    bool connected;
-} ble_state = {0};
+    ble_sub_t sub[BLE_CHAR_NOTIFY_COUNT];
+    volatile bool connected;
+    ble_link_t link;            // Written by the BLE callbacks, read by the streaming code
+} ble_state = { .link = LINK_DEFAULTS };
+
+// Connection parameter profiles
+typedef enum {
+    CONN_PROFILE_STREAM,
+    CONN_PROFILE_IDLE,
+    CONN_PROFILE_NONE,          // Nothing requested yet on this connection
+} conn_profile_t;
+
+static const struct {
+    const char *name;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t timeout;
+} conn_profiles[] = {
+    [CONN_PROFILE_STREAM] = { "stream", BLE_CONN_STREAM_MIN_INT, BLE_CONN_STREAM_MAX_INT,
+                              BLE_CONN_STREAM_LATENCY, BLE_CONN_STREAM_TIMEOUT },
+    [CONN_PROFILE_IDLE]   = { "idle", BLE_CONN_IDLE_MIN_INT, BLE_CONN_IDLE_MAX_INT,
+                              BLE_CONN_IDLE_LATENCY, BLE_CONN_IDLE_TIMEOUT },
+};
+
+// Connection parameter policy state, under conn_lock: the BLE callbacks and
+// the retry timer both evaluate it
+static struct {
+    conn_profile_t requested;
+    int64_t last_request_us;
+    esp_timer_handle_t retry_timer;
+} conn_policy = { .requested = CONN_PROFILE_NONE };
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Notification TX queue
+static struct {
+    QueueHandle_t queue[BLE_TX_CLASSES];
+    TaskHandle_t task;
+    volatile bool congested;
+    ble_tx_stats_t stats;       // Under tx_lock: producers, the TX task and GATTS events all count
+} tx;
+static portMUX_TYPE tx_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Waveform batch being filled (owned by the caller of notify_waveform_data)
+static struct {
+    tx_packet_t tx;
+    ppg_wavepack_t pack;        // Payload after the header; pack.count 0 = no batch
+    uint16_t seq;
+    int64_t first_us;
+    volatile uint16_t flush_ms;
+} waveform = { .tx.chr = BLE_CHAR_WAVEFORM, .flush_ms = BLE_WAVEFORM_FLUSH_MS };
+
+// Characteristic carrying each stream
+static ble_notify_char_t stream_char(ble_stream_t stream) {
+    switch (stream) {
+        case BLE_STREAM_WAVEFORM:
+            return BLE_CHAR_WAVEFORM;
+        case BLE_STREAM_STATUS:
+            return BLE_CHAR_STATUS;
+        case BLE_STREAM_HEALTH:
+        case BLE_STREAM_HRV:
+        default:
+            return BLE_CHAR_HEALTH;
+    }
+}
 
 // External references
 extern device_state_t device_state;
-extern void process_command(uint8_t *data, uint16_t len);
 
 //-----------------------------------------------------------------------------
-// GAP Event Handler
+// Notification TX Queue
 //-----------------------------------------------------------------------------
 
-static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
-    switch (event) {
-        case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-            ESP_LOGI(TAG, "Advertising data set, starting advertising...");
-            esp_ble_gap_start_advertising(&adv_params);
+static void tx_count(uint32_t *counter) {
+    portENTER_CRITICAL(&tx_lock);
+    (*counter)++;
+    portEXIT_CRITICAL(&tx_lock);
+}
+
+// Copies the packet (a tx_high_packet_t for BLE_TX_HIGH)
+static esp_err_t tx_enqueue(const void *packet, ble_tx_class_t cls) {
+    const tx_packet_t *item = packet;
+    if (tx.queue[cls] == NULL || ble_state.sub[item->chr].cccd == 0 || !ble_state.connected) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    tx_count(&tx.stats.enqueued[cls]);
+
+    // Waveform yields the link to everything else while the stack is backed up
+    if ((cls == BLE_TX_BULK && tx.congested) || xQueueSend(tx.queue[cls], packet, 0) != pdTRUE) {
+        tx_count(&tx.stats.dropped[cls]);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t waiting = uxQueueMessagesWaiting(tx.queue[cls]);
+    portENTER_CRITICAL(&tx_lock);
+    if (waiting > tx.stats.high_water[cls]) {
+        tx.stats.high_water[cls] = waiting;
+    }
+    portEXIT_CRITICAL(&tx_lock);
+
+    xTaskNotifyGive(tx.task);
+    return ESP_OK;
+}
+
+// Hold until the stack reports the link drained; gives up after
+// BLE_TX_CONGEST_MAX_MS in case the event never comes
+static void tx_wait_uncongested(void) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t limit = pdMS_TO_TICKS(BLE_TX_CONGEST_MAX_MS);
+
+    while (tx.congested && ble_state.connected) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= limit) {
+            ESP_LOGW(TAG, "Still congested after %dms, resuming", BLE_TX_CONGEST_MAX_MS);
+            tx.congested = false;
+            tx_count(&tx.stats.congest_timeouts);
             break;
-            
-        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
-            if (param->adv_start_cmpl.status == ESP_BT_STATUS_SUCCESS) {
-                ESP_LOGI(TAG, "✓ Advertising started successfully");
-            } else {
-                ESP_LOGE(TAG, "✗ Advertising start failed: %d", param->adv_start_cmpl.status);
+        }
+        // New packets wake this too; the loop re-checks
+        ulTaskNotifyTake(pdTRUE, limit - waited);
+    }
+}
+
+static void tx_send(const tx_packet_t *packet, ble_tx_class_t cls) {
+    for (int attempt = 0; attempt <= BLE_TX_MAX_RETRIES; attempt++) {
+        if (tx.congested) {
+            // Already stale by the time the link frees up
+            if (cls == BLE_TX_BULK) {
+                break;
             }
+            tx_wait_uncongested();
+        }
+        // Unsubscribed while queued
+        if (!ble_state.connected || ble_state.sub[packet->chr].cccd == 0) {
             break;
-        
-        // NEW: Handle authentication/pairing requests
-        case ESP_GAP_BLE_AUTH_CMPL_EVT:
-            if (param->ble_security.auth_cmpl.success) {
-                ESP_LOGI(TAG, "Authentication success");
+        }
+
+        esp_err_t ret = ble_host_notify(packet->chr, packet->data, packet->len);
+        if (ret == ESP_OK) {
+            tx_count(&tx.stats.sent[cls]);
+            return;
+        }
+        ESP_LOGD(TAG, "Notify refused: %s", esp_err_to_name(ret));
+        vTaskDelay(pdMS_TO_TICKS(BLE_TX_RETRY_MS));
+    }
+    tx_count(&tx.stats.dropped[cls]);
+}
+
+// Sends queued notifications, high priority first
+static void tx_task(void *pvParameters) {
+    static tx_packet_t packet;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (1) {
+            ble_tx_class_t cls;
+            if (xQueueReceive(tx.queue[BLE_TX_HIGH], &packet, 0) == pdTRUE) {
+                cls = BLE_TX_HIGH;
+            } else if (xQueueReceive(tx.queue[BLE_TX_BULK], &packet, 0) == pdTRUE) {
+                cls = BLE_TX_BULK;
             } else {
-                ESP_LOGE(TAG, "Authentication failed, status: %d", 
-                         param->ble_security.auth_cmpl.fail_reason);
+                break;
             }
-            break;
-            
-        case ESP_GAP_BLE_SEC_REQ_EVT:
-            // Security request from remote device - just accept it
-            ESP_LOGI(TAG, "Security request received");
-            esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
-            break;
-            
-        default:
-            break;
+            tx_send(&packet, cls);
+        }
+    }
+}
+
+// Whatever is still queued belongs to the old connection
+static void tx_discard(void) {
+    for (int cls = 0; cls < BLE_TX_CLASSES; cls++) {
+        uint32_t waiting = uxQueueMessagesWaiting(tx.queue[cls]);
+        xQueueReset(tx.queue[cls]);
+        portENTER_CRITICAL(&tx_lock);
+        tx.stats.dropped[cls] += waiting;
+        portEXIT_CRITICAL(&tx_lock);
     }
+    tx.congested = false;
+}
+
+static esp_err_t tx_init(void) {
+    tx.queue[BLE_TX_HIGH] = xQueueCreate(BLE_TX_HIGH_DEPTH, sizeof(tx_high_packet_t));
+    tx.queue[BLE_TX_BULK] = xQueueCreate(BLE_TX_BULK_DEPTH, sizeof(tx_packet_t));
+    if (tx.queue[BLE_TX_HIGH] == NULL || tx.queue[BLE_TX_BULK] == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(tx_task, "ble_tx", BLE_TX_STACK, NULL, BLE_TX_TASK_PRIO, &tx.task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
 }
 
 //-----------------------------------------------------------------------------
-// GATTS Event Handler
+// Link State
 //-----------------------------------------------------------------------------
 
-static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
-                               esp_ble_gatts_cb_param_t *param) {
-    switch (event) {
-        case ESP_GATTS_REG_EVT:
-            ESP_LOGI(TAG, "GATT server registered, app_id: %d", param->reg.app_id);
-            
-            // Set device name
-            esp_ble_gap_set_device_name(DEVICE_NAME);
-            
-            // Configure advertising data
-            esp_ble_gap_config_adv_data(&adv_data);
-            
-            // Create service
-            esp_ble_gatts_create_service(gatts_if, &service_id, GATTS_NUM_HANDLE);
-            break;
-            
-        case ESP_GATTS_CREATE_EVT:
-            ESP_LOGI(TAG, "Service created, handle: %d", param->create.service_handle);
-            ble_state.service_handle = param->create.service_handle;
-            ble_state.gatts_if = gatts_if;
-            
-            // Start service
-            esp_ble_gatts_start_service(ble_state.service_handle);
-            
-            // Add write characteristic
-            esp_ble_gatts_add_char(ble_state.service_handle, &char_write_uuid,
-                                  ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,  // Allow read too
-                                  ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ,
-                                  NULL, NULL);
-            break;
-            
-        case ESP_GATTS_ADD_CHAR_EVT:
-            ESP_LOGI(TAG, "Characteristic added, handle: %d", param->add_char.attr_handle);
-            
-            if (ble_state.char_write_handle == 0) {
-                ble_state.char_write_handle = param->add_char.attr_handle;
-                
-                // Add notify characteristic
-                esp_ble_gatts_add_char(ble_state.service_handle, &char_notify_uuid,
-                                      ESP_GATT_PERM_READ,
-                                      ESP_GATT_CHAR_PROP_BIT_NOTIFY | ESP_GATT_CHAR_PROP_BIT_READ,
-                                      NULL, NULL);
-            } else {
-                ble_state.char_notify_handle = param->add_char.attr_handle;
-                ESP_LOGI(TAG, "All characteristics added successfully");
-            }
-            break;
-            
-        case ESP_GATTS_CONNECT_EVT:
-            ESP_LOGI(TAG, "✓ Client connected, conn_id: %d", param->connect.conn_id);
-            ble_state.conn_id = param->connect.conn_id;
-            ble_state.connected = true;
-            memcpy(ble_state.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-            
-            // Update connection parameters for better performance
-            esp_ble_conn_update_params_t conn_params = {0};
-            memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-            conn_params.min_int = 0x10;  // 20ms
-            conn_params.max_int = 0x20;  // 40ms
-            conn_params.latency = 0;
-            conn_params.timeout = 400;   // 4s
-            esp_ble_gap_update_conn_params(&conn_params);
-            
-            // Play connection sound
-            audio_notify(AUDIO_NOTIFY_BLE_CONNECTED);
-            break;
-            
-        case ESP_GATTS_DISCONNECT_EVT:
-            ESP_LOGI(TAG, "✗ Client disconnected, reason: %d", param->disconnect.reason);
-            ble_state.connected = false;
-            
-            // Play disconnection sound
-            audio_notify(AUDIO_NOTIFY_BLE_DISCONNECTED);
-            
-            // Restart advertising
-            esp_ble_gap_start_advertising(&adv_params);
-            break;
-            
-        case ESP_GATTS_WRITE_EVT:
-            if (param->write.handle == ble_state.char_write_handle) {
-                ESP_LOGI(TAG, "Write received: %d bytes", param->write.len);
-                ESP_LOG_BUFFER_HEX(TAG, param->write.value, param->write.len);
-                
-                // Process command
-                process_command(param->write.value, param->write.len);
-                
-                // Send response if needed
-                if (param->write.need_rsp) {
-                    esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
-                                               param->write.trans_id,
-                                               ESP_GATT_OK, NULL);
-                }
-            }
-            break;
-        
-        case ESP_GATTS_MTU_EVT:
-            ESP_LOGI(TAG, "MTU exchange, MTU: %d", param->mtu.mtu);
-            break;
-            
-        default:
-            break;
+static void link_reset(void) {
+    ble_link_t defaults = LINK_DEFAULTS;
+    ble_state.link = defaults;
+}
+
+//-----------------------------------------------------------------------------
+// Connection Parameter Policy
+//-----------------------------------------------------------------------------
+
+// Profile the current workload calls for
+static conn_profile_t conn_wanted(void) {
+    return ble_server_is_subscribed(BLE_STREAM_WAVEFORM) ? CONN_PROFILE_STREAM : CONN_PROFILE_IDLE;
+}
+
+// Request the wanted profile if it changed; within BLE_CONN_UPDATE_MIN_MS of
+// the last request the retry timer tries again when the window ends
+static void conn_policy_update(void) {
+    if (!ble_state.connected) {
+        return;
+    }
+
+    conn_profile_t wanted = conn_wanted();
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us = 0;
+    bool send = false;
+
+    portENTER_CRITICAL(&conn_lock);
+    if (wanted != conn_policy.requested) {
+        wait_us = conn_policy.last_request_us + BLE_CONN_UPDATE_MIN_MS * 1000LL - now;
+        if (wait_us <= 0) {
+            conn_policy.requested = wanted;
+            conn_policy.last_request_us = now;
+            send = true;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    if (send) {
+        ESP_LOGI(TAG, "Requesting %s connection parameters", conn_profiles[wanted].name);
+        ble_host_update_conn_params(conn_profiles[wanted].min_int, conn_profiles[wanted].max_int,
+                                    conn_profiles[wanted].latency, conn_profiles[wanted].timeout);
+    } else if (wait_us > 0) {
+        // Restarting replaces a pending retry; one is enough
+        esp_timer_stop(conn_policy.retry_timer);
+        esp_timer_start_once(conn_policy.retry_timer, wait_us);
     }
 }
 
+static void conn_retry_cb(void *arg) {
+    conn_policy_update();
+}
+
+// The central's own parameters serve service discovery and MTU exchange;
+// the first request waits one rate-limit window
+static void conn_policy_start(void) {
+    portENTER_CRITICAL(&conn_lock);
+    conn_policy.requested = CONN_PROFILE_NONE;
+    conn_policy.last_request_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&conn_lock);
+
+    esp_timer_stop(conn_policy.retry_timer);
+    esp_timer_start_once(conn_policy.retry_timer, BLE_CONN_UPDATE_MIN_MS * 1000LL);
+}
+
+static void conn_policy_stop(void) {
+    esp_timer_stop(conn_policy.retry_timer);
+}
+
+// Centrals may pick other values than asked for; say so
+static void conn_policy_check(uint16_t interval, uint16_t latency) {
+    conn_profile_t requested = conn_policy.requested;
+    if (requested == CONN_PROFILE_NONE) {
+        return;
+    }
+    if (interval < conn_profiles[requested].min_int || interval > conn_profiles[requested].max_int ||
+        latency != conn_profiles[requested].latency) {
+        ESP_LOGW(TAG, "Central chose interval %d, latency %d outside the %s profile",
+                 interval, latency, conn_profiles[requested].name);
+    }
+}
+
+static esp_err_t conn_policy_init(void) {
+    const esp_timer_create_args_t args = {
+        .callback = conn_retry_cb,
+        .name = "ble_conn",
+    };
+    return esp_timer_create(&args, &conn_policy.retry_timer);
+}
+
 //-----------------------------------------------------------------------------
-// Public Functions
+// Host Events
 //-----------------------------------------------------------------------------
 
-esp_err_t ble_server_init(void) {
-    esp_err_t ret;
-    
-    // Release classic BT memory (we only use BLE)
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+void ble_server_on_advertising(void) {
+    static bool reported = false;
+
+    // First time only: boot-to-advertising and the RAM the host left over
+    if (!reported) {
+        reported = true;
+        ESP_LOGI(TAG, "%s advertising %lldms after boot, free heap %u (internal %u, min %u)",
+                 BLE_HOST_NAME, esp_timer_get_time() / 1000,
+                 heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+                 heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                 heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    }
+}
+
+void ble_server_on_connect(void) {
+    ble_state.connected = true;
+    conn_policy_start();
     
-    // Initialize BT controller
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    ret = esp_bt_controller_init(&bt_cfg);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Bluetooth controller init failed: %s", esp_err_to_name(ret));
-        return ret;
+    // Play connection sound; on the command task, the host is busy with
+    // the link exchanges now
+    command_submit_audio(AUDIO_NOTIFY_BLE_CONNECTED);
+}
+
+void ble_server_on_disconnect(int reason) {
+    ble_state.connected = false;
+    conn_policy_stop();
+    link_reset();
+    // Without bonding the CCCDs start disabled on every connection
+    for (int chr = 0; chr < BLE_CHAR_NOTIFY_COUNT; chr++) {
+        ble_state.sub[chr].cccd = 0;
     }
+    tx_discard();
+    ble_tx_stats_t ts;
+    ble_server_get_tx_stats(&ts);
+    ESP_LOGI(TAG, "TX: high %lu sent %lu dropped, waveform %lu sent %lu dropped, "
+             "%lu congestions", ts.sent[BLE_TX_HIGH], ts.dropped[BLE_TX_HIGH],
+             ts.sent[BLE_TX_BULK], ts.dropped[BLE_TX_BULK], ts.congestions);
+    max30102_demand_changed();
     
-    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    // Play disconnection sound
+    command_submit_audio(AUDIO_NOTIFY_BLE_DISCONNECTED);
+}
+
+void ble_server_on_subscribe(ble_notify_char_t chr, uint16_t cccd) {
+    static const char *const names[BLE_CHAR_NOTIFY_COUNT] = {
+        [BLE_CHAR_HEALTH] = "Health",
+        [BLE_CHAR_WAVEFORM] = "Waveform",
+        [BLE_CHAR_STATUS] = "Status",
+    };
+
+    if (chr >= BLE_CHAR_NOTIFY_COUNT) {
+        return;
+    }
+    ble_state.sub[chr].cccd = cccd;
+    ESP_LOGI(TAG, "%s notifications %s", names[chr], cccd ? "enabled" : "disabled");
+    if (chr == BLE_CHAR_STATUS) {
+        // Current state first, changes after
+        notify_status_data();
+    } else {
+        max30102_demand_changed();
+        conn_policy_update();
+    }
+}
+
+esp_err_t ble_server_on_write(const uint8_t *data, uint16_t len) {
+    // The command task runs it; the caller is the stack's own task
+    return command_submit(data, len);
+}
+
+esp_err_t ble_server_on_config_write(const uint8_t *data, uint16_t len) {
+    if (len != BLE_CONFIG_LEN || data[2] > HR_ENGINE_AUTOCORR) {
+        ESP_LOGW(TAG, "Config write rejected (%d bytes)", len);
+        return ESP_ERR_INVALID_ARG;
+    }
+    ble_server_set_waveform_flush((data[0] << 8) | data[1]);
+    max30102_set_hr_engine((hr_engine_t)data[2]);
+    return ESP_OK;
+}
+
+uint16_t ble_server_read_status(uint8_t *out) {
+    uint8_t flags = 0;
+
+    if (device_state.rotate_on) {
+        flags |= STATUS_REVERSE;
+    }
+    if (device_state.heat_on) {
+        flags |= STATUS_HEAT;
+    }
+    if (assistant_is_active()) {
+        flags |= STATUS_ASSISTANT;
+    }
+    if (ppg_recorder_is_recording()) {
+        flags |= STATUS_RECORDING;
+    }
+
+    out[0] = STATUS_PACKET_ID;
+    out[1] = device_state.intensity_level;
+    out[2] = flags;
+    return BLE_STATUS_LEN;
+}
+
+uint16_t ble_server_read_config(uint8_t *out) {
+    uint16_t flush_ms = waveform.flush_ms;
+
+    out[0] = (flush_ms >> 8) & 0xFF;
+    out[1] = flush_ms & 0xFF;
+    out[2] = max30102_get_hr_engine();
+    return BLE_CONFIG_LEN;
+}
+
+void ble_server_on_mtu(uint16_t mtu) {
+    ESP_LOGI(TAG, "MTU exchange, MTU: %d", mtu);
+    ble_state.link.mtu = mtu;
+}
+
+void ble_server_on_data_len(uint16_t tx_octets, uint16_t rx_octets) {
+    ble_state.link.data_len = tx_octets;
+    ESP_LOGI(TAG, "Data length: TX %d, RX %d octets", tx_octets, rx_octets);
+}
+
+void ble_server_on_phy(uint8_t tx_phy, uint8_t rx_phy) {
+    ble_state.link.tx_phy = tx_phy;
+    ble_state.link.rx_phy = rx_phy;
+    ESP_LOGI(TAG, "PHY: TX %s, RX %s", tx_phy == 2 ? "2M" : "1M", rx_phy == 2 ? "2M" : "1M");
+}
+
+void ble_server_on_conn_params(uint16_t interval, uint16_t latency, uint16_t timeout) {
+    ble_state.link.conn_interval = interval;
+    ESP_LOGI(TAG, "Connection interval %d.%02dms, latency %d, timeout %dms",
+             interval * 5 / 4, interval * 125 % 100, latency, timeout * 10);
+    conn_policy_check(interval, latency);
+}
+
+void ble_server_on_congest(bool congested) {
+    tx.congested = congested;
+    if (congested) {
+        tx_count(&tx.stats.congestions);
+        ESP_LOGD(TAG, "Link congested");
+    } else if (tx.task != NULL) {
+        xTaskNotifyGive(tx.task);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+esp_err_t ble_server_init(void) {
+    esp_err_t ret = tx_init();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Bluetooth controller enable failed: %s", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Notification TX queue init failed: %s", esp_err_to_name(ret));
         return ret;
     }
-    
-    // Initialize Bluedroid stack
-    ret = esp_bluedroid_init();
+
+    ret = conn_policy_init();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Bluedroid init failed: %s", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Connection policy timer init failed: %s", esp_err_to_name(ret));
         return ret;
     }
-    
-    ret = esp_bluedroid_enable();
+
+    ret = ble_host_init();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Bluedroid enable failed: %s", esp_err_to_name(ret));
         return ret;
     }
     
-    // NEW: Set IO capability to NoInputNoOutput (no pairing required)
-    esp_ble_io_cap_t iocap = ESP_IO_CAP_NONE;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(uint8_t));
-    
-    // NEW: Set authentication requirements to NONE
-    uint8_t auth_req = ESP_LE_AUTH_NO_BOND;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
-    
-    // NEW: Disable key distribution
-    uint8_t key_size = 16;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(uint8_t));
-    
-    uint8_t init_key = 0;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(uint8_t));
-    
-    uint8_t rsp_key = 0;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
-    
-    // Register callbacks
-    esp_ble_gatts_register_callback(gatts_event_handler);
-    esp_ble_gap_register_callback(gap_event_handler);
-    
-    // Register GATT application
-    esp_ble_gatts_app_register(0);
-    
-    ESP_LOGI(TAG, "BLE GATT Server initialized");
+    ESP_LOGI(TAG, "BLE GATT Server initialized (%s host)", BLE_HOST_NAME);
     ESP_LOGI(TAG, "Device name: %s", DEVICE_NAME);
     ESP_LOGI(TAG, "Security: NO PAIRING REQUIRED");
     
     return ESP_OK;
 }
 
-esp_err_t ble_server_notify(uint8_t *data, uint16_t len) {
+esp_err_t ble_server_notify(ble_stream_t stream, const uint8_t *data, uint16_t len) {
     if (!ble_state.connected) {
         ESP_LOGW(TAG, "Cannot notify - not connected");
         return ESP_ERR_INVALID_STATE;
     }
-    
-    return esp_ble_gatts_send_indicate(ble_state.gatts_if,
-                                       ble_state.conn_id,
-                                       ble_state.char_notify_handle,
-                                       len, data, false);
+    if (len > BLE_TX_HIGH_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    tx_high_packet_t packet = { .len = len, .chr = stream_char(stream) };
+    memcpy(packet.data, data, len);
+    return tx_enqueue(&packet, BLE_TX_HIGH);
+}
+
+void ble_server_get_tx_stats(ble_tx_stats_t *stats) {
+    portENTER_CRITICAL(&tx_lock);
+    *stats = tx.stats;
+    portEXIT_CRITICAL(&tx_lock);
+}
+
+void ble_server_get_link(ble_link_t *link) {
+    *link = ble_state.link;
 }
 
 bool ble_server_is_connected(void) {
     return ble_state.connected;
 }
 
-void notify_spo2_data(uint8_t heart_rate, uint8_t spo2) {
-    if (!ble_state.connected) {
+bool ble_server_is_subscribed(ble_stream_t stream) {
+    return ble_state.connected && ble_state.sub[stream_char(stream)].cccd != 0;
+}
+
+void notify_spo2_data(uint8_t heart_rate, uint8_t spo2, uint8_t quality, bool motion) {
+    if (!ble_server_is_subscribed(BLE_STREAM_HEALTH)) {
         return;
     }
     
-    uint8_t data[3] = {0xF1, heart_rate, spo2};  // 0xF1 = health data packet
-    ble_server_notify(data, sizeof(data));
+    // 0xF1 = health data packet; clients reading only the first 3 bytes still work
+    uint8_t data[5] = {0xF1, heart_rate, spo2, quality, motion ? 0x01 : 0x00};
+    ble_server_notify(BLE_STREAM_HEALTH, data, sizeof(data));
     
-    ESP_LOGD(TAG, "Health data sent: HR=%d, SpO2=%d", heart_rate, spo2);
+    ESP_LOGD(TAG, "Health data sent: HR=%d, SpO2=%d, Q=%d%s", heart_rate, spo2, quality,
+             motion ? " (motion)" : "");
 }
 
-void notify_waveform_data(uint32_t ir_value) {
-    if (!ble_state.connected) {
+void notify_hrv_data(uint16_t rmssd_x10, uint16_t sdnn_x10, uint8_t pnn50, uint16_t intervals) {
+    if (!ble_server_is_subscribed(BLE_STREAM_HRV)) {
         return;
     }
-    
-    // Send as 4 bytes: [0xF2][IR_HIGH][IR_MID][IR_LOW]
-    uint8_t data[4] = {
-        0xF2,
-        (ir_value >> 16) & 0xFF,
-        (ir_value >> 8) & 0xFF,
-        ir_value & 0xFF
+
+    uint8_t data[8] = {
+        0xF3,   // 0xF3 = HRV packet
+        (rmssd_x10 >> 8) & 0xFF,
+        rmssd_x10 & 0xFF,
+        (sdnn_x10 >> 8) & 0xFF,
+        sdnn_x10 & 0xFF,
+        pnn50,
+        (intervals >> 8) & 0xFF,
+        intervals & 0xFF
     };
-    
-    ble_server_notify(data, sizeof(data));
+
+    ble_server_notify(BLE_STREAM_HRV, data, sizeof(data));
+
+    ESP_LOGD(TAG, "HRV sent: RMSSD=%u.%u SDNN=%u.%u pNN50=%u%% (%u)",
+             rmssd_x10 / 10, rmssd_x10 % 10, sdnn_x10 / 10, sdnn_x10 % 10, pnn50, intervals);
+}
+
+void notify_status_data(void) {
+    if (!ble_server_is_subscribed(BLE_STREAM_STATUS)) {
+        return;
+    }
+
+    uint8_t data[BLE_STATUS_LEN];
+    ble_server_notify(BLE_STREAM_STATUS, data, ble_server_read_status(data));
+}
+
+static void waveform_start(int64_t t_us) {
+    uint16_t mtu = ble_state.link.mtu;
+    if (mtu > BLE_LINK_MTU) {
+        mtu = BLE_LINK_MTU;
+    }
+    ppg_wavepack_init(&waveform.pack, &waveform.tx.data[WAVEFORM_HEADER_LEN],
+                      mtu - ATT_NOTIFY_OVERHEAD - WAVEFORM_HEADER_LEN, BLE_WAVEFORM_DROP_BITS);
+    waveform.first_us = t_us;
+}
+
+static void waveform_flush(void) {
+    uint8_t *p = waveform.tx.data;
+    uint32_t t = (uint32_t)waveform.first_us;
+    size_t len = ppg_wavepack_finish(&waveform.pack);
+
+    p[0] = WAVEFORM_PACKET_ID;
+    p[1] = (waveform.seq >> 8) & 0xFF;
+    p[2] = waveform.seq & 0xFF;
+    p[3] = (t >> 24) & 0xFF;
+    p[4] = (t >> 16) & 0xFF;
+    p[5] = (t >> 8) & 0xFF;
+    p[6] = t & 0xFF;
+    p[7] = waveform.pack.count;
+
+    // A packet dropped on the way still uses its number: the client sees the loss
+    waveform.tx.len = WAVEFORM_HEADER_LEN + len;
+    tx_enqueue(&waveform.tx, BLE_TX_BULK);
+    waveform.seq++;
+    waveform.pack.count = 0;
 }
 
+void notify_waveform_data(uint32_t ir_value, int64_t t_us) {
+    if (!ble_server_is_subscribed(BLE_STREAM_WAVEFORM)) {
+        waveform.pack.count = 0;
+        return;
+    }
+
+    if (waveform.pack.count == 0) {
+        waveform_start(t_us);
+    }
+    // Full at this MTU (N is one byte): this sample keys the next packet
+    if (waveform.pack.count >= UINT8_MAX || !ppg_wavepack_add(&waveform.pack, ir_value)) {
+        waveform_flush();
+        waveform_start(t_us);
+        ppg_wavepack_add(&waveform.pack, ir_value);
+    }
+
+    // More than one notification per connection event only adds headers
+    int64_t flush_us = waveform.flush_ms * 1000LL;
+    int64_t interval_us = ble_state.link.conn_interval * 1250LL;
+    if (flush_us > 0 && flush_us < interval_us) {
+        flush_us = interval_us;
+    }
+    if (t_us - waveform.first_us >= flush_us) {
+        waveform_flush();
+    }
+}
+
+void ble_server_set_waveform_flush(uint16_t ms) {
+    waveform.flush_ms = (ms > BLE_WAVEFORM_FLUSH_MAX) ? BLE_WAVEFORM_FLUSH_MAX : ms;
+    ESP_LOGI(TAG, "Waveform flush: %ums", waveform.flush_ms);
+}
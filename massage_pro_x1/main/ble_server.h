@@ -8,7 +8,98 @@
 
 // Device configuration
 #define DEVICE_NAME             "Massage_Pro_X1"
-#define GATTS_NUM_HANDLE        8
+
+// GATT service 12345678-1234-5678-1234-56789ABCDEF0, one characteristic per
+// stream so a client subscribes only to what it renders. Packets keep their
+// type byte, which also tells the waveform encodings apart.
+//   ABCDEF01-...  Command   write               commands.h
+//   ABCDEF02-...  Health    notify              0xF1 health, 0xF3 HRV
+//   ABCDEF03-...  Waveform  notify              0xF5 packed IR batches
+//   ABCDEF04-...  Status    read, notify        0xF6 device state
+//   ABCDEF05-...  Config    read, write         [FLUSH_MS_H][FLUSH_MS_L][HR_ENGINE]
+// (ABCDEF02 was the single notify characteristic; health stays on it.)
+#define BLE_STATUS_LEN          3
+#define BLE_CONFIG_LEN          3
+
+// ATT MTU: 23 until the client negotiates more
+#define BLE_ATT_MTU_DEFAULT     23
+#define BLE_LL_DATA_LEN_DEFAULT 27      // LL payload octets without Data Length Extension
+
+// Link tuning, offered on every connection. The client starts the MTU
+// exchange; DLE and (on BLE 5 controllers) the 2M PHY are requested by the
+// server. What the link settles on is reported by ble_server_get_link().
+#define BLE_LINK_MTU            247     // Local MTU, also sizes the notification buffers
+#define BLE_LINK_DATA_LEN       251     // LL payload octets, the DLE maximum
+
+// Waveform batching: samples accumulate until a notification at the current
+// MTU is full or the oldest one has waited this long
+#define BLE_WAVEFORM_FLUSH_MS   200     // Default, 0 = one sample per notification
+#define BLE_WAVEFORM_FLUSH_MAX  2000
+#define BLE_WAVEFORM_DROP_BITS  3       // Low bits of the 18-bit IR sample left out of 0xF5
+                                        // packets (sensor noise); 0 = lossless
+
+// Connection parameter policy: a short interval while the waveform streams,
+// a long one with slave latency while only commands and health readings flow.
+// Intervals in 1.25 ms units, timeouts in 10 ms units.
+#define BLE_CONN_STREAM_MIN_INT     12      // 15 ms
+#define BLE_CONN_STREAM_MAX_INT     24      // 30 ms
+#define BLE_CONN_STREAM_LATENCY     0
+#define BLE_CONN_STREAM_TIMEOUT     400     // 4 s
+#define BLE_CONN_IDLE_MIN_INT       80      // 100 ms
+#define BLE_CONN_IDLE_MAX_INT       120     // 150 ms
+#define BLE_CONN_IDLE_LATENCY       2       // A command waits at most 450 ms
+#define BLE_CONN_IDLE_TIMEOUT       600     // 6 s
+#define BLE_CONN_UPDATE_MIN_MS      5000    // Between update requests, and after connecting
+
+// Notification TX queue: packets go out from a BLE task in priority order and
+// wait while the stack reports the link congested. Waveform batches are the
+// first to go: refused while congested, dropped when their queue is full.
+#define BLE_TX_TASK_PRIO        6       // Above the processing task that feeds it
+#define BLE_TX_STACK            3072
+#define BLE_TX_HIGH_DEPTH       8       // Health, HRV, alerts
+#define BLE_TX_HIGH_LEN         20      // Largest high priority packet (default MTU payload)
+#define BLE_TX_BULK_DEPTH       6       // Waveform batches, up to a full MTU each
+#define BLE_TX_RETRY_MS         20      // Wait after the stack refuses a packet
+#define BLE_TX_MAX_RETRIES      10
+#define BLE_TX_CONGEST_MAX_MS   1000    // Resume even if no un-congest event arrives
+
+// Client Characteristic Configuration bits
+#define BLE_CCCD_NOTIFY         0x0001
+#define BLE_CCCD_INDICATE       0x0002
+
+// Notification streams; health and HRV share the health characteristic
+typedef enum {
+    BLE_STREAM_HEALTH,      // 0xF1 HR / SpO2 / quality
+    BLE_STREAM_WAVEFORM,    // 0xF5 packed IR sample batches
+    BLE_STREAM_HRV,         // 0xF3 HRV metrics
+    BLE_STREAM_STATUS,      // 0xF6 device state
+} ble_stream_t;
+
+// Negotiated link parameters, defaults until each negotiation completes
+typedef struct {
+    uint16_t mtu;               // ATT MTU
+    uint16_t data_len;          // LL TX payload octets
+    uint8_t tx_phy;             // 1 = 1M, 2 = 2M, 3 = Coded
+    uint8_t rx_phy;
+    uint16_t conn_interval;     // 1.25 ms units, 0 until the first update
+} ble_link_t;
+
+// Notification priority classes
+typedef enum {
+    BLE_TX_HIGH,            // Health, HRV, alerts
+    BLE_TX_BULK,            // Waveform
+    BLE_TX_CLASSES,
+} ble_tx_class_t;
+
+// Notification TX queue counters, per class; reset only at boot
+typedef struct {
+    uint32_t enqueued[BLE_TX_CLASSES];
+    uint32_t sent[BLE_TX_CLASSES];
+    uint32_t dropped[BLE_TX_CLASSES];       // Queue full, congested, refused, or disconnected
+    uint32_t high_water[BLE_TX_CLASSES];    // Most packets waiting at once
+    uint32_t congestions;                   // Congestion events from the stack
+    uint32_t congest_timeouts;              // Resumed without an un-congest event
+} ble_tx_stats_t;
 
 /**
  * @brief Initialize BLE GATT server
@@ -18,13 +109,18 @@
 esp_err_t ble_server_init(void);
 
 /**
- * @brief Send notification to connected client
- * 
+ * @brief Queue a high priority notification to the connected client
+ *
+ * Sent on the stream's characteristic, ahead of any waveform batch, by the
+ * BLE TX task.
+ *
+ * @param stream Stream the packet belongs to
  * @param data Data to send
- * @param len Length of data
- * @return esp_err_t ESP_OK on success
+ * @param len Length of data, at most BLE_TX_HIGH_LEN
+ * @return esp_err_t ESP_OK if queued, ESP_ERR_INVALID_STATE without a
+ *         subscriber, ESP_ERR_NO_MEM if the queue is full
  */
-esp_err_t ble_server_notify(uint8_t *data, uint16_t len);
+esp_err_t ble_server_notify(ble_stream_t stream, const uint8_t *data, uint16_t len);
 
 /**
  * @brief Check if a client is connected
@@ -34,19 +130,87 @@ esp_err_t ble_server_notify(uint8_t *data, uint16_t len);
  */
 bool ble_server_is_connected(void);
 
+/**
+ * @brief Check if the connected client enabled notifications for a stream
+ *
+ * Follows the CCCD of the stream's characteristic; cleared on disconnect.
+ *
+ * @param stream Stream to check
+ * @return true Someone consumes the stream
+ */
+bool ble_server_is_subscribed(ble_stream_t stream);
+
+/**
+ * @brief Current link parameters
+ *
+ * Waveform packets fill the MTU and are not flushed faster than one per
+ * connection interval.
+ *
+ * @param link Filled in
+ */
+void ble_server_get_link(ble_link_t *link);
+
+/**
+ * @brief Snapshot of the notification TX queue counters
+ *
+ * @param stats Filled in
+ */
+void ble_server_get_tx_stats(ble_tx_stats_t *stats);
+
 /**
  * @brief Send health data notification (HR + SpO2)
- * 
+ *
+ * Packet: [0xF1][HR][SPO2][QUALITY][FLAGS], FLAGS bit 0 = motion. HR and
+ * SpO2 are 0 while quality is below PPG_SQI_MIN_QUALITY.
+ *
  * @param heart_rate Heart rate in BPM (0-255)
  * @param spo2 SpO2 percentage (0-100)
+ * @param quality Signal quality (0-100)
+ * @param motion Finger moving on the sensor
  */
-void notify_spo2_data(uint8_t heart_rate, uint8_t spo2);
+void notify_spo2_data(uint8_t heart_rate, uint8_t spo2, uint8_t quality, bool motion);
 
 /**
- * @brief Send waveform data notification
- * 
+ * @brief Send HRV notification
+ *
+ * Packet: [0xF3][RMSSD_H][RMSSD_L][SDNN_H][SDNN_L][PNN50][N_H][N_L]
+ *
+ * @param rmssd_x10 RMSSD in 0.1 ms
+ * @param sdnn_x10 SDNN in 0.1 ms
+ * @param pnn50 pNN50 percentage (0-100)
+ * @param intervals RR intervals the metrics cover
+ */
+void notify_hrv_data(uint16_t rmssd_x10, uint16_t sdnn_x10, uint8_t pnn50, uint16_t intervals);
+
+/**
+ * @brief Send device status notification
+ *
+ * Packet: [0xF6][LEVEL][FLAGS], FLAGS bit 0 = reverse rotation, bit 1 =
+ * heat, bit 2 = assistant session, bit 3 = recording. The same bytes
+ * answer reads of the status characteristic.
+ */
+void notify_status_data(void);
+
+/**
+ * @brief Queue a waveform sample, sent in batches
+ *
+ * Packet: [0xF5][SEQ_H][SEQ_L][T3][T2][T1][T0][N] then N samples packed as
+ * described in ppg_wavepack.h (24-bit key, predicted residuals in bit-packed
+ * groups). SEQ counts packets, so a jump means the client missed one; T is
+ * the esp_timer time of the first sample in microseconds (low 32 bits). N
+ * is as many samples as fit the negotiated MTU. Called from one task only.
+ *
  * @param ir_value IR sensor reading (18-bit value)
+ * @param t_us Time the sample was taken
+ */
+void notify_waveform_data(uint32_t ir_value, int64_t t_us);
+
+/**
+ * @brief Longest a waveform sample waits for its batch to fill
+ *
+ * @param ms 0 to BLE_WAVEFORM_FLUSH_MAX, 0 sends each sample on its own;
+ *           other values are raised to the connection interval
  */
-void notify_waveform_data(uint32_t ir_value);
+void ble_server_set_waveform_flush(uint16_t ms);
 
 #endif // BLE_SERVER_H#endif // BLE_SERVER_H
@@ -0,0 +1,465 @@
+/*
+ * BLE GATT Server - Bluedroid Host
+ * Stack bring-up, GATT service and advertising on Bluedroid
+ */
+
+#include "ble_server.h"
+#include "ble_server_host.h"
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
+#include <string.h>
+
+#define TAG "BLE_BLUEDROID"
+
+// Attribute table indices
+enum {
+    IDX_SVC,
+    IDX_CMD_CHAR,
+    IDX_CMD_VAL,
+    IDX_HEALTH_CHAR,
+    IDX_HEALTH_VAL,
+    IDX_HEALTH_CCCD,
+    IDX_WAVE_CHAR,
+    IDX_WAVE_VAL,
+    IDX_WAVE_CCCD,
+    IDX_STATUS_CHAR,
+    IDX_STATUS_VAL,
+    IDX_STATUS_CCCD,
+    IDX_CONFIG_CHAR,
+    IDX_CONFIG_VAL,
+    ATTR_COUNT,
+};
+
+// 12345678-1234-5678-1234-56789ABCDEF0; the characteristics are
+// ABCDEF0n-1234-5678-1234-56789ABCDEF0 (see ble_server.h)
+#define SVC_UUID128 \
+    0xF0, 0xDE, 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12, \
+    0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12
+#define CHAR_UUID128(n) \
+    0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, \
+    0x78, 0x56, 0x34, 0x12, (n), 0xef, 0xcd, 0xab
+
+static const uint8_t service_uuid[16] = { SVC_UUID128 };
+static const uint8_t cmd_uuid[16] = { CHAR_UUID128(0x01) };
+static const uint8_t health_uuid[16] = { CHAR_UUID128(0x02) };
+static const uint8_t wave_uuid[16] = { CHAR_UUID128(0x03) };
+static const uint8_t status_uuid[16] = { CHAR_UUID128(0x04) };
+static const uint8_t config_uuid[16] = { CHAR_UUID128(0x05) };
+
+static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t char_decl_uuid = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t cccd_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+
+static const uint8_t prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE;
+static const uint8_t prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t prop_read_write = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
+
+// CCCDs as stored by the stack (little endian), one per notifying characteristic
+static uint8_t cccd_value[BLE_CHAR_NOTIFY_COUNT][2];
+
+#define ATTR(rsp, uuid_len, uuid, perm, max, len, value) \
+    { { (rsp) }, { (uuid_len), (uint8_t *)(uuid), (perm), (max), (len), (uint8_t *)(value) } }
+#define CHAR_DECL(prop) \
+    ATTR(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &char_decl_uuid, ESP_GATT_PERM_READ, \
+         sizeof(uint8_t), sizeof(uint8_t), &(prop))
+#define CCCD(chr) \
+    ATTR(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &cccd_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, \
+         sizeof(cccd_value[chr]), sizeof(cccd_value[chr]), cccd_value[chr])
+
+// The whole service, created in one call. Values the application owns
+// (command, status, config) are answered from the GATTS events; the stack
+// keeps the rest. Notify values hold nothing: the data goes out in the
+// notifications.
+static const esp_gatts_attr_db_t attr_db[ATTR_COUNT] = {
+    [IDX_SVC] = ATTR(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &primary_service_uuid, ESP_GATT_PERM_READ,
+                     sizeof(service_uuid), sizeof(service_uuid), service_uuid),
+
+    [IDX_CMD_CHAR] = CHAR_DECL(prop_write),
+    [IDX_CMD_VAL] = ATTR(ESP_GATT_RSP_BY_APP, ESP_UUID_LEN_128, cmd_uuid, ESP_GATT_PERM_WRITE,
+                         ESP_GATT_MAX_ATTR_LEN, 0, NULL),
+
+    [IDX_HEALTH_CHAR] = CHAR_DECL(prop_notify),
+    [IDX_HEALTH_VAL] = ATTR(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_128, health_uuid, 0, 0, 0, NULL),
+    [IDX_HEALTH_CCCD] = CCCD(BLE_CHAR_HEALTH),
+
+    [IDX_WAVE_CHAR] = CHAR_DECL(prop_notify),
+    [IDX_WAVE_VAL] = ATTR(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_128, wave_uuid, 0, 0, 0, NULL),
+    [IDX_WAVE_CCCD] = CCCD(BLE_CHAR_WAVEFORM),
+
+    [IDX_STATUS_CHAR] = CHAR_DECL(prop_read_notify),
+    [IDX_STATUS_VAL] = ATTR(ESP_GATT_RSP_BY_APP, ESP_UUID_LEN_128, status_uuid, ESP_GATT_PERM_READ,
+                            BLE_STATUS_LEN, 0, NULL),
+    [IDX_STATUS_CCCD] = CCCD(BLE_CHAR_STATUS),
+
+    [IDX_CONFIG_CHAR] = CHAR_DECL(prop_read_write),
+    [IDX_CONFIG_VAL] = ATTR(ESP_GATT_RSP_BY_APP, ESP_UUID_LEN_128, config_uuid,
+                            ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, BLE_CONFIG_LEN, 0, NULL),
+};
+
+// Value handle and CCCD of each notifying characteristic
+static const struct {
+    uint8_t val;
+    uint8_t cccd;
+} notify_attrs[BLE_CHAR_NOTIFY_COUNT] = {
+    [BLE_CHAR_HEALTH] = { IDX_HEALTH_VAL, IDX_HEALTH_CCCD },
+    [BLE_CHAR_WAVEFORM] = { IDX_WAVE_VAL, IDX_WAVE_CCCD },
+    [BLE_CHAR_STATUS] = { IDX_STATUS_VAL, IDX_STATUS_CCCD },
+};
+
+// Advertising parameters
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min        = 0x20,
+    .adv_int_max        = 0x40,
+    .adv_type           = ADV_TYPE_IND,
+    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
+    .channel_map        = ADV_CHNL_ALL,
+    .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+};
+
+// Advertising data
+static esp_ble_adv_data_t adv_data = {
+    .set_scan_rsp       = false,
+    .include_name       = true,
+    .include_txpower    = true,
+    .min_interval       = 0x0006,
+    .max_interval       = 0x0010,
+    .appearance         = 0x00,
+    .manufacturer_len   = 0,
+    .p_manufacturer_data = NULL,
+    .service_data_len   = 0,
+    .p_service_data     = NULL,
+    .service_uuid_len   = 0,
+    .p_service_uuid     = NULL,
+    .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
+};
+
+
+// Bluedroid handles and connection
+static struct {
+    uint16_t conn_id;
+    uint16_t gatts_if;
+    uint16_t handles[ATTR_COUNT];   // 0 until the attribute table is created
+    esp_bd_addr_t remote_bda;
+} host;
+
+// Without bonding the CCCDs start disabled on every connection
+static void clear_cccd(void) {
+    memset(cccd_value, 0, sizeof(cccd_value));
+    for (int chr = 0; chr < BLE_CHAR_NOTIFY_COUNT; chr++) {
+        uint16_t handle = host.handles[notify_attrs[chr].cccd];
+        if (handle != 0) {
+            esp_ble_gatts_set_attr_value(handle, sizeof(cccd_value[chr]), cccd_value[chr]);
+        }
+    }
+}
+
+// Table index of an attribute handle, ATTR_COUNT if it is not ours
+static int attr_index(uint16_t handle) {
+    for (int i = 0; i < ATTR_COUNT; i++) {
+        if (host.handles[i] == handle) {
+            return i;
+        }
+    }
+    return ATTR_COUNT;
+}
+
+// Ask for the fastest link the controller supports; the GAP events record
+// what the peer agrees to
+static void link_tune(esp_bd_addr_t bda) {
+    esp_err_t ret = esp_ble_gap_set_pkt_data_len(bda, BLE_LINK_DATA_LEN);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Data length request failed: %s", esp_err_to_name(ret));
+    }
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    // BLE 5 controllers only; the ESP32's 4.2 controller stays on 1M
+    ret = esp_ble_gap_set_preferred_phy(bda, 0,
+                                        ESP_BLE_GAP_PHY_1M_PREF_MASK | ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                        ESP_BLE_GAP_PHY_1M_PREF_MASK | ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                        ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "2M PHY request failed: %s", esp_err_to_name(ret));
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// GAP Event Handler
+//-----------------------------------------------------------------------------
+
+static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    switch (event) {
+        case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
+            ESP_LOGI(TAG, "Advertising data set, starting advertising...");
+            esp_ble_gap_start_advertising(&adv_params);
+            break;
+            
+        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+            if (param->adv_start_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+                ESP_LOGI(TAG, "✓ Advertising started successfully");
+                ble_server_on_advertising();
+            } else {
+                ESP_LOGE(TAG, "✗ Advertising start failed: %d", param->adv_start_cmpl.status);
+            }
+            break;
+        
+        // NEW: Handle authentication/pairing requests
+        case ESP_GAP_BLE_AUTH_CMPL_EVT:
+            if (param->ble_security.auth_cmpl.success) {
+                ESP_LOGI(TAG, "Authentication success");
+            } else {
+                ESP_LOGE(TAG, "Authentication failed, status: %d", 
+                         param->ble_security.auth_cmpl.fail_reason);
+            }
+            break;
+            
+        case ESP_GAP_BLE_SEC_REQ_EVT:
+            // Security request from remote device - just accept it
+            ESP_LOGI(TAG, "Security request received");
+            esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
+            break;
+
+        case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+            if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+                ble_server_on_data_len(param->pkt_data_length_cmpl.params.tx_len,
+                                       param->pkt_data_length_cmpl.params.rx_len);
+            } else {
+                ESP_LOGW(TAG, "Data length extension refused: %d", param->pkt_data_length_cmpl.status);
+            }
+            break;
+
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+            if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+                ble_server_on_conn_params(param->update_conn_params.conn_int,
+                                          param->update_conn_params.latency,
+                                          param->update_conn_params.timeout);
+            }
+            break;
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+            if (param->phy_update.status == ESP_BT_STATUS_SUCCESS) {
+                ble_server_on_phy(param->phy_update.tx_phy, param->phy_update.rx_phy);
+            }
+            break;
+#endif
+            
+        default:
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// GATTS Event Handler
+//-----------------------------------------------------------------------------
+
+static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                               esp_ble_gatts_cb_param_t *param) {
+    switch (event) {
+        case ESP_GATTS_REG_EVT:
+            ESP_LOGI(TAG, "GATT server registered, app_id: %d", param->reg.app_id);
+            host.gatts_if = gatts_if;
+            
+            // Set device name
+            esp_ble_gap_set_device_name(DEVICE_NAME);
+            
+            // Configure advertising data
+            esp_ble_gap_config_adv_data(&adv_data);
+            
+            // Create the whole service
+            esp_ble_gatts_create_attr_tab(attr_db, gatts_if, ATTR_COUNT, 0);
+            break;
+            
+        case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+            if (param->add_attr_tab.status != ESP_GATT_OK || param->add_attr_tab.num_handle != ATTR_COUNT) {
+                ESP_LOGE(TAG, "Attribute table creation failed: status %d, %d handles",
+                         param->add_attr_tab.status, param->add_attr_tab.num_handle);
+                break;
+            }
+            memcpy(host.handles, param->add_attr_tab.handles, sizeof(host.handles));
+            ESP_LOGI(TAG, "Service created, handles %d-%d", host.handles[IDX_SVC],
+                     host.handles[ATTR_COUNT - 1]);
+            esp_ble_gatts_start_service(host.handles[IDX_SVC]);
+            break;
+            
+        case ESP_GATTS_CONNECT_EVT:
+            ESP_LOGI(TAG, "✓ Client connected, conn_id: %d", param->connect.conn_id);
+            host.conn_id = param->connect.conn_id;
+            memcpy(host.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            link_tune(param->connect.remote_bda);
+            ble_server_on_connect();
+            break;
+            
+        case ESP_GATTS_DISCONNECT_EVT:
+            ESP_LOGI(TAG, "✗ Client disconnected, reason: %d", param->disconnect.reason);
+            clear_cccd();
+            ble_server_on_disconnect(param->disconnect.reason);
+            
+            // Restart advertising
+            esp_ble_gap_start_advertising(&adv_params);
+            break;
+            
+        case ESP_GATTS_READ_EVT: {
+            // Reads of auto response attributes (CCCDs, declarations) are
+            // reported too, already answered by the stack
+            if (!param->read.need_rsp) {
+                break;
+            }
+
+            // Status and config, the values answered here, fit one read
+            esp_gatt_rsp_t rsp = { .attr_value.handle = param->read.handle };
+            esp_gatt_status_t status = ESP_GATT_OK;
+            switch (attr_index(param->read.handle)) {
+                case IDX_STATUS_VAL:
+                    rsp.attr_value.len = ble_server_read_status(rsp.attr_value.value);
+                    break;
+                case IDX_CONFIG_VAL:
+                    rsp.attr_value.len = ble_server_read_config(rsp.attr_value.value);
+                    break;
+                default:
+                    status = ESP_GATT_READ_NOT_PERMIT;
+                    break;
+            }
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id,
+                                        status, &rsp);
+            break;
+        }
+
+        case ESP_GATTS_WRITE_EVT: {
+            int idx = attr_index(param->write.handle);
+            esp_gatt_status_t status = ESP_GATT_OK;
+
+            if (idx == IDX_CMD_VAL) {
+                if (ble_server_on_write(param->write.value, param->write.len) != ESP_OK) {
+                    status = ESP_GATT_BUSY;
+                }
+                ESP_LOGD(TAG, "Write received: %d bytes", param->write.len);
+            } else if (idx == IDX_CONFIG_VAL) {
+                if (ble_server_on_config_write(param->write.value, param->write.len) != ESP_OK) {
+                    status = ESP_GATT_OUT_OF_RANGE;
+                }
+            } else {
+                // A CCCD: auto response, the stack already stored and acknowledged it
+                for (int chr = 0; chr < BLE_CHAR_NOTIFY_COUNT; chr++) {
+                    if (idx == notify_attrs[chr].cccd && param->write.len == 2) {
+                        ble_server_on_subscribe(chr, param->write.value[0] | (param->write.value[1] << 8));
+                    }
+                }
+                break;
+            }
+
+            // Send response if needed
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id,
+                                            status, NULL);
+            }
+            break;
+        }
+        
+        case ESP_GATTS_CONGEST_EVT:
+            // Notifications are sent without confirmation, so this is the
+            // only backpressure the stack gives
+            ble_server_on_congest(param->congest.congested);
+            break;
+
+        case ESP_GATTS_MTU_EVT:
+            ble_server_on_mtu(param->mtu.mtu);
+            break;
+            
+        default:
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Host Interface
+//-----------------------------------------------------------------------------
+
+esp_err_t ble_host_init(void) {
+    esp_err_t ret;
+    
+    // Release classic BT memory (we only use BLE)
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+    
+    // Initialize BT controller
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    ret = esp_bt_controller_init(&bt_cfg);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Bluetooth controller init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Bluetooth controller enable failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    // Initialize Bluedroid stack
+    ret = esp_bluedroid_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Bluedroid init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ret = esp_bluedroid_enable();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Bluedroid enable failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    // Answer the client's MTU exchange with BLE_LINK_MTU
+    ret = esp_ble_gatt_set_local_mtu(BLE_LINK_MTU);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Local MTU %d refused: %s", BLE_LINK_MTU, esp_err_to_name(ret));
+    }
+    
+    // NEW: Set IO capability to NoInputNoOutput (no pairing required)
+    esp_ble_io_cap_t iocap = ESP_IO_CAP_NONE;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(uint8_t));
+    
+    // NEW: Set authentication requirements to NONE
+    uint8_t auth_req = ESP_LE_AUTH_NO_BOND;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
+    
+    // NEW: Disable key distribution
+    uint8_t key_size = 16;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(uint8_t));
+    
+    uint8_t init_key = 0;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(uint8_t));
+    
+    uint8_t rsp_key = 0;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
+    
+    // Register callbacks
+    esp_ble_gatts_register_callback(gatts_event_handler);
+    esp_ble_gap_register_callback(gap_event_handler);
+    
+    // Register GATT application
+    esp_ble_gatts_app_register(0);
+    
+    return ESP_OK;
+}
+
+esp_err_t ble_host_notify(ble_notify_char_t chr, const uint8_t *data, uint16_t len) {
+    return esp_ble_gatts_send_indicate(host.gatts_if, host.conn_id, host.handles[notify_attrs[chr].val],
+                                       len, (uint8_t *)data, false);
+}
+
+esp_err_t ble_host_update_conn_params(uint16_t min_int, uint16_t max_int,
+                                      uint16_t latency, uint16_t timeout) {
+    esp_ble_conn_update_params_t params = {
+        .min_int = min_int,
+        .max_int = max_int,
+        .latency = latency,
+        .timeout = timeout,
+    };
+    memcpy(params.bda, host.remote_bda, sizeof(esp_bd_addr_t));
+    return esp_ble_gap_update_conn_params(&params);
+}
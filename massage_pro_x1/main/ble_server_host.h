@@ -0,0 +1,84 @@
+#ifndef BLE_SERVER_HOST_H
+#define BLE_SERVER_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Host stack port of the BLE server. ble_server.c keeps everything that does
+// not depend on the stack (TX queue, waveform batching, connection policy);
+// the host file brings up the stack, the GATT service and advertising, and
+// reports what happens on the link through the ble_server_on_* hooks. The
+// host is the one selected in menuconfig (Component config > Bluetooth >
+// Host): ble_server_bluedroid.c or ble_server_nimble.c.
+
+// Characteristics the server notifies on
+typedef enum {
+    BLE_CHAR_HEALTH,
+    BLE_CHAR_WAVEFORM,
+    BLE_CHAR_STATUS,
+    BLE_CHAR_NOTIFY_COUNT,
+} ble_notify_char_t;
+
+#if CONFIG_BT_NIMBLE_ENABLED
+#define BLE_HOST_NAME           "NimBLE"
+#else
+#define BLE_HOST_NAME           "Bluedroid"
+#endif
+
+//-----------------------------------------------------------------------------
+// Implemented by the host
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Start the controller and host, register the service and advertise
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t ble_host_init(void);
+
+/**
+ * @brief Send one notification
+ *
+ * Called from the BLE TX task only.
+ *
+ * @param chr Characteristic to notify on
+ * @return esp_err_t ESP_OK if the stack took it, anything else to retry later
+ */
+esp_err_t ble_host_notify(ble_notify_char_t chr, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Ask the central for new connection parameters
+ *
+ * @param min_int Interval, 1.25 ms units
+ * @param max_int Interval, 1.25 ms units
+ * @param latency Slave latency, connection events
+ * @param timeout Supervision timeout, 10 ms units
+ */
+esp_err_t ble_host_update_conn_params(uint16_t min_int, uint16_t max_int,
+                                      uint16_t latency, uint16_t timeout);
+
+//-----------------------------------------------------------------------------
+// Called by the host, from its own task
+//-----------------------------------------------------------------------------
+
+void ble_server_on_advertising(void);
+void ble_server_on_connect(void);
+void ble_server_on_disconnect(int reason);
+// New CCCD value of a characteristic (BLE_CCCD_* bits)
+void ble_server_on_subscribe(ble_notify_char_t chr, uint16_t cccd);
+// Write to the command characteristic; anything but ESP_OK is answered busy
+esp_err_t ble_server_on_write(const uint8_t *data, uint16_t len);
+// Write to the config characteristic; anything but ESP_OK is answered out of range
+esp_err_t ble_server_on_config_write(const uint8_t *data, uint16_t len);
+// Value for a read of the status or config characteristic, length returned
+uint16_t ble_server_read_status(uint8_t *out);
+uint16_t ble_server_read_config(uint8_t *out);
+void ble_server_on_mtu(uint16_t mtu);
+void ble_server_on_data_len(uint16_t tx_octets, uint16_t rx_octets);
+void ble_server_on_phy(uint8_t tx_phy, uint8_t rx_phy);
+void ble_server_on_conn_params(uint16_t interval, uint16_t latency, uint16_t timeout);
+// The stack's notification buffers filled up (true) or drained (false)
+void ble_server_on_congest(bool congested);
+
+#endif // BLE_SERVER_HOST_H
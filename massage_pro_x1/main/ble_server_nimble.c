@@ -0,0 +1,386 @@
+/*
+ * BLE GATT Server - NimBLE Host
+ * Stack bring-up, GATT service and advertising on NimBLE; same service,
+ * UUIDs and advertising as the Bluedroid host
+ */
+
+#include "ble_server.h"
+#include "ble_server_host.h"
+#include "command_processor.h"
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "host/util/util.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include <string.h>
+
+#define TAG "BLE_NIMBLE"
+
+// LL time for BLE_LINK_DATA_LEN octets on the 1M PHY: (payload + 14) * 8 us
+#define LINK_DATA_TIME_US       ((BLE_LINK_DATA_LEN + 14) * 8)
+
+// Service and characteristic UUIDs (byte order as in the Bluedroid table)
+#define CHAR_UUID128(n) BLE_UUID128_INIT( \
+    0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, \
+    0x78, 0x56, 0x34, 0x12, (n), 0xef, 0xcd, 0xab)
+
+static const ble_uuid128_t service_uuid = BLE_UUID128_INIT(
+    0xF0, 0xDE, 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12,
+    0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12);
+
+static const ble_uuid128_t cmd_uuid = CHAR_UUID128(0x01);
+static const ble_uuid128_t health_uuid = CHAR_UUID128(0x02);
+static const ble_uuid128_t wave_uuid = CHAR_UUID128(0x03);
+static const ble_uuid128_t status_uuid = CHAR_UUID128(0x04);
+static const ble_uuid128_t config_uuid = CHAR_UUID128(0x05);
+
+// Characteristic an access is for (the access_cb arg)
+typedef enum {
+    ACCESS_CMD,
+    ACCESS_NOTIFY,
+    ACCESS_STATUS,
+    ACCESS_CONFIG,
+} access_t;
+
+// NimBLE handles and connection
+static struct {
+    uint16_t conn_handle;
+    uint16_t notify_handle[BLE_CHAR_NOTIFY_COUNT];
+    uint8_t own_addr_type;
+    volatile bool congested;    // Set when a notification found no buffer
+} host = { .conn_handle = BLE_HS_CONN_HANDLE_NONE };
+
+static int gap_event_handler(struct ble_gap_event *event, void *arg);
+static int chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// Same layout as the Bluedroid attribute table; the stack adds the CCCDs itself
+static const struct ble_gatt_svc_def gatt_services[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &service_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                .uuid = &cmd_uuid.u,
+                .access_cb = chr_access,
+                .arg = (void *)ACCESS_CMD,
+                .flags = BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                .uuid = &health_uuid.u,
+                .access_cb = chr_access,
+                .arg = (void *)ACCESS_NOTIFY,
+                .flags = BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &host.notify_handle[BLE_CHAR_HEALTH],
+            },
+            {
+                .uuid = &wave_uuid.u,
+                .access_cb = chr_access,
+                .arg = (void *)ACCESS_NOTIFY,
+                .flags = BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &host.notify_handle[BLE_CHAR_WAVEFORM],
+            },
+            {
+                .uuid = &status_uuid.u,
+                .access_cb = chr_access,
+                .arg = (void *)ACCESS_STATUS,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &host.notify_handle[BLE_CHAR_STATUS],
+            },
+            {
+                .uuid = &config_uuid.u,
+                .access_cb = chr_access,
+                .arg = (void *)ACCESS_CONFIG,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            { 0 },
+        },
+    },
+    { 0 },
+};
+
+//-----------------------------------------------------------------------------
+// GATT Access
+//-----------------------------------------------------------------------------
+
+static int chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    access_t access = (access_t)(uintptr_t)arg;
+    uint8_t data[CMD_MAX_LEN];
+    uint16_t len = 0;
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            if (access == ACCESS_STATUS) {
+                len = ble_server_read_status(data);
+            } else if (access == ACCESS_CONFIG) {
+                len = ble_server_read_config(data);
+            } else {
+                return BLE_ATT_ERR_READ_NOT_PERMITTED;
+            }
+            return (os_mbuf_append(ctxt->om, data, len) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            if (access == ACCESS_CONFIG) {
+                if (OS_MBUF_PKTLEN(ctxt->om) != BLE_CONFIG_LEN) {
+                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+                }
+                ble_hs_mbuf_to_flat(ctxt->om, data, BLE_CONFIG_LEN, &len);
+                return (ble_server_on_config_write(data, len) == ESP_OK) ? 0 : BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+            }
+            if (access != ACCESS_CMD) {
+                return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+            }
+
+            // Longer writes keep their first CMD_MAX_LEN bytes, like command_submit
+            ble_hs_mbuf_to_flat(ctxt->om, data, sizeof(data), &len);
+            ESP_LOGD(TAG, "Write received: %d bytes", OS_MBUF_PKTLEN(ctxt->om));
+            return (ble_server_on_write(data, len) == ESP_OK) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// GAP
+//-----------------------------------------------------------------------------
+
+static void start_advertising(void) {
+    struct ble_hs_adv_fields fields = {0};
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    fields.tx_pwr_lvl_is_present = 1;
+    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+    fields.name = (uint8_t *)DEVICE_NAME;
+    fields.name_len = strlen(DEVICE_NAME);
+    fields.name_is_complete = 1;
+
+    int rc = ble_gap_adv_set_fields(&fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "✗ Advertising data rejected: %d", rc);
+        return;
+    }
+
+    struct ble_gap_adv_params adv_params = {
+        .conn_mode = BLE_GAP_CONN_MODE_UND,
+        .disc_mode = BLE_GAP_DISC_MODE_GEN,
+        .itvl_min = 0x20,
+        .itvl_max = 0x40,
+    };
+    rc = ble_gap_adv_start(host.own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
+                           gap_event_handler, NULL);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "✗ Advertising start failed: %d", rc);
+        return;
+    }
+    ESP_LOGI(TAG, "✓ Advertising started successfully");
+    ble_server_on_advertising();
+}
+
+// Ask for the fastest link the controller supports
+static void link_tune(uint16_t conn_handle) {
+    // The negotiated length arrives as BLE_GAP_EVENT_DATA_LEN_CHG
+    int rc = ble_gap_set_data_len(conn_handle, BLE_LINK_DATA_LEN, LINK_DATA_TIME_US);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Data length request failed: %d", rc);
+    }
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    // BLE 5 controllers only; the ESP32's 4.2 controller stays on 1M
+    rc = ble_gap_set_prefered_le_phy(conn_handle,
+                                     BLE_GAP_LE_PHY_1M_MASK | BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_1M_MASK | BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "2M PHY request failed: %d", rc);
+    }
+#endif
+}
+
+static void report_conn_params(uint16_t conn_handle) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+        ble_server_on_conn_params(desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+    }
+}
+
+static int gap_event_handler(struct ble_gap_event *event, void *arg) {
+    switch (event->type) {
+        case BLE_GAP_EVENT_CONNECT:
+            if (event->connect.status != 0) {
+                ESP_LOGW(TAG, "Connection failed: %d", event->connect.status);
+                start_advertising();
+                break;
+            }
+            ESP_LOGI(TAG, "✓ Client connected, handle: %d", event->connect.conn_handle);
+            host.conn_handle = event->connect.conn_handle;
+            host.congested = false;
+            link_tune(event->connect.conn_handle);
+            // Unlike Bluedroid, the parameters the central opened with are known now
+            report_conn_params(event->connect.conn_handle);
+            ble_server_on_connect();
+            break;
+
+        case BLE_GAP_EVENT_DISCONNECT:
+            ESP_LOGI(TAG, "✗ Client disconnected, reason: %d", event->disconnect.reason);
+            host.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+            ble_server_on_disconnect(event->disconnect.reason);
+
+            // Restart advertising
+            start_advertising();
+            break;
+
+        case BLE_GAP_EVENT_ADV_COMPLETE:
+            start_advertising();
+            break;
+
+        case BLE_GAP_EVENT_CONN_UPDATE:
+            if (event->conn_update.status == 0) {
+                report_conn_params(event->conn_update.conn_handle);
+            }
+            break;
+
+        case BLE_GAP_EVENT_SUBSCRIBE:
+            for (int chr = 0; chr < BLE_CHAR_NOTIFY_COUNT; chr++) {
+                if (event->subscribe.attr_handle == host.notify_handle[chr]) {
+                    ble_server_on_subscribe(chr, (event->subscribe.cur_notify ? BLE_CCCD_NOTIFY : 0) |
+                                                 (event->subscribe.cur_indicate ? BLE_CCCD_INDICATE : 0));
+                }
+            }
+            break;
+
+        case BLE_GAP_EVENT_MTU:
+            ble_server_on_mtu(event->mtu.value);
+            break;
+
+        case BLE_GAP_EVENT_NOTIFY_TX:
+            // A notification left the host, so buffers are free again
+            if (host.congested) {
+                host.congested = false;
+                ble_server_on_congest(false);
+            }
+            break;
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+        case BLE_GAP_EVENT_DATA_LEN_CHG:
+            ble_server_on_data_len(event->data_len_chg.max_tx_octets,
+                                   event->data_len_chg.max_rx_octets);
+            break;
+#endif
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+        case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+            if (event->phy_updated.status == 0) {
+                ble_server_on_phy(event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+            }
+            break;
+#endif
+
+        default:
+            break;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Host Task
+//-----------------------------------------------------------------------------
+
+static void on_sync(void) {
+    int rc = ble_hs_util_ensure_addr(0);
+    if (rc == 0) {
+        rc = ble_hs_id_infer_auto(0, &host.own_addr_type);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "No usable address: %d", rc);
+        return;
+    }
+    start_advertising();
+}
+
+static void on_reset(int reason) {
+    ESP_LOGW(TAG, "Host reset, reason: %d", reason);
+}
+
+static void host_task(void *pvParameters) {
+    // Returns only when nimble_port_stop() is called
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+//-----------------------------------------------------------------------------
+// Host Interface
+//-----------------------------------------------------------------------------
+
+esp_err_t ble_host_init(void) {
+    // Release classic BT memory (we only use BLE)
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+
+    // Brings up the controller as well
+    esp_err_t ret = nimble_port_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "NimBLE init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ble_hs_cfg.sync_cb = on_sync;
+    ble_hs_cfg.reset_cb = on_reset;
+
+    // No pairing required: no IO, no bonding, no key distribution
+    ble_hs_cfg.sm_io_cap = BLE_HS_IO_NO_INPUT_OUTPUT;
+    ble_hs_cfg.sm_bonding = 0;
+    ble_hs_cfg.sm_mitm = 0;
+    ble_hs_cfg.sm_sc = 0;
+    ble_hs_cfg.sm_our_key_dist = 0;
+    ble_hs_cfg.sm_their_key_dist = 0;
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+
+    int rc = ble_gatts_count_cfg(gatt_services);
+    if (rc == 0) {
+        rc = ble_gatts_add_svcs(gatt_services);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "GATT service registration failed: %d", rc);
+        return ESP_FAIL;
+    }
+
+    ble_svc_gap_device_name_set(DEVICE_NAME);
+
+    // Answer the client's MTU exchange with BLE_LINK_MTU
+    rc = ble_att_set_preferred_mtu(BLE_LINK_MTU);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Local MTU %d refused: %d", BLE_LINK_MTU, rc);
+    }
+
+    nimble_port_freertos_init(host_task);
+    return ESP_OK;
+}
+
+esp_err_t ble_host_notify(ble_notify_char_t chr, const uint8_t *data, uint16_t len) {
+    // NimBLE has no congestion event: running out of mbufs is the signal
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    int rc = (om != NULL) ? ble_gatts_notify_custom(host.conn_handle, host.notify_handle[chr], om)
+                          : BLE_HS_ENOMEM;
+
+    if (rc == BLE_HS_ENOMEM && !host.congested) {
+        host.congested = true;
+        ble_server_on_congest(true);
+    }
+    return (rc == 0) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t ble_host_update_conn_params(uint16_t min_int, uint16_t max_int,
+                                      uint16_t latency, uint16_t timeout) {
+    struct ble_gap_upd_params params = {
+        .itvl_min = min_int,
+        .itvl_max = max_int,
+        .latency = latency,
+        .supervision_timeout = timeout,
+    };
+    return (ble_gap_update_params(host.conn_handle, &params) == 0) ? ESP_OK : ESP_FAIL;
+}
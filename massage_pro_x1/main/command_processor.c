@@ -5,28 +5,70 @@
 
 #include "command_processor.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "motor_control.h"
 #include "assistant_handler.h"
 #include "audio_control.h"
 #include "commands.h"
+#include "ppg_recorder.h"
+#include "max30102.h"
+#include "ble_server.h"
+#include <string.h>
 
 #define TAG "CMD_PROC"
 
 // External references
 extern device_state_t device_state;
 
+typedef enum {
+    CMD_MSG_COMMAND,            // BLE write, data is the command
+    CMD_MSG_AUDIO,              // Sound to play, data[0] is the audio_notify_type_t
+} cmd_msg_type_t;
+
+// A BLE write or a sound waiting for the command task
+typedef struct {
+    int64_t t_us;               // When the write arrived
+    uint8_t type;               // cmd_msg_type_t
+    uint16_t len;
+    uint8_t data[CMD_MAX_LEN];
+} cmd_msg_t;
+
+static QueueHandle_t cmd_queue = NULL;
+static cmd_stats_t stats;       // received/dropped: GATT callback, the rest: command task
+static int64_t cmd_write_us;    // Write time of the command executing, 0 once actuated
+
+// Called by handlers right after their first actuator change
+static void cmd_actuated(void) {
+    if (cmd_write_us == 0) {
+        return;
+    }
+
+    uint32_t latency_us = (uint32_t)(esp_timer_get_time() - cmd_write_us);
+    cmd_write_us = 0;
+    stats.last_actuation_us = latency_us;
+    stats.total_actuation_us += latency_us;
+    if (latency_us > stats.max_actuation_us) {
+        stats.max_actuation_us = latency_us;
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Command Handlers
 //-----------------------------------------------------------------------------
 
 static void handle_rotate_command(void) {
     motor_toggle_direction();
+    cmd_actuated();
     audio_notify(AUDIO_NOTIFY_ROTATE);
 }
 
 static void handle_heat_command(void) {
     bool new_state = !device_state.heat_on;
     motor_set_heat(new_state);
+    cmd_actuated();
     
     if (new_state) {
         audio_notify(AUDIO_NOTIFY_HEAT_ON);
@@ -37,6 +79,7 @@ static void handle_heat_command(void) {
 
 static void handle_level_command(uint8_t level) {
     motor_set_level(level);
+    cmd_actuated();
     
     // Audio feedback
     switch (level) {
@@ -69,6 +112,17 @@ static void handle_assistant_stop(void) {
     assistant_stop_session();
 }
 
+static void handle_record_command(uint8_t start) {
+    esp_err_t ret = start ? ppg_recorder_start() : ppg_recorder_stop();
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Recording %s failed: %s", start ? "start" : "stop", esp_err_to_name(ret));
+    }
+
+    // Recording keeps the sensor powered
+    max30102_demand_changed();
+}
+
 //-----------------------------------------------------------------------------
 // Main Command Processor
 //-----------------------------------------------------------------------------
@@ -115,6 +169,24 @@ void process_command(uint8_t *data, uint16_t len) {
             handle_assistant_stop();
             break;
             
+        case CMD_RECORD:
+            if (len >= 2) {
+                ESP_LOGI(TAG, "Command: RECORD %d", data[1]);
+                handle_record_command(data[1]);
+            } else {
+                ESP_LOGW(TAG, "RECORD command missing parameter");
+            }
+            break;
+            
+        case CMD_WAVEFORM_FLUSH:
+            if (len >= 3) {
+                ESP_LOGI(TAG, "Command: WAVEFORM_FLUSH");
+                ble_server_set_waveform_flush((data[1] << 8) | data[2]);
+            } else {
+                ESP_LOGW(TAG, "WAVEFORM_FLUSH command missing parameter");
+            }
+            break;
+
         case CMD_ASSISTANT:
             ESP_LOGI(TAG, "Command: ASSISTANT (legacy - ignored)");
             break;
@@ -124,3 +196,97 @@ void process_command(uint8_t *data, uint16_t len) {
             break;
     }
 }
+
+//-----------------------------------------------------------------------------
+// Command Task
+//-----------------------------------------------------------------------------
+
+static void command_task(void *pvParameters) {
+    cmd_msg_t msg;
+
+    while (1) {
+        xQueueReceive(cmd_queue, &msg, portMAX_DELAY);
+
+        if (msg.type == CMD_MSG_AUDIO) {
+            audio_notify((audio_notify_type_t)msg.data[0]);
+            continue;
+        }
+
+        uint32_t wait_us = (uint32_t)(esp_timer_get_time() - msg.t_us);
+        stats.last_wait_us = wait_us;
+        if (wait_us > stats.max_wait_us) {
+            stats.max_wait_us = wait_us;
+        }
+
+        cmd_write_us = msg.t_us;
+        process_command(msg.data, msg.len);
+        cmd_actuated();
+        stats.executed++;
+        // Status subscribers see what the command changed
+        notify_status_data();
+
+        ESP_LOGD(TAG, "0x%02X: picked up after %luus, actuated after %luus, done after %lluus",
+                 msg.data[0], wait_us, stats.last_actuation_us,
+                 esp_timer_get_time() - msg.t_us);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+esp_err_t command_processor_init(void) {
+    if (cmd_queue != NULL) {
+        return ESP_OK;
+    }
+
+    cmd_queue = xQueueCreate(CMD_QUEUE_LEN, sizeof(cmd_msg_t));
+    if (cmd_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(command_task, "cmd", CMD_TASK_STACK, NULL, CMD_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Command task ready");
+    return ESP_OK;
+}
+
+esp_err_t command_submit(const uint8_t *data, uint16_t len) {
+    cmd_msg_t msg = {
+        .t_us = esp_timer_get_time(),
+        .type = CMD_MSG_COMMAND,
+        .len = (len > CMD_MAX_LEN) ? CMD_MAX_LEN : len,
+    };
+
+    if (cmd_queue == NULL || len == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(msg.data, data, msg.len);
+
+    if (xQueueSend(cmd_queue, &msg, 0) != pdTRUE) {
+        stats.dropped++;
+        return ESP_ERR_NO_MEM;
+    }
+    stats.received++;
+    return ESP_OK;
+}
+
+esp_err_t command_submit_audio(audio_notify_type_t type) {
+    cmd_msg_t msg = {
+        .t_us = esp_timer_get_time(),
+        .type = CMD_MSG_AUDIO,
+        .len = 1,
+        .data = { type },
+    };
+
+    if (cmd_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Not a command: the latency counters leave it out
+    return (xQueueSend(cmd_queue, &msg, 0) == pdTRUE) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void command_get_stats(cmd_stats_t *out) {
+    *out = stats;
+}
@@ -2,6 +2,59 @@
 #define COMMAND_PROCESSOR_H
 
 #include <stdint.h>
+#include "esp_err.h"
+#include "audio_control.h"
+
+// Command task: BLE writes are copied into a queue by the GATT callback and
+// executed here, so slow handlers (audio, session start) never hold up the
+// Bluetooth stack. Sounds the BLE host wants played go the same way.
+#define CMD_QUEUE_LEN           8
+#define CMD_MAX_LEN             20      // Longest command kept; the rest of a write is ignored
+#define CMD_TASK_PRIO           4
+#define CMD_TASK_STACK          4096
+
+// Command latency counters, times from the BLE write. A command actuates at
+// its first motor or heater change, or when its handler returns if it has
+// none.
+typedef struct {
+    uint32_t received;          // Writes queued
+    uint32_t dropped;           // Writes refused because the queue was full
+    uint32_t executed;
+    uint32_t last_wait_us;      // Write to the command task picking it up
+    uint32_t max_wait_us;
+    uint32_t last_actuation_us; // Write to actuation
+    uint32_t max_actuation_us;
+    uint64_t total_actuation_us;    // Divide by executed for the mean
+} cmd_stats_t;
+
+/**
+ * @brief Create the command queue and task
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t command_processor_init(void);
+
+/**
+ * @brief Queue a BLE command for the command task
+ *
+ * Copies the data and never blocks; safe from the GATT callback.
+ *
+ * @param data Command data buffer
+ * @param len Length of command data
+ * @return esp_err_t ESP_OK if queued, ESP_ERR_NO_MEM if the queue is full
+ */
+esp_err_t command_submit(const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Queue a sound for the command task to play
+ *
+ * audio_notify() reads the clip from SD and blocks on I2S until it ends;
+ * this never blocks, so the BLE host hooks can use it.
+ *
+ * @param type Sound to play
+ * @return esp_err_t ESP_OK if queued, ESP_ERR_NO_MEM if the queue is full
+ */
+esp_err_t command_submit_audio(audio_notify_type_t type);
 
 /**
  * @brief Process BLE command
@@ -11,4 +64,11 @@
  */
 void process_command(uint8_t *data, uint16_t len);
 
+/**
+ * @brief Snapshot of the command latency counters
+ *
+ * @param stats Filled in
+ */
+void command_get_stats(cmd_stats_t *stats);
+
 #endif // COMMAND_PROCESSOR_H
@@ -10,6 +10,8 @@
 #define CMD_LEVEL               0x04  // Set intensity level (0-5)
 #define CMD_ASSISTANT_CONFIG    0x06  // Configure assistant mode with parameters
 #define CMD_ASSISTANT_STOP      0x07  // Stop assistant mode
+#define CMD_RECORD              0x08  // Raw PPG recording to SD: [CMD][1=start, 0=stop]
+#define CMD_WAVEFORM_FLUSH      0x09  // Waveform batch latency: [CMD][MS_HIGH][MS_LOW]
 
 // Device State Structure
 typedef struct {
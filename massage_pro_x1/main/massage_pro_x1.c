@@ -15,7 +15,10 @@
 #include "motor_control.h"
 #include "max30102.h"
 #include "audio_control.h"
+#include "ppg_recorder.h"
+#include "ppg_source.h"
 #include "assistant_handler.h"
+#include "command_processor.h"
 #include "commands.h"
 
 // Logging tag
@@ -66,10 +69,13 @@ static esp_err_t init_hardware(void) {
     
     // Initialize health monitoring (MAX30102)
     ESP_LOGI(TAG, "  - Health monitor...");
+    const ppg_source_t *ppg_src = ppg_source_get(PPG_SOURCE_DEFAULT);
     ret = max30102_i2c_init();
-    if (ret != ESP_OK) {
+    if (ret != ESP_OK && PPG_SOURCE_DEFAULT == PPG_SOURCE_SENSOR) {
         ESP_LOGE(TAG, "✗ Health monitor init failed: %s", esp_err_to_name(ret));
         // Non-critical, continue anyway
+    } else if (max30102_start(ppg_src) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Health monitor task create failed");
     } else {
         ESP_LOGI(TAG, "  ✓ Health monitor ready");
     }
@@ -80,6 +86,11 @@ static esp_err_t init_hardware(void) {
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "  ✓ Audio system ready");
         audio_notify(AUDIO_NOTIFY_STARTUP);
+
+        // Raw PPG recorder shares the SD card mounted by audio
+        if (ppg_recorder_init() != ESP_OK) {
+            ESP_LOGW(TAG, "  ⚠ PPG recorder init failed (non-critical)");
+        }
     } else {
         ESP_LOGW(TAG, "  ⚠ Audio init failed (non-critical)");
     }
@@ -94,7 +105,14 @@ static esp_err_t init_hardware(void) {
 static esp_err_t init_bluetooth(void) {
     ESP_LOGI(TAG, "Initializing Bluetooth...");
     
-    esp_err_t ret = ble_server_init();
+    // Writes are queued for the command task from the first connection on
+    esp_err_t ret = command_processor_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Command task init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    ret = ble_server_init();
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "✓ Bluetooth initialized successfully");
     } else {
@@ -1,349 +1,945 @@
 /* max30102.c */
 #include "max30102.h"
-#include "driver/i2c.h"
+#include "driver/i2c_master.h"
+#include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 static const char *TAG = "MAX30102";
 #include "ble_server.h"
+#include "ppg_dsp.h"
+#include "ppg_ring.h"
+#include "ppg_fifo.h"
+#include "ppg_recorder.h"
+#include "ppg_source.h"
+#include "nvs.h"
+#include <math.h>
 // Register Addresses
 #define MAX30102_ADDR               0x57
 #define REG_INTR_STATUS_1           0x00
+#define REG_INTR_STATUS_2           0x01
+#define REG_INTR_ENABLE_1           0x02
+#define REG_INTR_ENABLE_2           0x03
 #define REG_FIFO_WR_PTR             0x04
+#define REG_OVF_COUNTER             0x05
 #define REG_FIFO_RD_PTR             0x06
 #define REG_FIFO_DATA               0x07
+#define REG_FIFO_CONFIG             0x08
 #define REG_MODE_CONFIG             0x09
 #define REG_SPO2_CONFIG             0x0A
 #define REG_LED1_PA                 0x0C
 #define REG_LED2_PA                 0x0D
+
+#define INTR_A_FULL                 0x80    // FIFO almost full (status + enable bit)
+#define MODE_SPO2                   0x03    // Red + IR
+#define MODE_SHDN                   0x80    // Power save: LEDs and ADC off, registers kept
+
+// Register fields for MAX30102_SAMPLE_RATE / MAX30102_SAMPLE_AVG
+#define SPO2_ADC_RGE_4096           (0x01 << 5)
+#define SPO2_SR_CODE                ((MAX30102_SAMPLE_RATE == 800 ? 4 : \
+                                      MAX30102_SAMPLE_RATE == 400 ? 3 : \
+                                      MAX30102_SAMPLE_RATE == 200 ? 2 : 1) << 2)
+#define SPO2_PW_CODE                (MAX30102_SAMPLE_RATE == 800 ? 0x02 : 0x03)  // 215us : 411us
+#define FIFO_SMP_AVE_CODE           ((MAX30102_SAMPLE_AVG == 32 ? 5 : \
+                                      MAX30102_SAMPLE_AVG == 16 ? 4 : \
+                                      MAX30102_SAMPLE_AVG == 8 ? 3 : \
+                                      MAX30102_SAMPLE_AVG == 4 ? 2 : \
+                                      MAX30102_SAMPLE_AVG == 2 ? 1 : 0) << 5)
+#define MAX30102_BYTES_PER_SAMPLE   6       // 3 bytes Red + 3 bytes IR
+#define REG_STATUS_BLOCK_LEN        7       // INTR_STATUS_1 .. FIFO_RD_PTR
+
 // --- Low Level I2C Functions ---
+// All transfers are queued on the i2c_master bus and complete through
+// on_trans_done. Register access waits for that callback; FIFO bursts are
+// started here and collected later so they overlap with sample processing.
+
+static i2c_master_bus_handle_t bus_handle = NULL;
+static i2c_master_dev_handle_t dev_handle = NULL;
+static SemaphoreHandle_t xfer_done = NULL;
+static volatile i2c_master_event_t xfer_event = I2C_EVENT_ALIVE;
+static max30102_bus_stats_t bus_stats = {0};
+
+static bool IRAM_ATTR max30102_on_trans_done(i2c_master_dev_handle_t dev,
+                                             const i2c_master_event_data_t *evt_data,
+                                             void *arg) {
+    BaseType_t higher_prio_woken = pdFALSE;
+    xfer_event = evt_data->event;
+    xSemaphoreGiveFromISR(xfer_done, &higher_prio_woken);
+    return higher_prio_woken == pdTRUE;
+}
 
 esp_err_t max30102_i2c_init(void) {
-    i2c_config_t conf = {
-        .mode = I2C_MODE_MASTER,
+    i2c_master_bus_config_t bus_config = {
+        .i2c_port = I2C_MASTER_NUM,
         .sda_io_num = I2C_MASTER_SDA_IO,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
         .scl_io_num = I2C_MASTER_SCL_IO,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master.clk_speed = I2C_MASTER_FREQ_HZ,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .trans_queue_depth = MAX30102_I2C_QUEUE_DEPTH,
+        .flags.enable_internal_pullup = true,
+    };
+    esp_err_t ret = i2c_new_master_bus(&bus_config, &bus_handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    i2c_device_config_t dev_config = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = MAX30102_ADDR,
+        .scl_speed_hz = I2C_MASTER_FREQ_HZ,
+    };
+    ret = i2c_master_bus_add_device(bus_handle, &dev_config, &dev_handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    xfer_done = xSemaphoreCreateBinary();
+    if (xfer_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    i2c_master_event_callbacks_t cbs = {
+        .on_trans_done = max30102_on_trans_done,
     };
-    i2c_param_config(I2C_MASTER_NUM, &conf);
-    return i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
-}
-
-static void max30102_write_reg(uint8_t reg, uint8_t data) {
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (MAX30102_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, reg, true);
-    i2c_master_write_byte(cmd, data, true);
-    i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-}
-
-static void max30102_read_fifo(uint8_t *data, int length) {
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (MAX30102_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, REG_FIFO_DATA, true);
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (MAX30102_ADDR << 1) | I2C_MASTER_READ, true);
-    i2c_master_read(cmd, data, length, I2C_MASTER_LAST_NACK);
-    i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-}
-
-static void max30102_setup_regs() {
+    return i2c_master_register_event_callbacks(dev_handle, &cbs, NULL);
+}
+
+void max30102_get_bus_stats(max30102_bus_stats_t *stats) {
+    *stats = bus_stats;
+}
+
+// A transfer that never completes means SDA/SCL is stuck; clock the bus free
+// rather than letting every later call wait out its timeout too.
+static void max30102_bus_recover(void) {
+    i2c_master_bus_wait_all_done(bus_handle, MAX30102_I2C_TIMEOUT_MS);
+    if (i2c_master_bus_reset(bus_handle) == ESP_OK) {
+        bus_stats.bus_resets++;
+    }
+    xSemaphoreTake(xfer_done, 0);
+}
+
+// Queue failed before reaching the bus
+static esp_err_t max30102_xfer_rejected(esp_err_t ret) {
+    bus_stats.errors++;
+    ESP_LOGW(TAG, "I2C queue failed: %s", esp_err_to_name(ret));
+    return ret;
+}
+
+static esp_err_t max30102_xfer_wait(void) {
+    if (xSemaphoreTake(xfer_done, pdMS_TO_TICKS(MAX30102_I2C_TIMEOUT_MS)) != pdTRUE) {
+        bus_stats.timeouts++;
+        ESP_LOGW(TAG, "I2C timeout (%lu total), resetting bus", bus_stats.timeouts);
+        max30102_bus_recover();
+        return ESP_ERR_TIMEOUT;
+    }
+
+    switch (xfer_event) {
+        case I2C_EVENT_DONE:
+            bus_stats.transfers++;
+            return ESP_OK;
+        case I2C_EVENT_NACK:
+            bus_stats.nacks++;
+            ESP_LOGW(TAG, "I2C NACK (%lu total)", bus_stats.nacks);
+            return ESP_FAIL;
+        case I2C_EVENT_TIMEOUT:
+            bus_stats.timeouts++;
+            ESP_LOGW(TAG, "I2C timeout (%lu total), resetting bus", bus_stats.timeouts);
+            max30102_bus_recover();
+            return ESP_ERR_TIMEOUT;
+        default:
+            bus_stats.errors++;
+            return ESP_FAIL;
+    }
+}
+
+static esp_err_t max30102_write_reg(uint8_t reg, uint8_t data) {
+    uint8_t buf[2] = {reg, data};
+
+    xSemaphoreTake(xfer_done, 0);
+    esp_err_t ret = i2c_master_transmit(dev_handle, buf, sizeof(buf), MAX30102_I2C_TIMEOUT_MS);
+    if (ret != ESP_OK) {
+        return max30102_xfer_rejected(ret);
+    }
+    return max30102_xfer_wait();
+}
+
+// Start a read at 'reg' without waiting. 'data' must stay valid until
+// max30102_xfer_wait() returns. The FIFO data register does not
+// auto-increment, so reading N*6 bytes from REG_FIFO_DATA pops N samples.
+static esp_err_t max30102_read_regs_start(uint8_t reg, uint8_t *data, size_t length) {
+    static uint8_t reg_addr;
+
+    reg_addr = reg;
+    xSemaphoreTake(xfer_done, 0);
+    esp_err_t ret = i2c_master_transmit_receive(dev_handle, &reg_addr, 1, data, length,
+                                                MAX30102_I2C_TIMEOUT_MS);
+    if (ret != ESP_OK) {
+        return max30102_xfer_rejected(ret);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t max30102_read_regs(uint8_t reg, uint8_t *data, size_t length) {
+    esp_err_t ret = max30102_read_regs_start(reg, data, length);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return max30102_xfer_wait();
+}
+
+// Read INTR_STATUS_1 through FIFO_RD_PTR in one transaction: reading status
+// releases the INT line, and WR_PTR/OVF_COUNTER/RD_PTR give a consistent
+// snapshot of how many samples are waiting.
+static esp_err_t max30102_fifo_status(ppg_fifo_regs_t *status) {
+    uint8_t regs[REG_STATUS_BLOCK_LEN];
+    esp_err_t ret = max30102_read_regs(REG_INTR_STATUS_1, regs, sizeof(regs));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    status->wr_ptr = regs[REG_FIFO_WR_PTR];
+    status->ovf = regs[REG_OVF_COUNTER];
+    status->rd_ptr = regs[REG_FIFO_RD_PTR];
+    return ESP_OK;
+}
+
+static esp_err_t max30102_setup_regs(void) {
+    esp_err_t ret;
+
     // 1. Reset
-    max30102_write_reg(REG_MODE_CONFIG, 0x40);
+    ret = max30102_write_reg(REG_MODE_CONFIG, 0x40);
+    if (ret != ESP_OK) {
+        return ret;
+    }
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
-    // 2. Mode = SpO2 (Red + IR)
-    max30102_write_reg(REG_MODE_CONFIG, 0x03);
+    const uint8_t config[][2] = {
+        // 2. Mode = SpO2 (Red + IR)
+        {REG_MODE_CONFIG, MODE_SPO2},
+
+        // 3. SpO2 Config: 4096nA range, MAX30102_SAMPLE_RATE, widest pulse
+        //    the rate allows (data is left justified, so scale is unchanged)
+        {REG_SPO2_CONFIG, SPO2_ADC_RGE_4096 | SPO2_SR_CODE | SPO2_PW_CODE},
+
+        // 4. LED Pulse Amplitudes (Current)
+        // Start at ~7.2mA; the AGC adjusts from here
+        {REG_LED1_PA, PPG_AGC_PA_DEFAULT}, // Red
+        {REG_LED2_PA, PPG_AGC_PA_DEFAULT}, // IR
+
+        // 5. FIFO: MAX30102_SAMPLE_AVG averaging, no rollover, almost-full when
+        //    MAX30102_FIFO_BURST_SAMPLES are waiting (A_FULL = empty slots left)
+        {REG_FIFO_CONFIG, FIFO_SMP_AVE_CODE | ((MAX30102_FIFO_DEPTH - MAX30102_FIFO_BURST_SAMPLES) & 0x0F)},
 
-    // 3. SpO2 Config: 4096nA range, 100Hz sample rate, 411uS pulse width
-    max30102_write_reg(REG_SPO2_CONFIG, 0x27);
+        // 6. Interrupt on FIFO almost full only
+        {REG_INTR_ENABLE_1, INTR_A_FULL},
+        {REG_INTR_ENABLE_2, 0x00},
 
-    // 4. LED Pulse Amplitudes (Current)
-    // 0x24 = ~7.2mA. Increase this if values are too low/dark.
-    max30102_write_reg(REG_LED1_PA, 0x24); // Red
-    max30102_write_reg(REG_LED2_PA, 0x24); // IR
+        // 7. Clear FIFO pointers
+        {REG_FIFO_WR_PTR, 0x00},
+        {REG_OVF_COUNTER, 0x00},
+        {REG_FIFO_RD_PTR, 0x00},
+    };
+
+    for (size_t i = 0; i < sizeof(config) / sizeof(config[0]); i++) {
+        ret = max30102_write_reg(config[i][0], config[i][1]);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
 
-    // 5. Clear FIFO pointers
-    max30102_write_reg(REG_FIFO_WR_PTR, 0x00);
-    max30102_write_reg(REG_FIFO_RD_PTR, 0x00);
-    
     ESP_LOGI(TAG, "MAX30102 Configured");
+    return ESP_OK;
+}
+
+// --- FIFO Interrupt ---
+
+static void IRAM_ATTR max30102_isr_handler(void *arg) {
+    BaseType_t higher_prio_woken = pdFALSE;
+    vTaskNotifyGiveFromISR((TaskHandle_t)arg, &higher_prio_woken);
+    if (higher_prio_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static esp_err_t max30102_int_init(TaskHandle_t task) {
+    if (MAX30102_INT_IO < 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << MAX30102_INT_IO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,   // INT is open-drain
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // Another module may already have installed the ISR service
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        return ret;
+    }
+
+    return gpio_isr_handler_add(MAX30102_INT_IO, max30102_isr_handler, task);
 }
 
 // --- Main Task ---
 
-#include <math.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+#define SAMPLE_RATE MAX30102_FIFO_RATE  // Hz, FIFO samples
+
+// SpO2 calibration override: blob of spo2_cal_t (Q16 a, b, c)
+#define SPO2_NVS_NAMESPACE "ppg"
+#define SPO2_NVS_KEY "spo2_cal"
+
+// Set to 1 to log average CPU cycles spent per sample and the share of one
+// core that is at the source rate
+#define MAX30102_PROFILE_CYCLES 0
+#define PROFILE_SAMPLES (10 * SAMPLE_RATE)
 
-#define BUFFER_SIZE 100
-#define MIN_VALID_IR 50000
-#define MAX_VALID_IR 200000
-#define SAMPLE_RATE 100  // Hz
-#define BEAT_THRESHOLD 3000  // Minimum change to detect a beat
+static ppg_dsp_t ppg;
+static ppg_agc_t agc;
+static volatile hr_engine_t hr_engine = MAX30102_DEFAULT_HR_ENGINE;
+static volatile bool hrv_restart = false;
+static hrv_metrics_t hrv_latest;
+static portMUX_TYPE hrv_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t hrv_sent_beats = 0;
+static volatile uint8_t signal_quality = 0;
+static volatile bool motion_detected = false;
+static max30102_timeline_stats_t timeline_stats;
+static portMUX_TYPE timeline_lock = portMUX_INITIALIZER_UNLOCKED;
 
-// Circular buffer for filtering
+// Single core builds run both tasks on core 0
+#if CONFIG_FREERTOS_UNICORE
+#define ACQ_CORE    0
+#define PROC_CORE   0
+#else
+#define ACQ_CORE    MAX30102_ACQ_CORE
+#define PROC_CORE   MAX30102_PROC_CORE
+#endif
+
+// One FIFO burst as read, in place in a ring slot
 typedef struct {
-    uint32_t red[BUFFER_SIZE];
-    uint32_t ir[BUFFER_SIZE];
-    int head;
-    int count;
-} sensor_buffer_t;
+    int64_t t_us;               // esp_timer time the burst was read
+    uint32_t lost;              // Timeline samples lost before it
+    uint16_t count;
+    uint8_t led_pa[2];          // LED setting it was read with
+    uint8_t data[MAX30102_FIFO_DEPTH * MAX30102_BYTES_PER_SAMPLE];
+} ppg_block_t;
+
+static ppg_block_t ring_slots[MAX30102_RING_BLOCKS];
+static ppg_ring_t ring;
+static TaskHandle_t processing_handle = NULL;
+static TaskHandle_t acquisition_handle = NULL;
+
+// Demand gating, only for sources that can stand by (see max30102.h)
+static bool demand_gating = false;
+static volatile bool session_active = false;
+
+// Read times anchor the DSP clock, only for sources paced in real time
+static bool anchor_reads = true;
+
+// Sample occupancy: each counter has a single writer, the difference is
+// what is waiting in the ring
+static volatile uint32_t ring_published = 0;    // Acquisition
+static volatile uint32_t ring_released = 0;     // Processing
+static uint32_t ring_high_samples = 0;          // Acquisition
+static volatile uint32_t ring_dropped = 0;      // Acquisition
+static volatile uint32_t ring_max_latency_us = 0;   // Processing
+
+// LED setting chosen by the AGC (processing), written by acquisition
+static uint8_t led_request[2] = { PPG_AGC_PA_DEFAULT, PPG_AGC_PA_DEFAULT };
+static portMUX_TYPE led_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void max30102_set_hr_engine(hr_engine_t engine) {
+    hr_engine = engine;
+}
+
+hr_engine_t max30102_get_hr_engine(void) {
+    return hr_engine;
+}
+
+void max30102_get_hrv(hrv_metrics_t *out) {
+    portENTER_CRITICAL(&hrv_lock);
+    *out = hrv_latest;
+    portEXIT_CRITICAL(&hrv_lock);
+}
+
+void max30102_restart_hrv(void) {
+    hrv_restart = true;
+}
+
+void max30102_get_timeline_stats(max30102_timeline_stats_t *stats) {
+    portENTER_CRITICAL(&timeline_lock);
+    *stats = timeline_stats;
+    portEXIT_CRITICAL(&timeline_lock);
+}
+
+void max30102_get_ring_stats(max30102_ring_stats_t *stats) {
+    stats->capacity = ring.capacity;
+    stats->used = ppg_ring_count(&ring);
+    stats->high_water = ring.high_water;
+    stats->high_water_samples = ring_high_samples;
+    stats->overruns = ring.overruns;
+    stats->dropped_samples = ring_dropped;
+    stats->max_latency_us = ring_max_latency_us;
+}
+
+void max30102_set_session_active(bool active) {
+    session_active = active;
+    max30102_demand_changed();
+}
+
+void max30102_demand_changed(void) {
+    if (acquisition_handle != NULL) {
+        xTaskNotifyGive(acquisition_handle);
+    }
+}
+
+// HR, SpO2, HRV or motion have a consumer
+static bool dsp_demand(void) {
+    return session_active ||
+           ble_server_is_subscribed(BLE_STREAM_HEALTH) ||
+           ble_server_is_subscribed(BLE_STREAM_HRV);
+}
+
+// Anything at all wants samples
+static bool sensor_demand(void) {
+    return dsp_demand() || ppg_recorder_is_recording() ||
+           ble_server_is_subscribed(BLE_STREAM_WAVEFORM);
+}
+
+uint8_t max30102_get_quality(void) {
+    return signal_quality;
+}
+
+bool max30102_motion_detected(void) {
+    return motion_detected;
+}
+
+// SpO2 calibration from NVS, or the default curve
+static spo2_cal_t load_spo2_calibration(void) {
+    spo2_cal_t cal = SPO2_CAL_DEFAULT;
+    nvs_handle_t nvs;
+
+    if (nvs_open(SPO2_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        spo2_cal_t stored;
+        size_t len = sizeof(stored);
+        if (nvs_get_blob(nvs, SPO2_NVS_KEY, &stored, &len) == ESP_OK && len == sizeof(stored)) {
+            cal = stored;
+            ESP_LOGI(TAG, "SpO2 calibration loaded from NVS");
+        }
+        nvs_close(nvs);
+    }
+
+    return cal;
+}
+
+// Pipeline output: forward to BLE
+static void on_ppg_result(const ppg_result_t *result, void *ctx) {
+    notify_spo2_data(result->heart_rate, result->spo2, result->quality, result->motion);
+
+    // Polled by the assistant task, which owns the voice prompts: playback
+    // blocks, and the ring must keep draining
+    signal_quality = result->quality;
+    if (result->motion != motion_detected) {
+        ESP_LOGI(TAG, "Motion %s", result->motion ? "detected, readings suppressed" : "ended");
+        motion_detected = result->motion;
+    }
+
+    portENTER_CRITICAL(&hrv_lock);
+    hrv_latest = result->hrv;
+    portEXIT_CRITICAL(&hrv_lock);
+
+    // HRV only moves on a new beat
+    if (result->hrv.intervals >= HRV_MIN_INTERVALS && result->hrv.accepted != hrv_sent_beats) {
+        notify_hrv_data((uint16_t)lroundf(result->hrv.rmssd_ms * 10),
+                        (uint16_t)lroundf(result->hrv.sdnn_ms * 10),
+                        (uint8_t)lroundf(result->hrv.pnn50),
+                        result->hrv.intervals);
+        hrv_sent_beats = result->hrv.accepted;
+    }
+
+    if (!result->finger) {
+        ESP_LOGD(TAG, "No valid finger detected");
+    } else if (result->heart_rate > 0) {
+        ESP_LOGI(TAG, "HR: %d BPM | SpO2: %d%% | Q: %d", result->heart_rate, result->spo2,
+                 result->quality);
+    } else {
+        ESP_LOGD(TAG, "Collecting data... (beats: %d, Q: %d)", result->beat_count, result->quality);
+    }
+}
+
+// Waveform at PPG_DSP_SAMPLE_RATE whatever the source runs at. It has its
+// own anti-alias decimator, same design as the DSP's, because the DSP may
+// be idle while the waveform streams.
+static void stream_waveform(const ppg_block_t *block, const uint32_t *red, const uint32_t *ir) {
+    static ppg_decim_t decim;
+    static bool streaming = false;
+    uint32_t red_out[MAX30102_FIFO_DEPTH + 1];
+    uint32_t ir_out[MAX30102_FIFO_DEPTH + 1];
+
+    if (!ble_server_is_subscribed(BLE_STREAM_WAVEFORM)) {
+        streaming = false;
+        return;
+    }
+    if (!streaming) {
+        ppg_decim_init(&decim, ppg.decim.factor);
+        streaming = true;
+    } else if (block->lost > 0) {
+        ppg_decim_skip(&decim, block->lost);
+    }
+
+    // Output k completes at input `first` + k * factor and is centred
+    // `centre` inputs before it; the last input of the burst was taken when
+    // it was read
+    const int first = decim.factor - 1 - decim.phase;
+    const float centre = (float)(decim.factor - 1) - ppg_decim_delay(&decim);
+    int out = ppg_decim_process(&decim, red, ir, block->count, red_out, ir_out);
+
+    for (int k = 0; k < out; k++) {
+        float behind = (float)(block->count - 1 - (first + k * decim.factor)) + centre;
+        notify_waveform_data(ir_out[k], block->t_us - (int64_t)lroundf(behind * 1000000.0f /
+                                                                      ppg.cfg.input_rate));
+    }
+}
+
+// Unpack and process one FIFO burst
+static void process_block(const ppg_block_t *block) {
+    const int count = block->count;
+    uint32_t red[MAX30102_FIFO_DEPTH];
+    uint32_t ir[MAX30102_FIFO_DEPTH];
+    static uint32_t dsp_idle = 0;       // Timeline samples the DSP skipped
+    static bool dsp_running = true;
+    const bool run_dsp = !demand_gating || dsp_demand();
+
+#if MAX30102_PROFILE_CYCLES
+    static uint64_t total_cycles = 0;
+    static uint32_t profiled = 0;
+    esp_cpu_cycle_count_t start_cycles = esp_cpu_get_cycle_count();
+#endif
+
+    if (hrv_restart) {
+        hrv_restart = false;
+        ppg_dsp_reset_hrv(&ppg);
+        hrv_sent_beats = 0;
+        ESP_LOGI(TAG, "HRV restarted");
+    }
+
+    // Engine switched: start the autocorrelation window from scratch
+    hr_engine_t engine = hr_engine;
+    if (engine != ppg.cfg.hr_engine) {
+        ppg_dsp_set_hr_engine(&ppg, engine);
+        ESP_LOGI(TAG, "HR engine: %s",
+                 engine == HR_ENGINE_AUTOCORR ? "autocorrelation" : "peak");
+    }
+
+    ppg_source_unpack(block->data, count, red, ir);
+    stream_waveform(block, red, ir);
+
+    // Nobody reads the results: the skipped span goes to the DSP as a gap
+    // when it resumes, bridged if short, a restart otherwise
+    if (!run_dsp) {
+        if (dsp_running) {
+            dsp_running = false;
+            signal_quality = 0;
+            motion_detected = false;
+            ESP_LOGI(TAG, "No result consumers, DSP idle");
+        }
+        dsp_idle += block->lost + count;
+    } else {
+        uint32_t lost = block->lost + dsp_idle;
+        if (!dsp_running) {
+            dsp_running = true;
+            ESP_LOGI(TAG, "DSP resumed");
+        }
+        dsp_idle = 0;
+
+        ppg_source_process(&ppg, red, ir, count, lost, anchor_reads ? block->t_us : -1,
+                           block->led_pa);
+    }
+
+    // The AGC keeps the LEDs right for the recorder and the waveform too
+    ppg_agc_update(&agc, red, ir, count, block->led_pa);
+
+#if MAX30102_PROFILE_CYCLES
+    total_cycles += esp_cpu_get_cycle_count() - start_cycles;
+    profiled += count;
+    if (profiled >= PROFILE_SAMPLES) {
+        uint32_t per_sample = (uint32_t)(total_cycles / profiled);
+        uint32_t load_permille = (uint32_t)((uint64_t)per_sample * ppg.cfg.input_rate * 1000 /
+                                            (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000ULL));
+        ESP_LOGI(TAG, "Processing: %lu cycles/sample at %luHz, %lu.%lu%% of one core",
+                 per_sample, ppg.cfg.input_rate, load_permille / 10, load_permille % 10);
+        total_cycles = 0;
+        profiled = 0;
+    }
+#endif
+}
+
+// --- Sensor Source Backend ---
 
-// Heart rate detection state
 typedef struct {
-    uint32_t last_beat_time;
-    uint32_t beat_intervals[4];  // Store last 4 intervals
-    int beat_count;
-    uint32_t last_ir_value;
-    bool beat_detected;
-} hr_state_t;
-
-static sensor_buffer_t buffer = {0};
-static hr_state_t hr_state = {0};
-
-// Add sample to circular buffer
-void add_sample(uint32_t red, uint32_t ir) {
-    buffer.red[buffer.head] = red;
-    buffer.ir[buffer.head] = ir;
-    buffer.head = (buffer.head + 1) % BUFFER_SIZE;
-    if (buffer.count < BUFFER_SIZE) {
-        buffer.count++;
-    }
-}
-
-// Simple moving average filter
-uint32_t moving_average(uint32_t *data, int window) {
-    if (buffer.count < window) return 0;
-    
-    uint64_t sum = 0;
-    int start = (buffer.head - window + BUFFER_SIZE) % BUFFER_SIZE;
-    
-    for (int i = 0; i < window; i++) {
-        int idx = (start + i) % BUFFER_SIZE;
-        sum += data[idx];
-    }
-    
-    return (uint32_t)(sum / window);
-}
-
-// DC removal using moving average
-int32_t remove_dc(uint32_t current, uint32_t *data) {
-    uint32_t dc = moving_average(data, 20);
-    if (dc == 0) return 0;
-    return (int32_t)current - (int32_t)dc;
-}
-
-// Detect heartbeat using peak detection
-bool detect_beat(int32_t ir_ac, uint32_t current_time) {
-    static int32_t last_value = 0;
-    static int32_t max_value = 0;
-    static bool rising = false;
-    
-    // Track if we're in rising phase
-    if (ir_ac > last_value) {
-        rising = true;
-        if (ir_ac > max_value) {
-            max_value = ir_ac;
+    bool use_interrupt;
+    TickType_t burst_ticks;     // Burst period at SAMPLE_RATE; also the poll period / missed-edge fallback
+    ppg_fifo_t fifo;            // Read pointer bookkeeping (ppg_fifo.h)
+} sensor_ctx_t;
+
+static sensor_ctx_t sensor_ctx;
+
+static esp_err_t sensor_open(void *ctx) {
+    sensor_ctx_t *s = ctx;
+
+    esp_err_t ret = max30102_setup_regs();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    s->burst_ticks = pdMS_TO_TICKS(MAX30102_FIFO_BURST_SAMPLES * 1000 / SAMPLE_RATE);
+    ppg_fifo_reset(&s->fifo, SAMPLE_RATE);   // Pointers were just cleared
+    s->use_interrupt = (max30102_int_init(xTaskGetCurrentTaskHandle()) == ESP_OK);
+    ESP_LOGI(TAG, "MAX30102 %s", s->use_interrupt ? "FIFO interrupt" : "FIFO polling");
+    return ESP_OK;
+}
+
+static void sensor_wait(void *ctx) {
+    sensor_ctx_t *s = ctx;
+
+    if (s->use_interrupt) {
+        // Timeout covers an edge lost while INT was already low
+        ulTaskNotifyTake(pdTRUE, 2 * s->burst_ticks);
+    } else {
+        vTaskDelay(s->burst_ticks);
+    }
+}
+
+// Gaps and repeats come from the FIFO registers, see ppg_fifo.h
+static esp_err_t sensor_pending(void *ctx, ppg_source_burst_t *burst) {
+    sensor_ctx_t *s = ctx;
+    ppg_fifo_regs_t status;
+    ppg_fifo_burst_t fifo_burst;
+
+    esp_err_t ret = max30102_fifo_status(&status);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ppg_fifo_status(&s->fifo, &status, esp_timer_get_time(), &fifo_burst);
+
+    if (fifo_burst.overflow > 0) {
+        portENTER_CRITICAL(&timeline_lock);
+        timeline_stats.overflows++;
+        portEXIT_CRITICAL(&timeline_lock);
+        ESP_LOGW(TAG, "FIFO overflow, %lu samples lost", fifo_burst.overflow);
+    }
+
+    burst->count = fifo_burst.count;
+    burst->lost = fifo_burst.lost;
+    burst->duplicates = fifo_burst.duplicates;
+    return ESP_OK;
+}
+
+static esp_err_t sensor_read_start(void *ctx, uint8_t *buf, int count) {
+    sensor_ctx_t *s = ctx;
+
+    esp_err_t ret = max30102_read_regs_start(REG_FIFO_DATA, buf, count * MAX30102_BYTES_PER_SAMPLE);
+    ppg_fifo_read_start(&s->fifo, count, ret == ESP_OK);
+    return ret;
+}
+
+static esp_err_t sensor_read_wait(void *ctx) {
+    sensor_ctx_t *s = ctx;
+
+    esp_err_t ret = max30102_xfer_wait();
+    ppg_fifo_read_done(&s->fifo, ret == ESP_OK);
+    return ret;
+}
+
+// Shut down: LEDs and ADC off, a few uA. On wake the FIFO restarts empty,
+// so the read pointer bookkeeping starts over.
+static esp_err_t sensor_standby(void *ctx, bool standby) {
+    sensor_ctx_t *s = ctx;
+
+    if (standby) {
+        return max30102_write_reg(REG_MODE_CONFIG, MODE_SHDN | MODE_SPO2);
+    }
+
+    const uint8_t config[][2] = {
+        {REG_FIFO_WR_PTR, 0x00},
+        {REG_OVF_COUNTER, 0x00},
+        {REG_FIFO_RD_PTR, 0x00},
+        {REG_MODE_CONFIG, MODE_SPO2},
+    };
+    for (size_t i = 0; i < sizeof(config) / sizeof(config[0]); i++) {
+        esp_err_t ret = max30102_write_reg(config[i][0], config[i][1]);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    ppg_fifo_reset(&s->fifo, SAMPLE_RATE);
+    return ESP_OK;
+}
+
+static esp_err_t sensor_set_led(void *ctx, const uint8_t led_pa[2]) {
+    esp_err_t ret = max30102_write_reg(REG_LED1_PA, led_pa[PPG_AGC_RED]);
+    if (ret == ESP_OK) {
+        ret = max30102_write_reg(REG_LED2_PA, led_pa[PPG_AGC_IR]);
+    }
+    return ret;
+}
+
+static void sensor_close(void *ctx) {
+    sensor_ctx_t *s = ctx;
+
+    if (s->use_interrupt) {
+        gpio_isr_handler_remove(MAX30102_INT_IO);
+        s->use_interrupt = false;
+    }
+}
+
+static uint32_t sensor_sample_rate(void *ctx) {
+    return SAMPLE_RATE;
+}
+
+static const ppg_source_ops_t sensor_ops = {
+    .name = "max30102",
+    .open = sensor_open,
+    .sample_rate = sensor_sample_rate,
+    .wait = sensor_wait,
+    .pending = sensor_pending,
+    .read_start = sensor_read_start,
+    .read_wait = sensor_read_wait,
+    .set_led = sensor_set_led,
+    .standby = sensor_standby,
+    .real_time = NULL,      // Read times follow the sensor's oscillator
+    .close = sensor_close,
+};
+
+const ppg_source_t *ppg_source_max30102(void) {
+    static const ppg_source_t source = { .ops = &sensor_ops, .ctx = &sensor_ctx };
+    return &source;
+}
+
+// Processing task: drains the ring through the DSP and the AGC, forwards
+// results over BLE. Nothing here can hold up a FIFO read.
+static void processing_task(void *pvParameters) {
+#if MAX30102_RING_LOG_S
+    int64_t next_log_us = esp_timer_get_time() + MAX30102_RING_LOG_S * 1000000LL;
+#endif
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        const ppg_block_t *block;
+        while ((block = ppg_ring_peek(&ring)) != NULL) {
+            process_block(block);
+
+            uint32_t latency_us = (uint32_t)(esp_timer_get_time() - block->t_us);
+            if (latency_us > ring_max_latency_us) {
+                ring_max_latency_us = latency_us;
+            }
+            ring_released += block->count;
+            ppg_ring_release(&ring);
         }
-    } else if (rising && (max_value - ir_ac) > BEAT_THRESHOLD) {
-        // Detected a peak (transition from rising to falling)
-        rising = false;
-        last_value = ir_ac;
-        max_value = 0;
-        
-        // Check if enough time passed since last beat (min 300ms = 200 BPM max)
-        if (current_time - hr_state.last_beat_time > 300) {
-            return true;
+
+        // Applied by the acquisition task between bursts
+        portENTER_CRITICAL(&led_lock);
+        led_request[PPG_AGC_RED] = agc.pa[PPG_AGC_RED];
+        led_request[PPG_AGC_IR] = agc.pa[PPG_AGC_IR];
+        portEXIT_CRITICAL(&led_lock);
+
+#if MAX30102_RING_LOG_S
+        if (esp_timer_get_time() >= next_log_us) {
+            max30102_ring_stats_t rs;
+            max30102_get_ring_stats(&rs);
+            ESP_LOGI(TAG, "Ring: high water %lu/%lu bursts (%lu samples), %lu overruns, "
+                     "max latency %lums", rs.high_water, rs.capacity, rs.high_water_samples,
+                     rs.overruns, rs.max_latency_us / 1000);
+            next_log_us += MAX30102_RING_LOG_S * 1000000LL;
         }
+#endif
+    }
+}
+
+// Acquisition task: FIFO reads, the recorder and LED writes only
+static void acquisition_task(void *pvParameters) {
+    const ppg_source_t *src = pvParameters;
+    static ppg_block_t overrun_block;   // Read target while the ring is full
+    uint32_t sample_index = 0;      // Timeline index of the next sample, gaps included
+    uint32_t gap = 0;               // Lost samples not yet placed before a burst
+    uint32_t dsp_gap = 0;           // Gap not yet passed to processing, ring overruns included
+    uint8_t applied_pa[2] = { PPG_AGC_PA_DEFAULT, PPG_AGC_PA_DEFAULT };
+    bool standby_failed = false;
+
+    // Open the source once
+    while (src->ops->open(src->ctx) != ESP_OK) {
+        ESP_LOGE(TAG, "%s source open failed, retrying", src->ops->name);
+        vTaskDelay(pdMS_TO_TICKS(1000));
     }
-    
-    last_value = ir_ac;
-    return false;
-}
-
-// Calculate heart rate from beat intervals
-uint8_t calculate_heart_rate(void) {
-    if (hr_state.beat_count < 2) {
-        return 0;  // Need at least 2 beats
-    }
-    
-    // Average the last beat intervals
-    uint32_t sum = 0;
-    int count = (hr_state.beat_count < 4) ? hr_state.beat_count : 4;
-    
-    for (int i = 0; i < count; i++) {
-        sum += hr_state.beat_intervals[i];
-    }
-    
-    uint32_t avg_interval = sum / count;
-    
-    // Convert to BPM: 60000 ms / interval
-    uint16_t bpm = 60000 / avg_interval;
-    
-    // Sanity check: valid range 40-200 BPM
-    if (bpm < 40 || bpm > 200) {
-        return 0;
-    }
-    
-    return (uint8_t)bpm;
-}
-
-// Calculate SpO2 using red/IR ratio
-uint8_t calculate_spo2(void) {
-    if (buffer.count < 50) {
-        return 0;
-    }
-    
-    // Get AC and DC components
-    uint32_t red_dc = moving_average(buffer.red, 50);
-    uint32_t ir_dc = moving_average(buffer.ir, 50);
-    
-    if (red_dc == 0 || ir_dc == 0) {
-        return 0;
-    }
-    
-    // Calculate AC components (peak-to-peak)
-    uint32_t red_max = 0, red_min = UINT32_MAX;
-    uint32_t ir_max = 0, ir_min = UINT32_MAX;
-    
-    int start = (buffer.head - 50 + BUFFER_SIZE) % BUFFER_SIZE;
-    for (int i = 0; i < 50; i++) {
-        int idx = (start + i) % BUFFER_SIZE;
-        
-        if (buffer.red[idx] > red_max) red_max = buffer.red[idx];
-        if (buffer.red[idx] < red_min) red_min = buffer.red[idx];
-        if (buffer.ir[idx] > ir_max) ir_max = buffer.ir[idx];
-        if (buffer.ir[idx] < ir_min) ir_min = buffer.ir[idx];
-    }
-    
-    uint32_t red_ac = red_max - red_min;
-    uint32_t ir_ac = ir_max - ir_min;
-    
-    if (ir_ac == 0 || ir_dc == 0) {
-        return 0;
-    }
-    
-    // Calculate R value: (Red_AC/Red_DC) / (IR_AC/IR_DC)
-    float r = ((float)red_ac / (float)red_dc) / ((float)ir_ac / (float)ir_dc);
-    
-    // Empirical formula for SpO2 (typical for MAX30102)
-    // SpO2 = 110 - 25*R (this is a common approximation)
-    float spo2 = 110.0 - 25.0 * r;
-    
-    // Clamp to valid range 70-100%
-    if (spo2 > 100.0) spo2 = 100.0;
-    if (spo2 < 70.0) spo2 = 70.0;
-    
-    return (uint8_t)spo2;
-}
-
-void max30102_task(void *pvParameters) {
-    uint8_t fifo_buffer[6];
-    uint32_t red_raw, ir_raw;
-    uint32_t current_time;
-    
-    // Configure sensor once
-    max30102_setup_regs();
-    
-    // Initialize state
-    hr_state.last_beat_time = 0;
-    hr_state.beat_count = 0;
-    
-    ESP_LOGI(TAG, "MAX30102 Algorithm started");
-    
+
+    // Initialize state; the first publish hands it to the processing task
+    ppg_dsp_config_t cfg = {
+        .hr_engine = hr_engine,
+        .spo2_cal = load_spo2_calibration(),
+        .on_result = on_ppg_result,
+        .ctx = NULL,
+        .input_rate = src->ops->sample_rate(src->ctx),
+    };
+    if (!ppg_dsp_init(&ppg, &cfg)) {
+        ESP_LOGW(TAG, "%s rate %luHz not supported, processing as %dHz",
+                 src->ops->name, cfg.input_rate, PPG_DSP_SAMPLE_RATE);
+    }
+    ppg_recorder_set_sample_rate(cfg.input_rate);
+    ppg_agc_init(&agc);
+
+    demand_gating = (src->ops->standby != NULL);
+    anchor_reads = ppg_source_is_real_time(src);
+
+    ESP_LOGI(TAG, "MAX30102 Algorithm started (source: %s, acquisition core %d, processing core %d)",
+             src->ops->name, ACQ_CORE, PROC_CORE);
+
     while (1) {
-        current_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
-        
-        // Read FIFO sample
-        max30102_read_fifo(fifo_buffer, 6);
-        
-        // Extract 18-bit values
-        red_raw = ((uint32_t)fifo_buffer[0] << 16 | 
-                   (uint32_t)fifo_buffer[1] << 8 | 
-                   fifo_buffer[2]) & 0x03FFFF;
-        ir_raw  = ((uint32_t)fifo_buffer[3] << 16 | 
-                   (uint32_t)fifo_buffer[4] << 8 | 
-                   fifo_buffer[5]) & 0x03FFFF;
-        notify_waveform_data(ir_raw);       
-        // Check if finger is present
-        if (ir_raw < MIN_VALID_IR || ir_raw > MAX_VALID_IR) {
-            // No finger or sensor saturated
-            notify_spo2_data(0, 0);
-            ESP_LOGD(TAG, "No valid finger detected (IR: %lu)", ir_raw);
-            
-            // Reset state
-            buffer.count = 0;
-            buffer.head = 0;
-            hr_state.beat_count = 0;
-            
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            continue;
+        // Nothing consumes samples: shut the sensor down until something does
+        if (demand_gating && !sensor_demand()) {
+            if (src->ops->standby(src->ctx, true) == ESP_OK) {
+                standby_failed = false;
+                ESP_LOGI(TAG, "No consumers, sensor shut down");
+                int64_t paused_us = esp_timer_get_time();
+                while (!sensor_demand()) {
+                    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MAX30102_IDLE_CHECK_MS));
+                }
+                while (src->ops->standby(src->ctx, false) != ESP_OK) {
+                    ESP_LOGW(TAG, "Sensor wake failed, retrying");
+                    vTaskDelay(pdMS_TO_TICKS(100));
+                }
+
+                // The shutdown is a span of the timeline without samples
+                uint32_t paused = (uint32_t)((esp_timer_get_time() - paused_us) *
+                                             cfg.input_rate / 1000000);
+                sample_index += paused;
+                dsp_gap += paused;
+                portENTER_CRITICAL(&timeline_lock);
+                timeline_stats.paused += paused;
+                portEXIT_CRITICAL(&timeline_lock);
+                ESP_LOGI(TAG, "Sensor resumed after %lus", paused / cfg.input_rate);
+            } else if (!standby_failed) {
+                // Keep sampling; retried every burst
+                standby_failed = true;
+                ESP_LOGW(TAG, "Sensor shutdown failed");
+            }
         }
-        
-        // Add to buffer for filtering
-        add_sample(red_raw, ir_raw);
-        
-        // Need enough samples before processing
-        if (buffer.count < 50) {
-            notify_spo2_data(0, 0);
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-            continue;
+
+        src->ops->wait(src->ctx);
+
+        ppg_source_burst_t burst = { 0 };
+        if (src->ops->pending(src->ctx, &burst) != ESP_OK) {
+            burst.count = 0;
+            burst.lost = 0;
         }
-        
-        // Remove DC component from IR signal
-        int32_t ir_ac = remove_dc(ir_raw, buffer.ir);
-        
-        // Detect heartbeat
-        if (detect_beat(ir_ac, current_time)) {
-            uint32_t interval = current_time - hr_state.last_beat_time;
-            
-            // Store interval
-            if (hr_state.beat_count < 4) {
-                hr_state.beat_intervals[hr_state.beat_count] = interval;
-                hr_state.beat_count++;
-            } else {
-                // Shift and add new interval
-                for (int i = 0; i < 3; i++) {
-                    hr_state.beat_intervals[i] = hr_state.beat_intervals[i + 1];
+        gap += burst.lost;
+
+        // Drain every pending sample in one transaction, straight into a
+        // ring slot. With the ring full the FIFO is still drained, so the
+        // sensor does not overflow; processing sees those samples as a gap.
+        ppg_block_t *block = NULL;
+        esp_err_t read = ESP_ERR_NOT_FOUND;
+        int count = 0;
+        if (burst.count > 0) {
+            block = ppg_ring_claim(&ring);
+            if (block == NULL) {
+                block = &overrun_block;
+            }
+            read = ppg_source_read(src, &burst, block->data, &count);
+        }
+
+        if (read == ESP_OK) {
+            // The gap goes into the timeline here; the recorder sees it as
+            // a jump in first_index, the DSP through the burst's `lost`
+            sample_index += gap;
+            block->t_us = esp_timer_get_time();
+            ppg_recorder_push(block->data, count, sample_index, block->t_us, applied_pa);
+            sample_index += count;
+            dsp_gap += gap;
+
+            portENTER_CRITICAL(&timeline_lock);
+            timeline_stats.samples += count;
+            timeline_stats.lost += gap;
+            timeline_stats.duplicates += burst.duplicates;
+            timeline_stats.gaps += (gap > 0);
+            portEXIT_CRITICAL(&timeline_lock);
+            gap = 0;
+
+            if (block == &overrun_block) {
+                ring_dropped += count;
+                dsp_gap += count;
+                ESP_LOGW(TAG, "Sample ring full, %d samples not processed", count);
+            } else if (count > 0) {
+                block->count = count;
+                block->lost = dsp_gap;
+                block->led_pa[PPG_AGC_RED] = applied_pa[PPG_AGC_RED];
+                block->led_pa[PPG_AGC_IR] = applied_pa[PPG_AGC_IR];
+                dsp_gap = 0;
+
+                ring_published += count;
+                uint32_t waiting = ring_published - ring_released;
+                if (waiting > ring_high_samples) {
+                    ring_high_samples = waiting;
                 }
-                hr_state.beat_intervals[3] = interval;
+                ppg_ring_publish(&ring);
+                xTaskNotifyGive(processing_handle);
             }
-            
-            hr_state.last_beat_time = current_time;
-            ESP_LOGD(TAG, "Beat detected! Interval: %lu ms", interval);
+        } else if (read == ESP_ERR_NOT_FINISHED) {
+            // The source reports what the failed read consumed as a gap next time
+            portENTER_CRITICAL(&timeline_lock);
+            timeline_stats.read_failures++;
+            portEXIT_CRITICAL(&timeline_lock);
+            ESP_LOGW(TAG, "FIFO burst read failed (%d samples)", burst.count);
         }
-        
-        // Calculate heart rate (every 500ms)
-        static uint32_t last_calc_time = 0;
-        if (current_time - last_calc_time > 500) {
-            uint8_t hr = calculate_heart_rate();
-            uint8_t spo2 = calculate_spo2();
-            
-            // Only send if we have valid readings
-            if (hr > 0 && spo2 > 0) {
-                notify_spo2_data(hr, spo2);
-                ESP_LOGI(TAG, "HR: %d BPM | SpO2: %d%% | Raw - R:%lu IR:%lu", 
-                         hr, spo2, red_raw, ir_raw);
-            } else {
-                // Still collecting data
-                notify_spo2_data(0, 0);
-                ESP_LOGD(TAG, "Collecting data... (beats: %d)", hr_state.beat_count);
+
+        // The bus is idle now, and everything read from here on was taken
+        // at the new current
+        uint8_t pa[2];
+        portENTER_CRITICAL(&led_lock);
+        pa[PPG_AGC_RED] = led_request[PPG_AGC_RED];
+        pa[PPG_AGC_IR] = led_request[PPG_AGC_IR];
+        portEXIT_CRITICAL(&led_lock);
+
+        if (src->ops->set_led != NULL &&
+            (pa[PPG_AGC_RED] != applied_pa[PPG_AGC_RED] || pa[PPG_AGC_IR] != applied_pa[PPG_AGC_IR])) {
+            if (src->ops->set_led(src->ctx, pa) == ESP_OK) {
+                ESP_LOGD(TAG, "LED current: red 0x%02X ir 0x%02X", pa[PPG_AGC_RED], pa[PPG_AGC_IR]);
+                applied_pa[PPG_AGC_RED] = pa[PPG_AGC_RED];
+                applied_pa[PPG_AGC_IR] = pa[PPG_AGC_IR];
             }
-            
-            last_calc_time = current_time;
         }
-        
-        // Match sample rate (~100Hz)
-        vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 }
+
+esp_err_t max30102_start(const ppg_source_t *src) {
+    if (src == NULL) {
+        src = ppg_source_max30102();
+    }
+    ppg_ring_init(&ring, ring_slots, sizeof(ppg_block_t), MAX30102_RING_BLOCKS);
+
+    // Consumer first: the producer notifies it from its first burst
+    if (xTaskCreatePinnedToCore(processing_task, "ppg_proc", MAX30102_PROC_STACK, NULL,
+                                MAX30102_PROC_TASK_PRIO, &processing_handle, PROC_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(acquisition_task, "ppg_acq", MAX30102_ACQ_STACK, (void *)src,
+                                MAX30102_ACQ_TASK_PRIO, &acquisition_handle, ACQ_CORE) != pdPASS) {
+        vTaskDelete(processing_handle);
+        processing_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
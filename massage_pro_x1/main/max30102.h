@@ -4,19 +4,128 @@
 
 #include "esp_err.h"
 #include <stdint.h>
+#include "ppg_dsp.h"
+#include "ppg_source.h"
 
 // --- Hardware Configuration ---
 // Check your wiring! 
 #define I2C_MASTER_SCL_IO           22      // GPIO for SCL
 #define I2C_MASTER_SDA_IO           21      // GPIO for SDA
 #define I2C_MASTER_NUM              0       // I2C Port Number
-#define I2C_MASTER_FREQ_HZ          100000  // I2C Frequency
+#define I2C_MASTER_FREQ_HZ          400000  // I2C Frequency (fast mode)
+#define MAX30102_I2C_TIMEOUT_MS     20      // Per-transfer timeout before bus reset
+#define MAX30102_I2C_QUEUE_DEPTH    4       // Async transfers queued on the bus
+#define MAX30102_INT_IO             4       // GPIO for INT (active low), -1 = poll FIFO pointers
+
+// --- Acquisition Rate ---
+// ADC rate (100/200/400/800 Hz) and on-chip averaging (1/2/4/8/16/32). The FIFO
+// fills at SAMPLE_RATE / SAMPLE_AVG, which ppg_dsp decimates back down to
+// PPG_DSP_SAMPLE_RATE; the ratio must be 1, 2, 4 or 8.
+#define MAX30102_SAMPLE_RATE        400
+#define MAX30102_SAMPLE_AVG         1
+#define MAX30102_FIFO_RATE          (MAX30102_SAMPLE_RATE / MAX30102_SAMPLE_AVG)
+
+_Static_assert(MAX30102_SAMPLE_RATE == 100 || MAX30102_SAMPLE_RATE == 200 ||
+               MAX30102_SAMPLE_RATE == 400 || MAX30102_SAMPLE_RATE == 800,
+               "MAX30102_SAMPLE_RATE: 100, 200, 400 or 800");
+_Static_assert(MAX30102_SAMPLE_AVG > 0 && MAX30102_SAMPLE_AVG <= 32 &&
+               (MAX30102_SAMPLE_AVG & (MAX30102_SAMPLE_AVG - 1)) == 0,
+               "MAX30102_SAMPLE_AVG: 1, 2, 4, 8, 16 or 32");
+_Static_assert(MAX30102_FIFO_RATE % PPG_DSP_SAMPLE_RATE == 0 &&
+               MAX30102_FIFO_RATE / PPG_DSP_SAMPLE_RATE <= PPG_DECIM_MAX_FACTOR,
+               "FIFO rate must be 1, 2, 4 or 8 times PPG_DSP_SAMPLE_RATE");
+
+// --- FIFO Acquisition ---
+// The sensor raises INT once this many samples are waiting in its 32-deep FIFO,
+// so the task wakes every ~42ms at 400Hz (~170ms at 100Hz) and drains the
+// whole FIFO in one burst.
+#define MAX30102_FIFO_DEPTH         32
+#define MAX30102_FIFO_BURST_SAMPLES 17
+
+// --- Task Layout ---
+// Acquisition (FIFO reads, recorder, LED writes) runs at high priority on the
+// app core, so a slow BLE send or log line cannot delay a read. Processing
+// (DSP, AGC, BLE notify) runs on the protocol core, fed bursts through a
+// lock-free single-producer / single-consumer ring.
+#define MAX30102_ACQ_TASK_PRIO      10
+#define MAX30102_ACQ_CORE           1       // APP_CPU
+#define MAX30102_ACQ_STACK          3072
+#define MAX30102_PROC_TASK_PRIO     5
+#define MAX30102_PROC_CORE          0       // PRO_CPU, with the Bluetooth stack
+#define MAX30102_PROC_STACK         4096
+#define MAX30102_RING_BLOCKS        16      // Bursts, power of two; ~700ms at 400Hz
+#define MAX30102_RING_LOG_S         60      // Ring stats log period, 0 = off
+
+// --- Demand Gating ---
+// The sensor is shut down (MODE_CONFIG SHDN, LEDs off) while no BLE stream is
+// subscribed, nothing records and no session runs; the DSP is skipped while
+// only the waveform or the recorder wants samples. Replay and synthetic
+// sources are always processed.
+#define MAX30102_IDLE_CHECK_MS      1000    // Demand re-check while shut down, besides wake-ups
+
+// Heart rate estimator (hr_engine_t, see ppg_dsp.h)
+#define MAX30102_DEFAULT_HR_ENGINE  HR_ENGINE_PEAK
+
+// I2C transport counters
+typedef struct {
+    uint32_t transfers;     // Completed transactions
+    uint32_t nacks;         // Sensor did not acknowledge
+    uint32_t timeouts;      // No completion within MAX30102_I2C_TIMEOUT_MS
+    uint32_t errors;        // Transfers the driver refused to queue
+    uint32_t bus_resets;    // Bus recoveries after a timeout
+} max30102_bus_stats_t;
+
+// Sample timeline counters. Sample N of the timeline was taken at
+// N / MAX30102_FIFO_RATE, so samples + lost + paused is the current index.
+typedef struct {
+    uint64_t samples;       // Samples read from the source
+    uint64_t lost;          // Timeline samples that never arrived (overflow, failed reads, recording gaps)
+    uint32_t duplicates;    // Samples read a second time and dropped
+    uint32_t gaps;          // Discontinuities passed to the DSP and the recorder
+    uint32_t overflows;     // Status reads that found the sensor FIFO overflowed
+    uint32_t read_failures; // Burst reads that did not complete
+    uint64_t paused;        // Timeline samples skipped while the sensor was shut down
+} max30102_timeline_stats_t;
+
+// Acquisition to processing ring counters, for sizing MAX30102_RING_BLOCKS
+typedef struct {
+    uint32_t capacity;          // Slots (bursts)
+    uint32_t used;              // Bursts waiting now
+    uint32_t high_water;        // Most bursts waiting at once
+    uint32_t high_water_samples;
+    uint32_t overruns;          // Bursts not processed because the ring was full
+    uint32_t dropped_samples;   // Their samples; recorded, seen by the DSP as a gap
+    uint32_t max_latency_us;    // Slowest burst from read to processed
+} max30102_ring_stats_t;
 
 // --- Function Prototypes ---
 // Call this in app_main to setup I2C
 esp_err_t max30102_i2c_init(void);
-void notify_spo2_data(uint8_t heart_rate, uint8_t spo2);
-// This is the FreeRTOS task that runs the sensor
-void max30102_task(void *pvParameters);
+// Snapshot of the I2C transport counters
+void max30102_get_bus_stats(max30102_bus_stats_t *stats);
+// Snapshot of the sample timeline counters
+void max30102_get_timeline_stats(max30102_timeline_stats_t *stats);
+// Snapshot of the acquisition to processing ring counters
+void max30102_get_ring_stats(max30102_ring_stats_t *stats);
+void notify_spo2_data(uint8_t heart_rate, uint8_t spo2, uint8_t quality, bool motion);
+// Select the heart rate estimator (takes effect on the next sample)
+void max30102_set_hr_engine(hr_engine_t engine);
+hr_engine_t max30102_get_hr_engine(void);
+// Latest HRV metrics (zeros until HRV_MIN_INTERVALS clean beats)
+void max30102_get_hrv(hrv_metrics_t *out);
+// Restart HRV collection (takes effect on the next block)
+void max30102_restart_hrv(void);
+// Signal quality of the latest reading (0-100, 0 without a finger)
+uint8_t max30102_get_quality(void);
+// Finger moving on the sensor; readings are suppressed meanwhile
+bool max30102_motion_detected(void);
+// A session uses HR/HRV/motion: keep the sensor and DSP running
+void max30102_set_session_active(bool active);
+// A consumer appeared or went away (BLE subscription, recording); wakes a
+// shut down sensor without waiting for MAX30102_IDLE_CHECK_MS
+void max30102_demand_changed(void);
+// Start the acquisition and processing tasks
+// src: sample source (see ppg_source.h), NULL = MAX30102
+esp_err_t max30102_start(const ppg_source_t *src);
 
 #endif
@@ -0,0 +1,364 @@
+/*
+ * PPG Recorder Module
+ * Streams raw MAX30102 bursts to a preallocated binary file on the SD card
+ */
+
+#include "ppg_recorder.h"
+#include "audio_control.h"
+#include "ppg_dsp.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define TAG "PPG_REC"
+
+#define REC_MAX_FILES       9999
+#define REC_MSG_CLOSE       0xFF    // Writer queue: buffer index or close request
+#define REC_QUEUE_LEN       3       // Both buffers + close
+
+// A full FIFO burst must always fit in an empty block
+_Static_assert(sizeof(ppg_rec_frame_t) + 32 * PPG_REC_BYTES_PER_SAMPLE <= PPG_RECORDER_BLOCK_SIZE,
+               "recorder block too small for one FIFO burst");
+_Static_assert(sizeof(ppg_rec_header_t) <= PPG_RECORDER_SECTOR_SIZE, "recorder header");
+_Static_assert(PPG_RECORDER_BLOCK_SIZE % PPG_RECORDER_SECTOR_SIZE == 0, "recorder block alignment");
+
+typedef enum {
+    REC_IDLE = 0,
+    REC_RECORDING,
+    REC_CLOSING,        // Stop requested, writer still flushing
+} rec_state_t;
+
+// Double buffer: the acquisition path fills one block while the writer
+// task owns the other. Static .bss is DMA capable, and whole aligned
+// blocks go straight from here to the card.
+static uint8_t rec_buf[2][PPG_RECORDER_BLOCK_SIZE] __attribute__((aligned(4)));
+static volatile bool buf_busy[2];
+static int fill_idx = 0;
+static size_t fill_pos = 0;
+
+static QueueHandle_t writer_queue = NULL;
+static SemaphoreHandle_t rec_lock = NULL;     // Producer state vs start/stop
+static volatile rec_state_t state = REC_IDLE;
+static volatile bool file_full = false;
+
+static FILE *rec_file = NULL;
+static char rec_path[32];
+static ppg_rec_header_t header;
+static ppg_recorder_stats_t stats;
+static uint32_t sample_rate = PPG_DSP_SAMPLE_RATE;
+static uint32_t next_index;             // Timeline index after the last pushed frame
+
+//-----------------------------------------------------------------------------
+// Writer Task
+//-----------------------------------------------------------------------------
+
+// Wait for the card; audio holds it only for one read at a time
+static void rec_sd_lock(void) {
+    while (!sd_card_lock(PPG_RECORDER_LOCK_MS)) {
+        ESP_LOGD(TAG, "SD card busy, retrying");
+    }
+}
+
+static void rec_write_block(int idx) {
+    if (file_full || rec_file == NULL) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    rec_sd_lock();
+    size_t written = fwrite(rec_buf[idx], 1, PPG_RECORDER_BLOCK_SIZE, rec_file);
+    bool sync = (written == PPG_RECORDER_BLOCK_SIZE) &&
+                ((stats.blocks + 1) % PPG_RECORDER_SYNC_BLOCKS == 0);
+    if (sync) {
+        fsync(fileno(rec_file));
+    }
+    sd_card_unlock();
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    if (elapsed > stats.max_write_us) {
+        stats.max_write_us = elapsed;
+    }
+
+    if (written != PPG_RECORDER_BLOCK_SIZE) {
+        ESP_LOGE(TAG, "Block write failed (errno %d), recording halted", errno);
+        file_full = true;
+        return;
+    }
+
+    stats.blocks++;
+
+    // No room for another block in the preallocated file
+    if (PPG_RECORDER_SECTOR_SIZE + (stats.blocks + 1) * PPG_RECORDER_BLOCK_SIZE > PPG_RECORDER_FILE_SIZE) {
+        ESP_LOGW(TAG, "Recording file full after %lu blocks", stats.blocks);
+        file_full = true;
+    }
+}
+
+static void rec_close_file(void) {
+    header.blocks = stats.blocks;
+    header.samples = stats.samples;
+    header.dropped_frames = stats.dropped_frames;
+    header.lost_samples = stats.lost_samples;
+    header.gaps = stats.gaps;
+
+    rec_sd_lock();
+    // Finalize the header and release the unused preallocation
+    memset(rec_buf[0], 0, PPG_RECORDER_SECTOR_SIZE);
+    memcpy(rec_buf[0], &header, sizeof(header));
+    fseek(rec_file, 0, SEEK_SET);
+    fwrite(rec_buf[0], 1, PPG_RECORDER_SECTOR_SIZE, rec_file);
+    ftruncate(fileno(rec_file), PPG_RECORDER_SECTOR_SIZE + (off_t)stats.blocks * PPG_RECORDER_BLOCK_SIZE);
+    fclose(rec_file);
+    sd_card_unlock();
+
+    rec_file = NULL;
+    ESP_LOGI(TAG, "Recording closed: %s (%lu samples, %lu frames dropped, %lu lost in %lu gaps, "
+             "max write %lu us)", rec_path, stats.samples, stats.dropped_frames, stats.lost_samples,
+             stats.gaps, stats.max_write_us);
+
+    stats.recording = false;
+    state = REC_IDLE;
+}
+
+static void recorder_task(void *pvParameters) {
+    uint8_t msg;
+
+    while (1) {
+        if (xQueueReceive(writer_queue, &msg, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if (msg == REC_MSG_CLOSE) {
+            rec_close_file();
+        } else {
+            rec_write_block(msg);
+            buf_busy[msg] = false;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Producer Side
+//-----------------------------------------------------------------------------
+
+// Pad the fill buffer and pass it to the writer; caller holds rec_lock
+static bool rec_hand_off(void) {
+    if (buf_busy[fill_idx ^ 1]) {
+        return false;   // Writer still has the other block
+    }
+
+    // A zero frame header marks the rest of the block as padding
+    memset(&rec_buf[fill_idx][fill_pos], 0, PPG_RECORDER_BLOCK_SIZE - fill_pos);
+    buf_busy[fill_idx] = true;
+
+    uint8_t msg = (uint8_t)fill_idx;
+    xQueueSend(writer_queue, &msg, 0);
+
+    fill_idx ^= 1;
+    fill_pos = 0;
+    return true;
+}
+
+void ppg_recorder_push(const uint8_t *fifo, int count, uint32_t first_index, int64_t t_us,
+                       const uint8_t led_pa[2]) {
+    if (state != REC_RECORDING || count <= 0) {
+        return;
+    }
+
+    // Only start/stop hold the lock; never wait for them here
+    if (xSemaphoreTake(rec_lock, 0) != pdTRUE) {
+        return;
+    }
+
+    if (state != REC_RECORDING) {
+        goto out;
+    }
+
+    // Frames this recorder drops below still advance next_index, so a jump
+    // here is always a loss upstream
+    if (stats.samples + stats.dropped_frames > 0 && first_index != next_index) {
+        stats.lost_samples += first_index - next_index;
+        stats.gaps++;
+    }
+    next_index = first_index + count;
+
+    size_t need = sizeof(ppg_rec_frame_t) + (size_t)count * PPG_REC_BYTES_PER_SAMPLE;
+    if (file_full ||
+        (fill_pos + need > PPG_RECORDER_BLOCK_SIZE && !rec_hand_off())) {
+        stats.dropped_frames++;
+        goto out;
+    }
+
+    ppg_rec_frame_t frame = {
+        .count = (uint16_t)count,
+        .red_pa = led_pa[0],
+        .ir_pa = led_pa[1],
+        .first_index = first_index,
+        .t_us = t_us,
+    };
+    memcpy(&rec_buf[fill_idx][fill_pos], &frame, sizeof(frame));
+    memcpy(&rec_buf[fill_idx][fill_pos + sizeof(frame)], fifo, need - sizeof(frame));
+    fill_pos += need;
+    stats.samples += count;
+
+out:
+    xSemaphoreGive(rec_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Public Functions
+//-----------------------------------------------------------------------------
+
+esp_err_t ppg_recorder_init(void) {
+    if (writer_queue != NULL) {
+        return ESP_OK;
+    }
+
+    writer_queue = xQueueCreate(REC_QUEUE_LEN, sizeof(uint8_t));
+    rec_lock = xSemaphoreCreateMutex();
+    if (writer_queue == NULL || rec_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(recorder_task, "ppg_rec", 3072, NULL, PPG_RECORDER_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "PPG recorder ready");
+    return ESP_OK;
+}
+
+// First unused rec_NNNN.bin in PPG_RECORDER_DIR
+static esp_err_t rec_next_path(void) {
+    struct stat st;
+
+    for (int i = 1; i <= REC_MAX_FILES; i++) {
+        snprintf(rec_path, sizeof(rec_path), PPG_RECORDER_DIR "/rec_%04d.bin", i);
+        if (stat(rec_path, &st) != 0) {
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t rec_open_file(void) {
+    if (mkdir(PPG_RECORDER_DIR, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Cannot create %s (errno %d)", PPG_RECORDER_DIR, errno);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = rec_next_path();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "No free recording slot");
+        return ret;
+    }
+
+    // Contiguous clusters: later block writes never touch the FAT
+    ret = esp_vfs_fat_create_contiguous_file(SD_MOUNT_POINT, rec_path, PPG_RECORDER_FILE_SIZE, true);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Preallocation failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    rec_file = fopen(rec_path, "r+b");
+    if (rec_file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", rec_path);
+        return ESP_FAIL;
+    }
+
+    // Blocks are already sector sized; skip the stdio copy
+    setvbuf(rec_file, NULL, _IONBF, 0);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PPG_REC_MAGIC, sizeof(header.magic));
+    header.version = PPG_REC_VERSION;
+    header.header_size = PPG_RECORDER_SECTOR_SIZE;
+    header.block_size = PPG_RECORDER_BLOCK_SIZE;
+    header.sample_rate = sample_rate;
+    header.start_us = esp_timer_get_time();
+
+    memset(rec_buf[0], 0, PPG_RECORDER_SECTOR_SIZE);
+    memcpy(rec_buf[0], &header, sizeof(header));
+    if (fwrite(rec_buf[0], 1, PPG_RECORDER_SECTOR_SIZE, rec_file) != PPG_RECORDER_SECTOR_SIZE) {
+        ESP_LOGE(TAG, "Header write failed");
+        fclose(rec_file);
+        rec_file = NULL;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ppg_recorder_start(void) {
+    if (writer_queue == NULL || !sd_card_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (state != REC_IDLE) {
+        ESP_LOGW(TAG, "Recorder busy");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    rec_sd_lock();
+    esp_err_t ret = rec_open_file();
+    sd_card_unlock();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    xSemaphoreTake(rec_lock, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    stats.recording = true;
+    buf_busy[0] = false;
+    buf_busy[1] = false;
+    fill_idx = 0;
+    fill_pos = 0;
+    file_full = false;
+    state = REC_RECORDING;
+    xSemaphoreGive(rec_lock);
+
+    ESP_LOGI(TAG, "Recording to %s", rec_path);
+    return ESP_OK;
+}
+
+esp_err_t ppg_recorder_stop(void) {
+    if (state != REC_RECORDING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(rec_lock, portMAX_DELAY);
+    state = REC_CLOSING;
+
+    // Flush the partial block once the writer releases the other one
+    if (fill_pos > 0) {
+        while (!rec_hand_off()) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+
+    uint8_t msg = REC_MSG_CLOSE;
+    xQueueSend(writer_queue, &msg, portMAX_DELAY);
+    xSemaphoreGive(rec_lock);
+
+    return ESP_OK;
+}
+
+void ppg_recorder_set_sample_rate(uint32_t hz) {
+    sample_rate = hz;
+}
+
+bool ppg_recorder_is_recording(void) {
+    return state == REC_RECORDING;
+}
+
+void ppg_recorder_get_stats(ppg_recorder_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,111 @@
+#ifndef PPG_RECORDER_H
+#define PPG_RECORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// --- Recorder Configuration ---
+#define PPG_RECORDER_DIR            "/sdcard/ppg"
+#define PPG_RECORDER_SECTOR_SIZE    512
+#define PPG_RECORDER_BLOCK_SIZE     4096                // Bytes per SD write, whole sectors
+#define PPG_RECORDER_FILE_SIZE      (4 * 1024 * 1024)   // Preallocated, ~100 min at 100Hz, ~25 at 400Hz
+#define PPG_RECORDER_SYNC_BLOCKS    16                  // fsync period (blocks)
+#define PPG_RECORDER_LOCK_MS        50                  // SD card wait before retrying
+#define PPG_RECORDER_TASK_PRIO      3
+
+// --- File Format ---
+// Sector 0 holds ppg_rec_header_t, zero padded. Data follows in
+// PPG_RECORDER_BLOCK_SIZE blocks, each a sequence of frames: one
+// ppg_rec_frame_t plus `count` samples in MAX30102 FIFO layout (Red then IR,
+// 3 bytes big endian each). A frame with count 0 pads to the end of the block.
+// first_index is on the gap-aware sensor timeline: when it jumps past the
+// end of the previous frame, the samples in between were lost (sensor
+// overflow, failed read, or a frame the recorder dropped).
+// The header is finalized on stop; after a power loss, read blocks until the
+// first one that starts with a zero frame.
+#define PPG_REC_MAGIC               "PPGR"
+#define PPG_REC_VERSION             2       // 2: lost_samples / gaps
+#define PPG_REC_BYTES_PER_SAMPLE    6
+
+typedef struct __attribute__((packed)) {
+    char magic[4];              // PPG_REC_MAGIC
+    uint16_t version;
+    uint16_t header_size;       // PPG_RECORDER_SECTOR_SIZE
+    uint32_t block_size;        // PPG_RECORDER_BLOCK_SIZE
+    uint32_t sample_rate;       // Hz
+    int64_t start_us;           // esp_timer time of start
+    uint32_t blocks;            // Data blocks written (0 until stopped)
+    uint32_t samples;
+    uint32_t dropped_frames;    // Frames lost because both buffers were busy
+    uint32_t lost_samples;      // Lost before reaching the recorder (v2)
+    uint32_t gaps;              // Discontinuities those fall into (v2)
+} ppg_rec_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t count;             // Samples in this frame, 0 = padding
+    uint8_t red_pa;             // LED amplitude codes the burst was taken with
+    uint8_t ir_pa;
+    uint32_t first_index;       // Sensor sample index of the first sample
+    int64_t t_us;               // esp_timer time the burst was read
+} ppg_rec_frame_t;
+
+// Recorder counters
+typedef struct {
+    bool recording;
+    uint32_t blocks;            // Blocks written to the card
+    uint32_t samples;           // Samples accepted
+    uint32_t dropped_frames;    // Frames lost (writer behind or file full)
+    uint32_t lost_samples;      // Timeline samples that never reached the recorder
+    uint32_t gaps;
+    uint32_t max_write_us;      // Slowest block write including SD lock wait
+} ppg_recorder_stats_t;
+
+/**
+ * @brief Create the writer task; call after the SD card is mounted
+ */
+esp_err_t ppg_recorder_init(void);
+
+/**
+ * @brief Start a new recording in PPG_RECORDER_DIR
+ *
+ * Preallocates a contiguous PPG_RECORDER_FILE_SIZE file named rec_NNNN.bin.
+ */
+esp_err_t ppg_recorder_start(void);
+
+/**
+ * @brief Flush buffered samples, finalize the header and close the file
+ */
+esp_err_t ppg_recorder_stop(void);
+
+/**
+ * @brief Rate stored in the header of recordings started from now on
+ *
+ * @param hz Rate the pushed samples were taken at (default PPG_DSP_SAMPLE_RATE)
+ */
+void ppg_recorder_set_sample_rate(uint32_t hz);
+
+bool ppg_recorder_is_recording(void);
+
+/**
+ * @brief Append one FIFO burst; never blocks
+ *
+ * Called from the acquisition path. Data is copied into the active buffer;
+ * if the writer still owns the other buffer the frame is dropped and counted.
+ *
+ * @param fifo Raw FIFO bytes (count * PPG_REC_BYTES_PER_SAMPLE)
+ * @param count Number of samples
+ * @param first_index Timeline index of fifo[0]; a jump past the previous
+ *                    frame is counted as a gap
+ * @param t_us Time the burst was read
+ * @param led_pa LED setting of the burst (red, IR)
+ */
+void ppg_recorder_push(const uint8_t *fifo, int count, uint32_t first_index, int64_t t_us,
+                       const uint8_t led_pa[2]);
+
+/**
+ * @brief Snapshot of the recorder counters
+ */
+void ppg_recorder_get_stats(ppg_recorder_stats_t *stats);
+
+#endif // PPG_RECORDER_H
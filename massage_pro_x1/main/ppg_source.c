@@ -0,0 +1,229 @@
+/*
+ * PPG Source Module
+ * Backend selection, pacing and the synthetic pulse generator
+ */
+
+#include "ppg_source.h"
+#include "max30102.h"
+#include "ppg_dsp.h"
+#include "ppg_synth.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+#define TAG "PPG_SRC"
+
+//-----------------------------------------------------------------------------
+// Pacing
+//-----------------------------------------------------------------------------
+
+void ppg_source_pace_start(ppg_source_pace_t *pace, uint32_t rate, uint32_t speed) {
+    pace->rate = rate;
+    pace->speed = speed;
+    pace->start_tick = xTaskGetTickCount();
+    pace->delivered = 0;
+}
+
+// Same cadence as the sensor's almost-full interrupt, scaled by speed
+void ppg_source_pace_wait(const ppg_source_pace_t *pace) {
+    TickType_t ticks = 1;
+
+    if (pace->speed > 0) {
+        ticks = pdMS_TO_TICKS(MAX30102_FIFO_BURST_SAMPLES * 1000 / pace->rate) / pace->speed;
+        if (ticks == 0) {
+            ticks = 1;
+        }
+    }
+    vTaskDelay(ticks);
+}
+
+int ppg_source_pace_due(const ppg_source_pace_t *pace) {
+    if (pace->speed == 0) {
+        return MAX30102_FIFO_DEPTH;
+    }
+
+    uint32_t elapsed = xTaskGetTickCount() - pace->start_tick;
+    uint64_t due = (uint64_t)elapsed * portTICK_PERIOD_MS * pace->rate * pace->speed / 1000;
+    if (due <= pace->delivered) {
+        return 0;
+    }
+
+    // A backlog drains one FIFO per read; unlike the sensor nothing is lost
+    due -= pace->delivered;
+    return (due > MAX30102_FIFO_DEPTH) ? MAX30102_FIFO_DEPTH : (int)due;
+}
+
+//-----------------------------------------------------------------------------
+// Pipeline
+//-----------------------------------------------------------------------------
+
+bool ppg_source_is_real_time(const ppg_source_t *src) {
+    return src->ops->real_time == NULL || src->ops->real_time(src->ctx);
+}
+
+esp_err_t ppg_source_read(const ppg_source_t *src, const ppg_source_burst_t *burst,
+                          uint8_t *buf, int *count) {
+    *count = 0;
+
+    esp_err_t ret = src->ops->read_start(src->ctx, buf, burst->count);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (src->ops->read_wait(src->ctx) != ESP_OK) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    // Samples read twice lead the burst
+    *count = burst->count - burst->duplicates;
+    if (burst->duplicates > 0) {
+        memmove(buf, &buf[burst->duplicates * PPG_SOURCE_BYTES_PER_SAMPLE],
+                *count * PPG_SOURCE_BYTES_PER_SAMPLE);
+    }
+    return ESP_OK;
+}
+
+void ppg_source_unpack(const uint8_t *buf, int count, uint32_t *red, uint32_t *ir) {
+    for (int i = 0; i < count; i++) {
+        const uint8_t *p = &buf[i * PPG_SOURCE_BYTES_PER_SAMPLE];
+
+        // Extract 18-bit values
+        red[i] = ((uint32_t)p[0] << 16 |
+                  (uint32_t)p[1] << 8 |
+                  p[2]) & 0x03FFFF;
+        ir[i]  = ((uint32_t)p[3] << 16 |
+                  (uint32_t)p[4] << 8 |
+                  p[5]) & 0x03FFFF;
+    }
+}
+
+void ppg_source_process(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count,
+                        uint32_t lost, int64_t t_us, const uint8_t led_pa[2]) {
+    if (lost > 0) {
+        ppg_dsp_gap(dsp, lost);
+        ESP_LOGD(TAG, "Timeline gap of %lu samples", lost);
+    }
+
+    // The last sample of the burst was taken just before the read; the
+    // constant part of that latency cancels out of beat intervals
+    if (count > 0 && t_us >= 0) {
+        ppg_dsp_anchor(dsp, dsp->input_count + count - 1, t_us);
+    }
+
+    // Samples taken after an AGC step arrive rescaled, not as a new finger
+    ppg_dsp_set_led(dsp, led_pa);
+    ppg_dsp_process(dsp, red, ir, count);
+}
+
+//-----------------------------------------------------------------------------
+// Synthetic Backend
+//-----------------------------------------------------------------------------
+
+typedef struct {
+    uint8_t heart_rate;
+    uint8_t spo2;
+    uint32_t seed;
+    uint32_t speed;
+    ppg_synth_t gen;
+    ppg_source_pace_t pace;
+} synth_ctx_t;
+
+static synth_ctx_t synth_ctx;
+
+static esp_err_t synth_open(void *ctx) {
+    synth_ctx_t *s = ctx;
+
+    ppg_synth_init(&s->gen, s->heart_rate, s->spo2, PPG_DSP_SAMPLE_RATE, s->seed);
+    ppg_source_pace_start(&s->pace, PPG_DSP_SAMPLE_RATE, s->speed);
+    ESP_LOGI(TAG, "Synthetic source: HR %d SpO2 %d", s->heart_rate, s->spo2);
+    return ESP_OK;
+}
+
+static uint32_t synth_sample_rate(void *ctx) {
+    return PPG_DSP_SAMPLE_RATE;
+}
+
+static void synth_wait(void *ctx) {
+    synth_ctx_t *s = ctx;
+    ppg_source_pace_wait(&s->pace);
+}
+
+static esp_err_t synth_pending(void *ctx, ppg_source_burst_t *burst) {
+    synth_ctx_t *s = ctx;
+    burst->count = ppg_source_pace_due(&s->pace);
+    burst->lost = 0;
+    burst->duplicates = 0;
+    return ESP_OK;
+}
+
+static esp_err_t synth_read_start(void *ctx, uint8_t *buf, int count) {
+    synth_ctx_t *s = ctx;
+    uint32_t red[MAX30102_FIFO_DEPTH];
+    uint32_t ir[MAX30102_FIFO_DEPTH];
+
+    if (count > MAX30102_FIFO_DEPTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ppg_synth_generate(&s->gen, red, ir, count);
+    for (int i = 0; i < count; i++) {
+        ppg_source_pack(&buf[i * PPG_SOURCE_BYTES_PER_SAMPLE], red[i], ir[i]);
+    }
+
+    s->pace.delivered += count;
+    return ESP_OK;
+}
+
+static esp_err_t synth_read_wait(void *ctx) {
+    return ESP_OK;
+}
+
+static bool synth_real_time(void *ctx) {
+    synth_ctx_t *s = ctx;
+    return s->speed == 1;
+}
+
+static void synth_close(void *ctx) {
+}
+
+static const ppg_source_ops_t synth_ops = {
+    .name = "synth",
+    .open = synth_open,
+    .sample_rate = synth_sample_rate,
+    .wait = synth_wait,
+    .pending = synth_pending,
+    .read_start = synth_read_start,
+    .read_wait = synth_read_wait,
+    .set_led = NULL,        // Generated signal ignores LED current
+    .standby = NULL,        // Development source: always processed
+    .real_time = synth_real_time,
+    .close = synth_close,
+};
+
+const ppg_source_t *ppg_source_synth(uint8_t heart_rate, uint8_t spo2, uint32_t seed, uint32_t speed) {
+    static ppg_source_t source = { .ops = &synth_ops, .ctx = &synth_ctx };
+
+    synth_ctx.heart_rate = heart_rate;
+    synth_ctx.spo2 = spo2;
+    synth_ctx.seed = seed;
+    synth_ctx.speed = speed;
+    return &source;
+}
+
+//-----------------------------------------------------------------------------
+// Selection
+//-----------------------------------------------------------------------------
+
+const ppg_source_t *ppg_source_get(ppg_source_kind_t kind) {
+    switch (kind) {
+        case PPG_SOURCE_SENSOR:
+            return ppg_source_max30102();
+        case PPG_SOURCE_REPLAY:
+            return ppg_source_replay(PPG_SOURCE_REPLAY_PATH, PPG_SOURCE_REPLAY_LOOP, PPG_SOURCE_SPEED);
+        case PPG_SOURCE_SYNTH:
+            return ppg_source_synth(PPG_SOURCE_SYNTH_HR, PPG_SOURCE_SYNTH_SPO2,
+                                    PPG_SOURCE_SYNTH_SEED, PPG_SOURCE_SPEED);
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef PPG_SOURCE_H
+#define PPG_SOURCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "ppg_dsp.h"
+
+// --- Source Selection ---
+// Source that app_main hands to max30102_start
+#define PPG_SOURCE_DEFAULT          PPG_SOURCE_SENSOR
+#define PPG_SOURCE_REPLAY_PATH      "/sdcard/ppg/replay.bin"    // PPGR recording or "red,ir" CSV
+#define PPG_SOURCE_REPLAY_LOOP      true
+#define PPG_SOURCE_SPEED            1       // Replay/synth pacing: 1 = real time, N = N times faster, 0 = flat out
+                                            // (only 0 gives the same bursts every run, see ppg_source_pace_t)
+#define PPG_SOURCE_SYNTH_HR         72      // BPM
+#define PPG_SOURCE_SYNTH_SPO2       97      // Percent
+#define PPG_SOURCE_SYNTH_SEED       1       // Same seed, same samples
+
+// All sources deliver samples in MAX30102 FIFO layout: Red then IR,
+// 3 bytes big endian each
+#define PPG_SOURCE_BYTES_PER_SAMPLE 6
+
+typedef enum {
+    PPG_SOURCE_SENSOR = 0,      // MAX30102 over I2C
+    PPG_SOURCE_REPLAY,          // Recorded trace from a file
+    PPG_SOURCE_SYNTH,           // Generated pulse with known HR / SpO2
+} ppg_source_kind_t;
+
+/**
+ * @brief Where the next burst sits on the source's sample timeline
+ *
+ * Sample N of the timeline was taken at N / sample_rate on the source's
+ * clock. A burst normally continues where the previous one ended; `lost`
+ * samples before it are a gap (sensor overflow, a failed read, frames
+ * missing from a recording), and the first `duplicates` samples of the
+ * burst were already delivered and must be dropped.
+ */
+typedef struct {
+    int count;              // Samples ready, at most the FIFO depth
+    uint32_t lost;          // Timeline samples missing before this burst
+    int duplicates;         // Leading samples of the burst already delivered
+} ppg_source_burst_t;
+
+/**
+ * @brief Backend operations, called only from the acquisition task
+ *
+ * A read is split into start/wait so the sensor backend can queue the
+ * burst on the bus and block on its completion; file and generator
+ * backends complete the read in read_start. read_start is called with
+ * the count from the latest pending() (or not at all).
+ */
+typedef struct {
+    const char *name;
+    esp_err_t (*open)(void *ctx);
+    uint32_t (*sample_rate)(void *ctx);                         // Hz, valid after open
+    void (*wait)(void *ctx);                                    // Block until the next burst is due
+    esp_err_t (*pending)(void *ctx, ppg_source_burst_t *burst); // Next burst and any gap before it
+    esp_err_t (*read_start)(void *ctx, uint8_t *buf, int count);
+    esp_err_t (*read_wait)(void *ctx);
+    esp_err_t (*set_led)(void *ctx, const uint8_t led_pa[2]);   // Optional; NULL disables the AGC
+    esp_err_t (*standby)(void *ctx, bool standby);              // Optional; NULL runs the pipeline unconditionally
+    bool (*real_time)(void *ctx);                               // Optional; false: bursts do not arrive as the
+                                                                // samples are taken, NULL = they do
+    void (*close)(void *ctx);
+} ppg_source_ops_t;
+
+typedef struct {
+    const ppg_source_ops_t *ops;
+    void *ctx;
+} ppg_source_t;
+
+/**
+ * @brief Get a configured source instance
+ *
+ * @param kind Backend
+ * @return Source, or NULL if the backend is not available
+ */
+const ppg_source_t *ppg_source_get(ppg_source_kind_t kind);
+
+// Backend instances
+const ppg_source_t *ppg_source_max30102(void);
+const ppg_source_t *ppg_source_replay(const char *path, bool loop, uint32_t speed);
+const ppg_source_t *ppg_source_synth(uint8_t heart_rate, uint8_t spo2, uint32_t seed, uint32_t speed);
+
+// --- Backend Helpers ---
+
+/**
+ * @brief Real-time (or sped up) delivery for backends without a hardware clock
+ *
+ * With speed > 0 the samples due are worked out from the tick count, so
+ * burst sizes depend on when the acquisition task gets to run: the
+ * samples are the same every run, how they are split into bursts is not.
+ * Speed 0 hands out one full FIFO per wait and is the mode to use where
+ * runs must be repeatable, e.g. tools/ppg_bench.
+ */
+typedef struct {
+    uint32_t rate;          // Hz
+    uint32_t speed;         // PPG_SOURCE_SPEED semantics
+    uint32_t start_tick;
+    uint64_t delivered;     // Samples handed out since start
+} ppg_source_pace_t;
+
+void ppg_source_pace_start(ppg_source_pace_t *pace, uint32_t rate, uint32_t speed);
+void ppg_source_pace_wait(const ppg_source_pace_t *pace);
+int ppg_source_pace_due(const ppg_source_pace_t *pace);    // Capped at the FIFO depth
+
+// Pack one sample into FIFO layout
+static inline void ppg_source_pack(uint8_t *p, uint32_t red, uint32_t ir) {
+    p[0] = (uint8_t)(red >> 16);
+    p[1] = (uint8_t)(red >> 8);
+    p[2] = (uint8_t)red;
+    p[3] = (uint8_t)(ir >> 16);
+    p[4] = (uint8_t)(ir >> 8);
+    p[5] = (uint8_t)ir;
+}
+
+// --- Pipeline Helpers ---
+// The acquisition and processing tasks go through these, and so does
+// tools/ppg_bench, which runs the replay and synth backends on the host
+
+/**
+ * @brief Check if read times can anchor the DSP clock (valid after open)
+ *
+ * False for paced sources running faster than real time: their read times
+ * say nothing about when the samples were taken.
+ */
+bool ppg_source_is_real_time(const ppg_source_t *src);
+
+/**
+ * @brief Read the burst announced by pending(), dropping samples read twice
+ *
+ * @param src Source
+ * @param burst From pending(), count > 0
+ * @param buf Room for burst->count samples; the new ones end up at the start
+ * @param[out] count New samples in buf
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_NOT_FINISHED: the read started and failed; the source
+ *        reports what it consumed as lost before a later burst
+ *      - Other: read_start's error, nothing was read
+ */
+esp_err_t ppg_source_read(const ppg_source_t *src, const ppg_source_burst_t *burst,
+                          uint8_t *buf, int *count);
+
+/**
+ * @brief Unpack FIFO layout into 18-bit Red and IR samples
+ */
+void ppg_source_unpack(const uint8_t *buf, int count, uint32_t *red, uint32_t *ir);
+
+/**
+ * @brief Run one burst through the DSP
+ *
+ * Places the gap before it, anchors its last sample at t_us (the read
+ * time), declares its LED setting and processes it. Bursts from a source
+ * that is not real time are not anchored; the DSP keeps the nominal rate.
+ *
+ * @param dsp Pipeline
+ * @param red Red samples
+ * @param ir IR samples
+ * @param count Samples in the burst
+ * @param lost Timeline samples missing before the burst
+ * @param t_us Time the burst was read, < 0 if not real time
+ * @param led_pa LED setting the burst was taken with
+ */
+void ppg_source_process(ppg_dsp_t *dsp, const uint32_t *red, const uint32_t *ir, int count,
+                        uint32_t lost, int64_t t_us, const uint8_t led_pa[2]);
+
+#endif // PPG_SOURCE_H
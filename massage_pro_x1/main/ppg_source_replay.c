@@ -0,0 +1,297 @@
+/*
+ * PPG Replay Source
+ * Plays back ppg_recorder files or "red,ir" CSV traces as if from the sensor
+ */
+
+#include "ppg_source.h"
+#include "ppg_recorder.h"
+#include "audio_control.h"
+#include "max30102.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "PPG_REPLAY"
+
+typedef struct {
+    const char *path;
+    bool loop;
+    uint32_t speed;
+
+    FILE *file;
+    bool binary;                // PPGR recording, else CSV
+    bool finished;
+    uint32_t data_offset;       // First data block (binary)
+    uint32_t block_size;
+    uint32_t blocks;            // From a finalized header, 0 = scan to the end
+    uint32_t blocks_read;
+    uint32_t sample_rate;       // From the header; CSV traces are at PPG_DSP_SAMPLE_RATE
+
+    // Binary parse state
+    uint8_t block[PPG_RECORDER_BLOCK_SIZE];
+    size_t block_len;
+    size_t block_pos;
+    int frame_left;             // Samples left in the current frame
+    uint32_t frame_index;       // Timeline index of its next sample
+    uint32_t next_index;        // Timeline index after the last delivered sample
+    bool timeline;              // next_index is valid (not at the start of a pass)
+
+    ppg_source_pace_t pace;
+} replay_ctx_t;
+
+static replay_ctx_t replay_ctx;
+
+// File may live on the SD card shared with audio and the recorder
+static bool replay_on_sd(const replay_ctx_t *r) {
+    return strncmp(r->path, SD_MOUNT_POINT "/", sizeof(SD_MOUNT_POINT)) == 0;
+}
+
+static void replay_lock(const replay_ctx_t *r) {
+    if (replay_on_sd(r)) {
+        sd_card_lock(SD_LOCK_FOREVER);
+    }
+}
+
+static void replay_unlock(const replay_ctx_t *r) {
+    if (replay_on_sd(r)) {
+        sd_card_unlock();
+    }
+}
+
+static void replay_rewind(replay_ctx_t *r) {
+    fseek(r->file, r->binary ? r->data_offset : 0, SEEK_SET);
+    r->block_len = 0;
+    r->block_pos = 0;
+    r->frame_left = 0;
+    r->blocks_read = 0;
+    r->timeline = false;        // A new pass is not a gap
+}
+
+// Next frame header from the recording, loading blocks as needed
+static bool replay_next_frame(replay_ctx_t *r) {
+    while (1) {
+        if (r->block_pos + sizeof(ppg_rec_frame_t) <= r->block_len) {
+            ppg_rec_frame_t frame;
+            memcpy(&frame, &r->block[r->block_pos], sizeof(frame));
+
+            // Zero count pads the rest of the block; past the last block of an
+            // unfinalized file the preallocated clusters hold stale data
+            if (frame.count > MAX30102_FIFO_DEPTH) {
+                return false;
+            }
+            if (frame.count > 0) {
+                r->block_pos += sizeof(frame);
+                r->frame_left = frame.count;
+                r->frame_index = frame.first_index;
+                return true;
+            }
+        }
+
+        if (r->blocks > 0 && r->blocks_read == r->blocks) {
+            return false;
+        }
+        r->block_len = fread(r->block, 1, r->block_size, r->file);
+        r->block_pos = 0;
+        if (r->block_len < r->block_size) {
+            return false;
+        }
+        r->blocks_read++;
+    }
+}
+
+static bool replay_read_sample(replay_ctx_t *r, uint8_t *out) {
+    if (r->binary) {
+        if (r->frame_left == 0 && !replay_next_frame(r)) {
+            return false;
+        }
+        memcpy(out, &r->block[r->block_pos], PPG_SOURCE_BYTES_PER_SAMPLE);
+        r->block_pos += PPG_SOURCE_BYTES_PER_SAMPLE;
+        r->frame_left--;
+        r->next_index = ++r->frame_index;
+        return true;
+    }
+
+    char line[64];
+    while (fgets(line, sizeof(line), r->file) != NULL) {
+        unsigned long red, ir;
+        if (sscanf(line, "%lu,%lu", &red, &ir) == 2) {
+            ppg_source_pack(out, (uint32_t)red, (uint32_t)ir);
+            return true;
+        }
+        // Header or comment line
+    }
+    return false;
+}
+
+static esp_err_t replay_open(void *ctx) {
+    replay_ctx_t *r = ctx;
+    ppg_rec_header_t header;
+
+    replay_lock(r);
+    r->file = fopen(r->path, "rb");
+    bool has_header = r->file != NULL &&
+                      fread(&header, sizeof(header), 1, r->file) == 1 &&
+                      memcmp(header.magic, PPG_REC_MAGIC, sizeof(header.magic)) == 0;
+    replay_unlock(r);
+
+    if (r->file == NULL) {
+        ESP_LOGE(TAG, "Cannot open %s", r->path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    r->binary = has_header;
+    r->sample_rate = PPG_DSP_SAMPLE_RATE;
+    if (r->binary) {
+        if (header.block_size != PPG_RECORDER_BLOCK_SIZE) {
+            ESP_LOGE(TAG, "Unsupported block size %lu", header.block_size);
+            fclose(r->file);
+            r->file = NULL;
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        r->data_offset = header.header_size;
+        r->block_size = header.block_size;
+        r->blocks = header.blocks;
+        if (header.sample_rate > 0) {
+            r->sample_rate = header.sample_rate;
+        }
+    }
+
+    replay_lock(r);
+    replay_rewind(r);
+    replay_unlock(r);
+
+    r->finished = false;
+    ppg_source_pace_start(&r->pace, r->sample_rate, r->speed);
+    ESP_LOGI(TAG, "Replaying %s (%s, %luHz)", r->path, r->binary ? "recording" : "CSV",
+             r->sample_rate);
+    return ESP_OK;
+}
+
+static uint32_t replay_sample_rate(void *ctx) {
+    replay_ctx_t *r = ctx;
+    return r->sample_rate;
+}
+
+static void replay_wait(void *ctx) {
+    replay_ctx_t *r = ctx;
+    ppg_source_pace_wait(&r->pace);
+}
+
+// Recordings: a burst never crosses a frame, so a jump in first_index
+// (sensor overflow, frame dropped by the recorder) falls between bursts
+static void replay_frame_burst(replay_ctx_t *r, ppg_source_burst_t *burst) {
+    if (r->frame_left == 0) {
+        replay_lock(r);
+        bool more = replay_next_frame(r);
+        if (!more && r->loop) {
+            replay_rewind(r);
+            more = replay_next_frame(r);
+        }
+        replay_unlock(r);
+
+        if (!more) {
+            r->finished = true;
+            burst->count = 0;
+            ESP_LOGI(TAG, "Replay finished");
+            return;
+        }
+    }
+
+    if (r->timeline && r->frame_index > r->next_index) {
+        burst->lost = r->frame_index - r->next_index;
+        r->pace.delivered += burst->lost;      // That time passed on the recording too
+    }
+    r->next_index = r->frame_index;
+    r->timeline = true;
+
+    if (burst->count > r->frame_left) {
+        burst->count = r->frame_left;
+    }
+}
+
+static esp_err_t replay_pending(void *ctx, ppg_source_burst_t *burst) {
+    replay_ctx_t *r = ctx;
+
+    burst->count = r->finished ? 0 : ppg_source_pace_due(&r->pace);
+    burst->lost = 0;
+    burst->duplicates = 0;
+    if (r->binary && burst->count > 0) {
+        replay_frame_burst(r, burst);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t replay_read_start(void *ctx, uint8_t *buf, int count) {
+    replay_ctx_t *r = ctx;
+    esp_err_t ret = ESP_OK;
+
+    replay_lock(r);
+    for (int i = 0; i < count; i++) {
+        uint8_t *p = &buf[i * PPG_SOURCE_BYTES_PER_SAMPLE];
+
+        if (replay_read_sample(r, p)) {
+            continue;
+        }
+        if (r->loop) {
+            replay_rewind(r);
+            if (replay_read_sample(r, p)) {
+                continue;
+            }
+        }
+
+        // End of trace (or empty file): the partial burst is dropped
+        r->finished = true;
+        ret = ESP_ERR_NOT_FOUND;
+        break;
+    }
+    replay_unlock(r);
+
+    if (r->finished) {
+        ESP_LOGI(TAG, "Replay finished");
+    }
+    r->pace.delivered += count;
+    return ret;
+}
+
+static esp_err_t replay_read_wait(void *ctx) {
+    return ESP_OK;
+}
+
+static bool replay_real_time(void *ctx) {
+    replay_ctx_t *r = ctx;
+    return r->speed == 1;
+}
+
+static void replay_close(void *ctx) {
+    replay_ctx_t *r = ctx;
+
+    if (r->file != NULL) {
+        replay_lock(r);
+        fclose(r->file);
+        replay_unlock(r);
+        r->file = NULL;
+    }
+}
+
+static const ppg_source_ops_t replay_ops = {
+    .name = "replay",
+    .open = replay_open,
+    .sample_rate = replay_sample_rate,
+    .wait = replay_wait,
+    .pending = replay_pending,
+    .read_start = replay_read_start,
+    .read_wait = replay_read_wait,
+    .set_led = NULL,        // Recorded at whatever the recording used
+    .standby = NULL,        // Development source: always processed
+    .real_time = replay_real_time,
+    .close = replay_close,
+};
+
+const ppg_source_t *ppg_source_replay(const char *path, bool loop, uint32_t speed) {
+    static ppg_source_t source = { .ops = &replay_ops, .ctx = &replay_ctx };
+
+    replay_ctx.path = path;
+    replay_ctx.loop = loop;
+    replay_ctx.speed = speed;
+    return &source;
+}
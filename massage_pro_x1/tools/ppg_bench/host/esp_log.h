@@ -0,0 +1,12 @@
+/*
+ * Host shim: logging is dropped, the bench reports outcomes itself
+ */
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#define ESP_LOGE(tag, ...)      ((void)(tag))
+#define ESP_LOGW(tag, ...)      ((void)(tag))
+#define ESP_LOGI(tag, ...)      ((void)(tag))
+#define ESP_LOGD(tag, ...)      ((void)(tag))
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,13 @@
+/*
+ * Host shim: a simulated tick count, advanced only by vTaskDelay(), so
+ * paced sources deliver the same bursts on every run
+ */
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+
+#endif // HOST_TASK_H
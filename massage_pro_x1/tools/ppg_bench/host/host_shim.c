@@ -0,0 +1,33 @@
+/*
+ * Host Shim
+ * What main/ppg_source.c and main/ppg_source_replay.c need from the rest
+ * of the firmware, so tools/ppg_bench can run the replay and synth backends
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "audio_control.h"
+#include "ppg_source.h"
+
+static TickType_t host_ticks;
+
+TickType_t xTaskGetTickCount(void) {
+    return host_ticks;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    host_ticks += ticks;
+}
+
+// Replay paths on the host are never under SD_MOUNT_POINT
+bool sd_card_lock(uint32_t timeout_ms) {
+    return true;
+}
+
+void sd_card_unlock(void) {
+}
+
+// No sensor on the host
+const ppg_source_t *ppg_source_max30102(void) {
+    return NULL;
+}
@@ -0,0 +1,1707 @@
+/*
+ * PPG DSP Host Benchmark
+ * Runs components/ppg_dsp on recorded or synthetic traces, both HR engines side by side
+ *
+ * Usage: ppg_bench              synthetic sweep over HR / SpO2, stream_window vs
+ *                               rescans, the band-pass vs remove_dc, SpO2 float
+ *                               path vs spo2_lut, waveform packing, sensor rates
+ *                               through the decimator, beat timing, timeline gaps,
+ *                               motion gating, the LED AGC loop, the sample ring
+ *                               across two threads, the FIFO pointer bookkeeping
+ *                               against a simulated MAX30102, then the replay and
+ *                               synth sources through the firmware block path;
+ *                               exits non-zero if stream_window disagrees with a
+ *                               rescan, the band-pass leaves its response limits,
+ *                               spo2_lut leaves its reference outputs, beat timing
+ *                               (interval spread or fake RMSSD on regular beats),
+ *                               gaps or motion gating are out of tolerance, the
+ *                               packer or the ring corrupts data, a FIFO sample
+ *                               lands at the wrong timeline index, or a source
+ *                               run differs from ppg_dsp fed directly
+ *        ppg_bench trace.csv    "red,ir" per line at PPG_DSP_SAMPLE_RATE, HR engines
+ *                               and waveform packing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "ppg_dsp.h"
+#include "ppg_synth.h"
+#include "ppg_agc.h"
+#include "ppg_ring.h"
+#include "ppg_wavepack.h"
+#include "ppg_fifo.h"
+#include "spo2_lut.h"
+#include "stream_window.h"
+#include "ppg_source.h"
+#include "ppg_recorder.h"
+#include "freertos/task.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#define BLOCK_SAMPLES       17      // Matches MAX30102_FIFO_BURST_SAMPLES
+#define SYNTH_SECONDS       60
+#define SYNTH_SEED          1
+#define ADC_FULL_SCALE      262143  // 18-bit
+#define TARGET_CPU_HZ       160e6   // CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define TIMING_RATE         400     // MAX30102_FIFO_RATE
+#define TIMING_LATENCY_US   500     // Burst read after its last sample...
+#define TIMING_JITTER_US    3000    // ...plus up to this much task latency
+#define TIMING_MAX_MEAN_US  500     // Pass: mean interval error
+#define TIMING_MAX_SD_US    1000    // Pass: interval SD (synthetic beats are regular)
+#define TIMING_MAX_RMSSD_MS 1.0     // Pass: HRV RMSSD, all of it timing error on regular beats
+#define TIMING_SETTLE_S     10      // Filter settling and clock fit, not scored
+#define GAP_START_S         20      // Samples dropped from the trace here
+#define GAP_SETTLE_S        1       // Beats skipped after the gap
+#define GAP_MAX_ERR_US      15000   // Pass: worst beat phase error
+#define MOTION_START_S      20      // Artifact injected into the synthetic trace...
+#define MOTION_SECONDS      6       // ...for this long
+#define MOTION_DC           0.25    // Finger sliding: DC swing, fraction of DC
+#define MOTION_HZ           1.3     // Close to the pulse rate, so a filter cannot remove it
+#define MOTION_RECOVER_S    10      // Pass: readings resume within this after the artifact
+#define WAVE_HEADER_LEN     8       // BLE waveform packet header (ble_server.c)
+#define WAVE_FLUSH_SAMPLES  20      // BLE_WAVEFORM_FLUSH_MS at PPG_DSP_SAMPLE_RATE
+#define RING_SLOTS          16      // MAX30102_RING_BLOCKS
+#define RING_BURSTS         2000000
+#define FIFO_ROUNDS         500     // Repeats of each FIFO script
+#define SPO2_SETS           1000000 // AC/DC sets per SpO2 evaluation run
+#define SPO2_SEED           1
+#define WINDOW_SAMPLES      1000000 // Samples per sliding window timing run
+#define WINDOW_DC           20      // DC removal window before the band-pass
+#define WINDOW_CHECK        5000    // Operations per window length in the rescan check
+#define LEGACY_BUFFER_SIZE  100     // sensor_buffer_t before stream_window
+#define FILTER_TONE_SECONDS 60      // Per tone in the IR stage response check
+#define FILTER_TONE_AMP     2000.0  // Counts, peak
+#define FILTER_RESP_HZ      0.2     // Respiration
+#define FILTER_PULSE_HZ     1.2     // 72 BPM
+#define FILTER_NOISE_HZ     20.0    // Out-of-band noise
+#define FILTER_MAX_STOP     0.25    // Pass: band-pass gain at respiration and noise
+#define FILTER_MAX_RIPPLE   0.1     // Pass: band-pass gain at the pulse within 1 +/- this
+#define SOURCE_SECONDS      60      // Per source run
+#define SOURCE_HR           72
+#define SOURCE_SPO2         97
+#define SOURCE_DROP_FRAME   100     // Frame missing from the PPGR recording (bridged gap)
+#define SOURCE_MAX_IDLE     10      // Empty bursts in a row that end a run
+
+// Accumulated readings for one engine over one trace
+typedef struct {
+    double true_hr;
+    double true_spo2;
+    uint32_t first_ms;      // Time of the first non-zero reading
+    int readings;
+    double hr_err;
+    double spo2_err;
+    double quality;         // Sum over finger-present results
+    int results;
+    hrv_metrics_t hrv;      // At the last reading
+} bench_stats_t;
+
+typedef struct {
+    ppg_dsp_t dsp;
+    bench_stats_t stats;
+    double seconds;
+    uint64_t cycles;
+} bench_run_t;
+
+static void on_result(const ppg_result_t *result, void *ctx) {
+    bench_stats_t *s = ctx;
+
+    if (result->finger) {
+        s->quality += result->quality;
+        s->results++;
+    }
+    if (!result->finger || result->heart_rate == 0) {
+        return;
+    }
+    if (s->readings == 0) {
+        s->first_ms = result->time_ms;
+    }
+    s->readings++;
+    s->hr_err += fabs(result->heart_rate - s->true_hr);
+    s->spo2_err += fabs(result->spo2 - s->true_spo2);
+    s->hrv = result->hrv;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_init(bench_run_t *run, hr_engine_t engine, double hr, double spo2, uint32_t rate) {
+    memset(run, 0, sizeof(*run));
+    run->stats.true_hr = hr;
+    run->stats.true_spo2 = spo2;
+
+    ppg_dsp_config_t cfg = {
+        .hr_engine = engine,
+        .spo2_cal = SPO2_CAL_DEFAULT,
+        .on_result = on_result,
+        .ctx = &run->stats,
+        .input_rate = rate,
+    };
+    ppg_dsp_init(&run->dsp, &cfg);
+}
+
+// Feed a trace in FIFO-sized blocks, timing only ppg_dsp_process()
+static void run_trace(bench_run_t *run, const uint32_t *red, const uint32_t *ir, int count) {
+    double start = now_seconds();
+#ifdef HAVE_CYCLES
+    uint64_t start_cycles = __rdtsc();
+#endif
+
+    for (int done = 0; done < count; done += BLOCK_SAMPLES) {
+        int n = (count - done < BLOCK_SAMPLES) ? (count - done) : BLOCK_SAMPLES;
+        ppg_dsp_process(&run->dsp, &red[done], &ir[done], n);
+    }
+
+#ifdef HAVE_CYCLES
+    run->cycles = __rdtsc() - start_cycles;
+#endif
+    run->seconds = now_seconds() - start;
+}
+
+static void print_run(const char *name, const bench_run_t *run, int count) {
+    const bench_stats_t *s = &run->stats;
+
+    printf("  %-8s %8.2f Msamples/s", name, count / run->seconds / 1e6);
+#ifdef HAVE_CYCLES
+    printf(" %6.0f cycles/sample", (double)run->cycles / count);
+#endif
+    if (s->readings == 0) {
+        printf("  no reading\n");
+        return;
+    }
+    printf("  first %5.1fs", s->first_ms / 1000.0);
+    if (s->true_hr > 0) {
+        printf("  HR err %5.1f  SpO2 err %4.1f", s->hr_err / s->readings, s->spo2_err / s->readings);
+    }
+    // Synthetic beats are perfectly regular: RMSSD / SDNN here is timing jitter
+    printf("  RMSSD %5.1f SDNN %5.1f", s->hrv.rmssd_ms, s->hrv.sdnn_ms);
+    printf("  Q %3.0f", s->quality / s->results);
+    printf("  (%d readings)\n", s->readings);
+}
+
+static void bench(const uint32_t *red, const uint32_t *ir, int count, double hr, double spo2) {
+    bench_run_t *peak = malloc(sizeof(*peak));
+    bench_run_t *ac = malloc(sizeof(*ac));
+
+    // Independent instances see the same samples
+    run_init(peak, HR_ENGINE_PEAK, hr, spo2, PPG_DSP_SAMPLE_RATE);
+    run_init(ac, HR_ENGINE_AUTOCORR, hr, spo2, PPG_DSP_SAMPLE_RATE);
+    run_trace(peak, red, ir, count);
+    run_trace(ac, red, ir, count);
+
+    print_run("peak", peak, count);
+    print_run("autocorr", ac, count);
+    free(peak);
+    free(ac);
+}
+
+// The SpO2 evaluation before spo2_lut, as calculate_spo2() had it
+static __attribute__((noinline)) uint8_t spo2_float(uint32_t red_ac, uint32_t red_dc,
+                                                    uint32_t ir_ac, uint32_t ir_dc) {
+    float r = ((float)red_ac / (float)red_dc) / ((float)ir_ac / (float)ir_dc);
+    float spo2 = 110.0 - 25.0 * r;
+
+    if (spo2 > 100.0) spo2 = 100.0;
+    if (spo2 < 70.0) spo2 = 70.0;
+    return (uint8_t)spo2;
+}
+
+static uint32_t bench_rng(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// FNV-1a over a byte sequence
+static uint32_t fnv1a(uint32_t hash, const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Times the float 110 - 25*R path against spo2_ratio_q16 + spo2_lookup over
+// the same AC/DC sets, and checks the table path against stored references:
+// single inputs across the range, and hashes of both calibration tables and
+// of every output of the sweep. spo2_lut is integer-only, so the hashes must
+// match on any target; an ESP32 build of this section should print the same.
+static bool bench_spo2(void) {
+    // Red AC, Red DC, IR AC, IR DC -> SpO2 with the default curve
+    static const struct {
+        uint32_t red_ac, red_dc, ir_ac, ir_dc;
+        uint8_t spo2;
+    } ref[] = {
+        { 1000, 100000, 2000, 100000, 97 },     // R 0.5
+        { 1500, 100000, 2000, 100000, 91 },     // R 0.75
+        { 2000, 100000, 2000, 100000, 84 },     // R 1
+        { 2520, 120000, 3000, 150000, 83 },     // R 1.05
+        { 1000, 200000, 4000, 200000, 100 },     // R 0.25, clamped at 100
+        { 5000, 100000, 2000, 100000, 70 },     // R 2.5, past the table
+        { 3, 262143, 1, 262143, 70 },           // R 3, 18-bit extremes
+        { 1, 262143, 262143, 1, 100 },           // R ~0
+        { 127, 100000, 128, 100000, 85 },       // Just under a bin edge
+        { 129, 100000, 128, 100000, 84 },       // Just over one
+    };
+    // Maxim's quadratic curve: -45.060 R^2 + 30.354 R + 94.845
+    static const spo2_cal_t quad_cal = { .a = 6215762, .b = 1989280, .c = -2953052 };
+    static const spo2_cal_t default_cal = SPO2_CAL_DEFAULT;
+    static const uint32_t default_table_hash = 0xef269492;
+    static const uint32_t quad_table_hash = 0x3fe30b54;
+    static const uint32_t sweep_hash = 0x8e3381e0;
+
+    uint32_t (*sets)[4] = malloc(SPO2_SETS * sizeof(*sets));
+    uint8_t *out_float = malloc(SPO2_SETS);
+    uint8_t *out_lut = malloc(SPO2_SETS);
+    uint32_t rng = SPO2_SEED;
+    spo2_lut_t lut;
+    spo2_lut_t quad;
+    bool pass = true;
+
+    spo2_lut_build(&lut, &default_cal);
+    spo2_lut_build(&quad, &quad_cal);
+
+    // Plausible fingers: DC over the upper half of the ADC, AC 0.2% to 5% of DC
+    for (int i = 0; i < SPO2_SETS; i++) {
+        for (int k = 0; k < 4; k += 2) {
+            uint32_t dc = ADC_FULL_SCALE / 2 + bench_rng(&rng) % (ADC_FULL_SCALE / 2);
+            uint32_t permille = 2 + bench_rng(&rng) % 49;
+            sets[i][k] = dc * permille / 1000;
+            sets[i][k + 1] = dc;
+        }
+    }
+
+    double start = now_seconds();
+#ifdef HAVE_CYCLES
+    uint64_t start_cycles = __rdtsc();
+#endif
+    for (int i = 0; i < SPO2_SETS; i++) {
+        out_float[i] = spo2_float(sets[i][0], sets[i][1], sets[i][2], sets[i][3]);
+    }
+#ifdef HAVE_CYCLES
+    uint64_t float_cycles = __rdtsc() - start_cycles;
+#endif
+    double float_s = now_seconds() - start;
+
+    start = now_seconds();
+#ifdef HAVE_CYCLES
+    start_cycles = __rdtsc();
+#endif
+    for (int i = 0; i < SPO2_SETS; i++) {
+        out_lut[i] = spo2_lookup(&lut, spo2_ratio_q16(sets[i][0], sets[i][1], sets[i][2], sets[i][3]));
+    }
+#ifdef HAVE_CYCLES
+    uint64_t lut_cycles = __rdtsc() - start_cycles;
+#endif
+    double lut_s = now_seconds() - start;
+
+    int differ = 0;
+    int worst = 0;
+    for (int i = 0; i < SPO2_SETS; i++) {
+        int d = abs(out_float[i] - out_lut[i]);
+        differ += d != 0;
+        worst = (d > worst) ? d : worst;
+    }
+
+    printf("  float 110-25R %5.1f ns", float_s / SPO2_SETS * 1e9);
+#ifdef HAVE_CYCLES
+    printf(" %4.1f cycles", (double)float_cycles / SPO2_SETS);
+#endif
+    printf("  spo2_lut %5.1f ns", lut_s / SPO2_SETS * 1e9);
+#ifdef HAVE_CYCLES
+    printf(" %4.1f cycles", (double)lut_cycles / SPO2_SETS);
+#endif
+    // The table evaluates each 1/128-wide R bin at its centre
+    printf("  %.1f%% of outputs differ, by at most %d  %s\n", 100.0 * differ / SPO2_SETS, worst,
+           worst <= 1 ? "ok" : "FAIL");
+    pass &= worst <= 1;
+
+    int ref_errors = 0;
+    for (size_t i = 0; i < sizeof(ref) / sizeof(ref[0]); i++) {
+        uint8_t spo2 = spo2_lookup(&lut, spo2_ratio_q16(ref[i].red_ac, ref[i].red_dc,
+                                                        ref[i].ir_ac, ref[i].ir_dc));
+        ref_errors += spo2 != ref[i].spo2;
+    }
+    uint32_t hashes[3] = {
+        fnv1a(2166136261u, lut.table, sizeof(lut.table)),
+        fnv1a(2166136261u, quad.table, sizeof(quad.table)),
+        fnv1a(2166136261u, out_lut, SPO2_SETS),
+    };
+    bool hashes_ok = hashes[0] == default_table_hash && hashes[1] == quad_table_hash &&
+                     hashes[2] == sweep_hash;
+    printf("  reference: %d/%d inputs, tables %08lx %08lx, sweep %08lx  %s\n",
+           (int)(sizeof(ref) / sizeof(ref[0])) - ref_errors, (int)(sizeof(ref) / sizeof(ref[0])),
+           (unsigned long)hashes[0], (unsigned long)hashes[1], (unsigned long)hashes[2],
+           (ref_errors == 0 && hashes_ok) ? "ok" : "FAIL");
+    pass &= ref_errors == 0 && hashes_ok;
+
+    free(sets);
+    free(out_float);
+    free(out_lut);
+    return pass;
+}
+
+// sensor_buffer_t before stream_window: one ring, every statistic rescans
+typedef struct {
+    uint32_t red[LEGACY_BUFFER_SIZE];
+    uint32_t ir[LEGACY_BUFFER_SIZE];
+    int head;
+    int count;
+} legacy_buffer_t;
+
+static void legacy_add(legacy_buffer_t *b, uint32_t red, uint32_t ir) {
+    b->red[b->head] = red;
+    b->ir[b->head] = ir;
+    b->head = (b->head + 1) % LEGACY_BUFFER_SIZE;
+    if (b->count < LEGACY_BUFFER_SIZE) {
+        b->count++;
+    }
+}
+
+static uint32_t legacy_mean(const legacy_buffer_t *b, const uint32_t *data, int window) {
+    if (b->count < window) return 0;
+
+    uint64_t sum = 0;
+    int start = (b->head - window + LEGACY_BUFFER_SIZE) % LEGACY_BUFFER_SIZE;
+    for (int i = 0; i < window; i++) {
+        sum += data[(start + i) % LEGACY_BUFFER_SIZE];
+    }
+    return (uint32_t)(sum / window);
+}
+
+static uint32_t legacy_p2p(const legacy_buffer_t *b, const uint32_t *data, int window) {
+    uint32_t max = 0, min = UINT32_MAX;
+    int start = (b->head - window + LEGACY_BUFFER_SIZE) % LEGACY_BUFFER_SIZE;
+    for (int i = 0; i < window; i++) {
+        uint32_t v = data[(start + i) % LEGACY_BUFFER_SIZE];
+        if (v > max) max = v;
+        if (v < min) min = v;
+    }
+    return max - min;
+}
+
+// Window statistics the pipeline takes per sample: with dc_only, the
+// 20-sample DC mean before the band-pass and the SpO2 AC/DC once per
+// result period, as max30102.c did when stream_window went in; otherwise
+// today's, the IR mean and peak-to-peak every sample for the SQI.
+// Returns a checksum of every statistic read.
+static uint64_t window_legacy(const uint32_t *red, const uint32_t *ir, int count, bool dc_only) {
+    legacy_buffer_t *b = calloc(1, sizeof(*b));
+    uint64_t check = 0;
+
+    for (int i = 0; i < count; i++) {
+        legacy_add(b, red[i], ir[i]);
+        if (b->count < PPG_SPO2_WINDOW) {
+            continue;
+        }
+        if (dc_only) {
+            check += legacy_mean(b, b->ir, WINDOW_DC);
+        } else {
+            check += legacy_mean(b, b->ir, PPG_SPO2_WINDOW) + legacy_p2p(b, b->ir, PPG_SPO2_WINDOW);
+        }
+        if (i % PPG_SPO2_WINDOW == 0) {
+            check += legacy_mean(b, b->red, PPG_SPO2_WINDOW) + legacy_mean(b, b->ir, PPG_SPO2_WINDOW) +
+                     legacy_p2p(b, b->red, PPG_SPO2_WINDOW) + legacy_p2p(b, b->ir, PPG_SPO2_WINDOW);
+        }
+    }
+    free(b);
+    return check;
+}
+
+static uint64_t window_stream(const uint32_t *red, const uint32_t *ir, int count, bool dc_only) {
+    stream_window_t *w = malloc(3 * sizeof(*w));
+    uint64_t check = 0;
+
+    stream_window_init(&w[0], PPG_SPO2_WINDOW, true);
+    stream_window_init(&w[1], PPG_SPO2_WINDOW, true);
+    stream_window_init(&w[2], WINDOW_DC, false);
+    for (int i = 0; i < count; i++) {
+        stream_window_push(&w[0], red[i]);
+        stream_window_push(&w[1], ir[i]);
+        if (dc_only) {
+            stream_window_push(&w[2], ir[i]);
+        }
+        if (!stream_window_full(&w[1])) {
+            continue;
+        }
+        if (dc_only) {
+            check += stream_window_mean(&w[2]);
+        } else {
+            check += stream_window_mean(&w[1]) + stream_window_max(&w[1]) - stream_window_min(&w[1]);
+        }
+        if (i % PPG_SPO2_WINDOW == 0) {
+            check += stream_window_mean(&w[0]) + stream_window_mean(&w[1]) +
+                     stream_window_max(&w[0]) - stream_window_min(&w[0]) +
+                     stream_window_max(&w[1]) - stream_window_min(&w[1]);
+        }
+    }
+    free(w);
+    return check;
+}
+
+// Cycles per sample where the TSC is available, ns otherwise
+static double time_window(uint64_t (*run)(const uint32_t *, const uint32_t *, int, bool),
+                          const uint32_t *red, const uint32_t *ir, bool dc_only, uint64_t *check) {
+#ifdef HAVE_CYCLES
+    uint64_t start = __rdtsc();
+    *check = run(red, ir, WINDOW_SAMPLES, dc_only);
+    return (double)(__rdtsc() - start) / WINDOW_SAMPLES;
+#else
+    double start = now_seconds();
+    *check = run(red, ir, WINDOW_SAMPLES, dc_only);
+    return (now_seconds() - start) / WINDOW_SAMPLES * 1e9;
+#endif
+}
+
+// stream_window against a naive rescan of the same samples for every
+// length, through random pushes, resets and gain rescales; values are drawn
+// from a narrow band half the time so the min/max deques see ties
+static int window_rescan_errors(void) {
+    uint32_t *hist = malloc(WINDOW_CHECK * sizeof(uint32_t));
+    uint32_t rng = SYNTH_SEED;
+    int errors = 0;
+
+    for (uint32_t length = 1; length <= STREAM_WINDOW_CAPACITY; length++) {
+        stream_window_t w;
+        uint32_t held = 0;
+
+        stream_window_init(&w, length, true);
+        for (int op = 0; op < WINDOW_CHECK; op++) {
+            uint32_t r = bench_rng(&rng);
+            if (r % 500 == 0) {
+                stream_window_reset(&w);
+                held = 0;
+                continue;
+            }
+            uint32_t n = held < length ? held : length;
+            if (r % 300 == 1) {
+                float gain = 0.5f + (float)(bench_rng(&rng) % 1500) / 1000.0f;
+                stream_window_rescale(&w, gain);
+                for (uint32_t i = held - n; i < held; i++) {
+                    hist[i] = (uint32_t)lroundf((float)hist[i] * gain);
+                }
+                continue;
+            }
+            uint32_t v = bench_rng(&rng);
+            v = (r & 1) ? v % (ADC_FULL_SCALE + 1) : 100000 + v % 8;
+            stream_window_push(&w, v);
+            hist[held++] = v;
+
+            n = held < length ? held : length;
+            uint64_t sum = 0;
+            uint32_t max = 0, min = UINT32_MAX;
+            for (uint32_t i = held - n; i < held; i++) {
+                sum += hist[i];
+                max = hist[i] > max ? hist[i] : max;
+                min = hist[i] < min ? hist[i] : min;
+            }
+            uint32_t mean = (n == length) ? (uint32_t)(sum / length) : 0;
+            errors += w.count != n || w.sum != sum || stream_window_mean(&w) != mean ||
+                      stream_window_max(&w) != max || stream_window_min(&w) != min;
+        }
+    }
+    free(hist);
+    return errors;
+}
+
+// Window statistics per sample, sensor_buffer_t rescans against
+// stream_window over the same trace, then the rescan equivalence check
+static bool bench_window(void) {
+    static const struct { const char *name; bool dc_only; } loads[] = {
+        { "DC mean + SpO2 per period", true },
+        { "SQI mean + p2p per sample", false },
+    };
+#ifdef HAVE_CYCLES
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+    uint32_t *red = malloc(WINDOW_SAMPLES * sizeof(uint32_t));
+    uint32_t *ir = malloc(WINDOW_SAMPLES * sizeof(uint32_t));
+    ppg_synth_t synth;
+    bool pass = true;
+
+    ppg_synth_init(&synth, 72, 97, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, WINDOW_SAMPLES);
+
+    for (size_t c = 0; c < sizeof(loads) / sizeof(loads[0]); c++) {
+        uint64_t legacy_check, stream_check;
+        double legacy = time_window(window_legacy, red, ir, loads[c].dc_only, &legacy_check);
+        double stream = time_window(window_stream, red, ir, loads[c].dc_only, &stream_check);
+        bool match = legacy_check == stream_check;
+        printf("  %-26s rescan %6.1f  stream_window %6.1f %s/sample  outputs %s  %s\n",
+               loads[c].name, legacy, stream, unit, match ? "match" : "differ",
+               match ? "ok" : "FAIL");
+        pass &= match;
+    }
+
+    int errors = window_rescan_errors();
+    printf("  naive rescan, lengths 1-%d x %d operations: %d mismatches  %s\n",
+           STREAM_WINDOW_CAPACITY, WINDOW_CHECK, errors, errors == 0 ? "ok" : "FAIL");
+    pass &= errors == 0;
+
+    free(red);
+    free(ir);
+    return pass;
+}
+
+// IR stage ahead of detect_beat(): the raw sample minus its 20-sample
+// mean, by rescan (before stream_window) or stream_window (before the
+// band-pass), or ppg_filter. Runs in FIFO bursts like ppg_dsp_process().
+typedef enum {
+    DC_STAGE_RESCAN,
+    DC_STAGE_WINDOW,
+    DC_STAGE_BANDPASS,
+} dc_stage_t;
+
+static void dc_stage_run(dc_stage_t stage, const uint32_t *ir, float *out, int count) {
+    legacy_buffer_t *b = calloc(1, sizeof(*b));
+    stream_window_t w;
+    ppg_filter_t f;
+
+    stream_window_init(&w, WINDOW_DC, false);
+    ppg_filter_init(&f, PPG_DSP_SAMPLE_RATE);
+    for (int done = 0; done < count; done += BLOCK_SAMPLES) {
+        int n = (count - done < BLOCK_SAMPLES) ? (count - done) : BLOCK_SAMPLES;
+
+        if (stage == DC_STAGE_BANDPASS) {
+            ppg_filter_process(&f, &ir[done], &out[done], n);
+            continue;
+        }
+        for (int i = done; i < done + n; i++) {
+            uint32_t dc;
+            if (stage == DC_STAGE_RESCAN) {
+                legacy_add(b, 0, ir[i]);
+                dc = legacy_mean(b, b->ir, WINDOW_DC);
+            } else {
+                stream_window_push(&w, ir[i]);
+                dc = stream_window_mean(&w);
+            }
+            out[i] = dc ? (float)((int32_t)ir[i] - (int32_t)dc) : 0.0f;
+        }
+    }
+    free(b);
+}
+
+// RMS gain for a sine of 'hz' riding on the synthetic IR DC, after the
+// stage has settled
+static double dc_stage_gain(dc_stage_t stage, double hz) {
+    const int count = FILTER_TONE_SECONDS * PPG_DSP_SAMPLE_RATE;
+    const int settle = count / 2;
+    uint32_t *ir = malloc(count * sizeof(uint32_t));
+    float *out = malloc(count * sizeof(float));
+    double energy = 0.0;
+
+    for (int i = 0; i < count; i++) {
+        ir[i] = (uint32_t)lround(PPG_SYNTH_IR_DC +
+                                 FILTER_TONE_AMP * sin(2 * M_PI * hz * i / PPG_DSP_SAMPLE_RATE));
+    }
+    dc_stage_run(stage, ir, out, count);
+    for (int i = settle; i < count; i++) {
+        energy += (double)out[i] * out[i];
+    }
+
+    free(ir);
+    free(out);
+    return sqrt(energy / (count - settle)) / (FILTER_TONE_AMP / sqrt(2.0));
+}
+
+// Cost per sample of each stage over the same trace, then its response to
+// respiration, the pulse and out-of-band noise. Only the band-pass is held
+// to the response limits; remove_dc is printed for comparison.
+static bool bench_filter(void) {
+    static const struct { const char *name; dc_stage_t stage; } stages[] = {
+        { "remove_dc, rescan", DC_STAGE_RESCAN },
+        { "remove_dc, stream_window", DC_STAGE_WINDOW },
+        { "ppg_filter band-pass", DC_STAGE_BANDPASS },
+    };
+#ifdef HAVE_CYCLES
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+    uint32_t *red = malloc(WINDOW_SAMPLES * sizeof(uint32_t));
+    uint32_t *ir = malloc(WINDOW_SAMPLES * sizeof(uint32_t));
+    float *out = malloc(WINDOW_SAMPLES * sizeof(float));
+    ppg_synth_t synth;
+    bool pass = true;
+
+    ppg_synth_init(&synth, 72, 97, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, WINDOW_SAMPLES);
+
+    for (size_t c = 0; c < sizeof(stages) / sizeof(stages[0]); c++) {
+#ifdef HAVE_CYCLES
+        uint64_t start = __rdtsc();
+        dc_stage_run(stages[c].stage, ir, out, WINDOW_SAMPLES);
+        double cost = (double)(__rdtsc() - start) / WINDOW_SAMPLES;
+#else
+        double start = now_seconds();
+        dc_stage_run(stages[c].stage, ir, out, WINDOW_SAMPLES);
+        double cost = (now_seconds() - start) / WINDOW_SAMPLES * 1e9;
+#endif
+        double resp = dc_stage_gain(stages[c].stage, FILTER_RESP_HZ);
+        double pulse = dc_stage_gain(stages[c].stage, FILTER_PULSE_HZ);
+        double noise = dc_stage_gain(stages[c].stage, FILTER_NOISE_HZ);
+        printf("  %-25s %6.1f %s/sample  gain %.1fHz %.2f  %.1fHz %.2f  %.0fHz %.2f",
+               stages[c].name, cost, unit, FILTER_RESP_HZ, resp, FILTER_PULSE_HZ, pulse,
+               FILTER_NOISE_HZ, noise);
+        if (stages[c].stage == DC_STAGE_BANDPASS) {
+            bool ok = resp <= FILTER_MAX_STOP && noise <= FILTER_MAX_STOP &&
+                      fabs(pulse - 1.0) <= FILTER_MAX_RIPPLE;
+            printf("  %s", ok ? "ok" : "FAIL");
+            pass &= ok;
+        }
+        printf("\n");
+    }
+
+    free(red);
+    free(ir);
+    free(out);
+    return pass;
+}
+
+// Results of one run, reduced to a hash of everything but their time
+typedef struct {
+    uint32_t hash;
+    int results;
+    int readings;
+    double hr_sum;
+} source_digest_t;
+
+static void on_source_result(const ppg_result_t *result, void *ctx) {
+    source_digest_t *d = ctx;
+    const uint8_t v[] = {
+        result->heart_rate, result->spo2, result->finger, result->quality, result->motion,
+        (uint8_t)result->beat_count,
+    };
+
+    d->hash = fnv1a(d->hash, v, sizeof(v));
+    d->results++;
+    if (result->heart_rate > 0) {
+        d->readings++;
+        d->hr_sum += result->heart_rate;
+    }
+}
+
+static void source_dsp_init(ppg_dsp_t *dsp, uint32_t rate, source_digest_t *d) {
+    ppg_dsp_config_t cfg = {
+        .hr_engine = HR_ENGINE_PEAK,
+        .spo2_cal = SPO2_CAL_DEFAULT,
+        .on_result = on_source_result,
+        .ctx = d,
+        .input_rate = rate,
+    };
+
+    memset(d, 0, sizeof(*d));
+    d->hash = 2166136261u;
+    ppg_dsp_init(dsp, &cfg);
+}
+
+typedef struct {
+    int bursts;
+    int min_burst;
+    int max_burst;
+    uint32_t samples;
+    uint32_t lost;
+} source_run_t;
+
+// The acquisition and processing tasks reduced to one thread: wait,
+// pending, ppg_source_read, ppg_source_unpack, ppg_source_process. Time
+// comes from the shim's tick count. Stops after `samples` samples or
+// once the source stops producing.
+static bool source_run(const ppg_source_t *src, uint32_t samples, source_digest_t *d,
+                       source_run_t *run) {
+    static ppg_dsp_t dsp;
+    static const uint8_t led_pa[2] = { PPG_AGC_PA_DEFAULT, PPG_AGC_PA_DEFAULT };
+    uint8_t buf[PPG_FIFO_DEPTH * PPG_SOURCE_BYTES_PER_SAMPLE];
+    uint32_t red[PPG_FIFO_DEPTH];
+    uint32_t ir[PPG_FIFO_DEPTH];
+    uint32_t gap = 0;
+    int idle = 0;
+
+    memset(run, 0, sizeof(*run));
+    run->min_burst = PPG_FIFO_DEPTH;
+    if (src->ops->open(src->ctx) != ESP_OK) {
+        return false;
+    }
+    source_dsp_init(&dsp, src->ops->sample_rate(src->ctx), d);
+
+    while (run->samples < samples && idle < SOURCE_MAX_IDLE) {
+        src->ops->wait(src->ctx);
+
+        ppg_source_burst_t burst = { 0 };
+        if (src->ops->pending(src->ctx, &burst) != ESP_OK) {
+            burst.count = 0;
+            burst.lost = 0;
+        }
+        gap += burst.lost;
+        if (burst.count == 0) {
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        int count;
+        if (ppg_source_read(src, &burst, buf, &count) != ESP_OK) {
+            continue;
+        }
+        ppg_source_unpack(buf, count, red, ir);
+        int64_t t_us = ppg_source_is_real_time(src) ?
+                       (int64_t)xTaskGetTickCount() * portTICK_PERIOD_MS * 1000 : -1;
+        ppg_source_process(&dsp, red, ir, count, gap, t_us, led_pa);
+
+        run->bursts++;
+        run->min_burst = (count < run->min_burst) ? count : run->min_burst;
+        run->max_burst = (count > run->max_burst) ? count : run->max_burst;
+        run->samples += count;
+        run->lost += gap;
+        gap = 0;
+    }
+    src->ops->close(src->ctx);
+    return true;
+}
+
+// The same samples straight into ppg_dsp_process(), with `gap_len` lost
+// after the first `gap_at`
+static uint32_t source_reference(const uint32_t *red, const uint32_t *ir, uint32_t count,
+                                 uint32_t gap_at, uint32_t gap_len) {
+    static ppg_dsp_t dsp;
+    source_digest_t d;
+
+    source_dsp_init(&dsp, PPG_DSP_SAMPLE_RATE, &d);
+    for (uint32_t done = 0; done < count; ) {
+        uint32_t n = (count - done < BLOCK_SAMPLES) ? (count - done) : BLOCK_SAMPLES;
+        if (gap_len > 0 && done < gap_at && done + n > gap_at) {
+            n = gap_at - done;
+        }
+        if (gap_len > 0 && done == gap_at) {
+            ppg_dsp_gap(&dsp, gap_len);
+        }
+        ppg_dsp_process(&dsp, &red[done], &ir[done], (int)n);
+        done += n;
+    }
+    return d.hash;
+}
+
+static bool write_csv(const char *path, const uint32_t *red, const uint32_t *ir, int count) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fprintf(f, "red,ir\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%lu,%lu\n", (unsigned long)red[i], (unsigned long)ir[i]);
+    }
+    return fclose(f) == 0;
+}
+
+// PPGR recording in BLOCK_SAMPLES frames, as ppg_recorder writes it, with
+// frame `drop` missing as if the recorder had dropped it
+static bool write_recording(const char *path, const uint32_t *red, const uint32_t *ir, int count,
+                            int drop) {
+    static uint8_t block[PPG_RECORDER_BLOCK_SIZE];
+    uint8_t sector[PPG_RECORDER_SECTOR_SIZE] = { 0 };
+    ppg_rec_header_t header = {
+        .magic = PPG_REC_MAGIC,
+        .version = PPG_REC_VERSION,
+        .header_size = PPG_RECORDER_SECTOR_SIZE,
+        .block_size = PPG_RECORDER_BLOCK_SIZE,
+        .sample_rate = PPG_DSP_SAMPLE_RATE,
+    };
+    FILE *f = fopen(path, "wb");
+    size_t pos = 0;
+
+    if (f == NULL) {
+        return false;
+    }
+    fwrite(sector, sizeof(sector), 1, f);
+    memset(block, 0, sizeof(block));
+
+    for (int first = 0, frame = 0; first < count; first += BLOCK_SAMPLES, frame++) {
+        int n = (count - first < BLOCK_SAMPLES) ? (count - first) : BLOCK_SAMPLES;
+        size_t len = sizeof(ppg_rec_frame_t) + n * PPG_REC_BYTES_PER_SAMPLE;
+
+        if (frame == drop) {
+            header.lost_samples += n;
+            header.gaps++;
+            continue;
+        }
+        if (pos + len > sizeof(block)) {
+            fwrite(block, sizeof(block), 1, f);
+            header.blocks++;
+            memset(block, 0, sizeof(block));
+            pos = 0;
+        }
+
+        ppg_rec_frame_t hdr = {
+            .count = (uint16_t)n,
+            .red_pa = PPG_AGC_PA_DEFAULT,
+            .ir_pa = PPG_AGC_PA_DEFAULT,
+            .first_index = (uint32_t)first,
+            .t_us = (int64_t)(first + n) * 1000000 / PPG_DSP_SAMPLE_RATE,
+        };
+        memcpy(&block[pos], &hdr, sizeof(hdr));
+        pos += sizeof(hdr);
+        for (int i = first; i < first + n; i++) {
+            ppg_source_pack(&block[pos], red[i], ir[i]);
+            pos += PPG_REC_BYTES_PER_SAMPLE;
+        }
+        header.samples += n;
+    }
+    if (pos > 0) {
+        fwrite(block, sizeof(block), 1, f);
+        header.blocks++;
+    }
+
+    memcpy(sector, &header, sizeof(header));
+    fseek(f, 0, SEEK_SET);
+    fwrite(sector, sizeof(sector), 1, f);
+    return fclose(f) == 0;
+}
+
+static bool source_case(const char *name, const ppg_source_t *src, const uint32_t *red,
+                        const uint32_t *ir, uint32_t gap_at, uint32_t gap_len) {
+    source_digest_t d;
+    source_run_t run;
+
+    if (!source_run(src, SOURCE_SECONDS * PPG_DSP_SAMPLE_RATE, &d, &run)) {
+        printf("  %-22s open failed  FAIL\n", name);
+        return false;
+    }
+    uint32_t ref = source_reference(red, ir, run.samples, gap_at, run.lost ? gap_len : 0);
+    bool pass = d.hash == ref && run.lost == gap_len && d.readings > 0;
+    printf("  %-22s %4d bursts of %2d-%2d, %5lu samples, %2lu lost, %3d readings HR %5.1f, "
+           "results %s direct ppg_dsp  %s\n",
+           name, run.bursts, run.min_burst, run.max_burst, (unsigned long)run.samples,
+           (unsigned long)run.lost, d.readings, d.readings ? d.hr_sum / d.readings : 0.0,
+           d.hash == ref ? "match" : "differ from", pass ? "ok" : "FAIL");
+    return pass;
+}
+
+// Replay and synth backends through the firmware's read, unpack and DSP
+// feed, against the same samples fed to ppg_dsp directly. The host tick
+// count is simulated, so paced runs repeat exactly too.
+static bool bench_source(void) {
+    // Sources stop on a burst boundary, up to a FIFO past the run
+    const int count = SOURCE_SECONDS * PPG_DSP_SAMPLE_RATE;
+    const int generated = count + PPG_FIFO_DEPTH;
+    uint32_t *red = malloc(generated * sizeof(uint32_t));
+    uint32_t *ir = malloc(generated * sizeof(uint32_t));
+    uint32_t *gap_red = malloc(count * sizeof(uint32_t));
+    uint32_t *gap_ir = malloc(count * sizeof(uint32_t));
+    char csv_path[] = "/tmp/ppg_bench_XXXXXX";
+    char rec_path[] = "/tmp/ppg_bench_XXXXXX";
+    const uint32_t gap_at = SOURCE_DROP_FRAME * BLOCK_SAMPLES;
+    ppg_synth_t synth;
+    bool pass = true;
+
+    ppg_synth_init(&synth, SOURCE_HR, SOURCE_SPO2, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, generated);
+
+    pass &= source_case("synth, flat out", ppg_source_synth(SOURCE_HR, SOURCE_SPO2, SYNTH_SEED, 0),
+                        red, ir, 0, 0);
+    pass &= source_case("synth, real time", ppg_source_synth(SOURCE_HR, SOURCE_SPO2, SYNTH_SEED, 1),
+                        red, ir, 0, 0);
+
+    int csv_fd = mkstemp(csv_path);
+    int rec_fd = mkstemp(rec_path);
+    if (csv_fd < 0 || rec_fd < 0) {
+        printf("  cannot create replay files  FAIL\n");
+        pass = false;
+    } else {
+        close(csv_fd);
+        close(rec_fd);
+        pass &= write_csv(csv_path, red, ir, count);
+        pass &= source_case("replay CSV, flat out", ppg_source_replay(csv_path, false, 0),
+                            red, ir, 0, 0);
+
+        // The reference sees the samples that remain, with the gap where the frame was
+        memcpy(gap_red, red, gap_at * sizeof(uint32_t));
+        memcpy(gap_ir, ir, gap_at * sizeof(uint32_t));
+        memcpy(&gap_red[gap_at], &red[gap_at + BLOCK_SAMPLES], (count - gap_at - BLOCK_SAMPLES) * sizeof(uint32_t));
+        memcpy(&gap_ir[gap_at], &ir[gap_at + BLOCK_SAMPLES], (count - gap_at - BLOCK_SAMPLES) * sizeof(uint32_t));
+        pass &= write_recording(rec_path, red, ir, count, SOURCE_DROP_FRAME);
+        pass &= source_case("replay PPGR, real time", ppg_source_replay(rec_path, false, 1),
+                            gap_red, gap_ir, gap_at, BLOCK_SAMPLES);
+    }
+    if (csv_fd >= 0) {
+        unlink(csv_path);
+    }
+    if (rec_fd >= 0) {
+        unlink(rec_path);
+    }
+
+    free(red);
+    free(ir);
+    free(gap_red);
+    free(gap_ir);
+    return pass;
+}
+
+// Closed loop: a finger whose reflectance is `scale` times the synthetic
+// default, read at the LED current the AGC asks for, one block of latency
+// between a decision and the samples that reflect it (as in the acquisition task)
+static void bench_agc(double scale, bool use_agc) {
+    const int count = SYNTH_SECONDS * PPG_DSP_SAMPLE_RATE;
+    bench_run_t *run = malloc(sizeof(*run));
+    ppg_synth_t synth;
+    ppg_agc_t agc;
+    uint8_t applied[2] = { PPG_AGC_PA_DEFAULT, PPG_AGC_PA_DEFAULT };
+
+    run_init(run, HR_ENGINE_PEAK, 72, 97, PPG_DSP_SAMPLE_RATE);
+    ppg_synth_init(&synth, 72, 97, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_agc_init(&agc);
+
+    for (int done = 0; done < count; done += BLOCK_SAMPLES) {
+        uint32_t red[BLOCK_SAMPLES];
+        uint32_t ir[BLOCK_SAMPLES];
+        uint8_t block_pa[2] = { applied[0], applied[1] };
+
+        ppg_synth_generate(&synth, red, ir, BLOCK_SAMPLES);
+        for (int i = 0; i < BLOCK_SAMPLES; i++) {
+            double r = red[i] * scale * block_pa[PPG_AGC_RED] / PPG_AGC_PA_DEFAULT;
+            double x = ir[i] * scale * block_pa[PPG_AGC_IR] / PPG_AGC_PA_DEFAULT;
+            red[i] = (uint32_t)(r > ADC_FULL_SCALE ? ADC_FULL_SCALE : r);
+            ir[i] = (uint32_t)(x > ADC_FULL_SCALE ? ADC_FULL_SCALE : x);
+        }
+
+        ppg_dsp_set_led(&run->dsp, block_pa);
+        ppg_dsp_process(&run->dsp, red, ir, BLOCK_SAMPLES);
+        if (use_agc) {
+            ppg_agc_update(&agc, red, ir, BLOCK_SAMPLES, block_pa);
+            applied[0] = agc.pa[0];
+            applied[1] = agc.pa[1];
+        }
+    }
+
+    printf("  reflectance x%.2f %-7s", scale, use_agc ? "AGC" : "fixed");
+    if (run->stats.readings == 0) {
+        printf("  no reading\n");
+    } else {
+        printf("  first %5.1fs  HR err %5.1f  SpO2 err %4.1f  LED red 0x%02X ir 0x%02X  (%lu steps)\n",
+               run->stats.first_ms / 1000.0, run->stats.hr_err / run->stats.readings,
+               run->stats.spo2_err / run->stats.readings, applied[0], applied[1],
+               (unsigned long)agc.steps);
+    }
+    free(run);
+}
+
+// Sensor-rate trace through the decimator; cycles are per input sample, and
+// the load figure assumes one host cycle per target cycle, so treat it as a
+// ratio between rates rather than an ESP32 measurement
+static void bench_rate(uint32_t rate) {
+    const int count = SYNTH_SECONDS * rate;
+    uint32_t *red = malloc(count * sizeof(uint32_t));
+    uint32_t *ir = malloc(count * sizeof(uint32_t));
+    ppg_synth_t synth;
+
+    ppg_synth_init(&synth, 72, 97, rate, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, count);
+
+    static const hr_engine_t engines[] = { HR_ENGINE_PEAK, HR_ENGINE_AUTOCORR };
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        bench_run_t *run = malloc(sizeof(*run));
+        run_init(run, engines[e], 72, 97, rate);
+        run_trace(run, red, ir, count);
+        print_run(engines[e] == HR_ENGINE_PEAK ? "peak" : "autocorr", run, count);
+#ifdef HAVE_CYCLES
+        printf("  %-8s %5.2f%% of a %.0f MHz core at %luHz\n", "",
+               100.0 * run->cycles / SYNTH_SECONDS / TARGET_CPU_HZ, TARGET_CPU_HZ / 1e6,
+               (unsigned long)rate);
+#endif
+        free(run);
+    }
+
+    free(red);
+    free(ir);
+}
+
+// Beat times against a known rate. The sensor clock runs `skew` fast
+// relative to esp_timer, bursts are anchored with read latency and jitter,
+// and the synthetic beats are perfectly regular in sensor samples, so the
+// true interval is exact and any spread, and any RMSSD the HRV ring
+// reports, is timing error. Unanchored is a control run: it shows the
+// skew the anchors remove and is not scored.
+static bool bench_timing(double hr, double skew, bool anchored) {
+    const int count = SYNTH_SECONDS * TIMING_RATE;
+    const double period_us = 1e6 / TIMING_RATE / (1.0 + skew);
+    const double true_rr_us = 60e6 / hr / (1.0 + skew);
+    ppg_dsp_t *dsp = malloc(sizeof(*dsp));
+    ppg_synth_t synth;
+    uint32_t rng = SYNTH_SEED;
+    ppg_dsp_config_t cfg = {
+        .hr_engine = HR_ENGINE_PEAK,
+        .spo2_cal = SPO2_CAL_DEFAULT,
+        .input_rate = TIMING_RATE,
+    };
+
+    ppg_dsp_init(dsp, &cfg);
+    ppg_synth_init(&synth, hr, 97, TIMING_RATE, SYNTH_SEED);
+
+    double last_beat = 0;
+    int intervals = 0;
+    double sum = 0, sum_sq = 0;
+    bool settled = false;
+    for (int done = 0; done + BLOCK_SAMPLES <= count; done += BLOCK_SAMPLES) {
+        uint32_t red[BLOCK_SAMPLES];
+        uint32_t ir[BLOCK_SAMPLES];
+        ppg_synth_generate(&synth, red, ir, BLOCK_SAMPLES);
+
+        if (anchored) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            uint64_t last = done + BLOCK_SAMPLES - 1;
+            int64_t t_us = (int64_t)(last * period_us) + TIMING_LATENCY_US + rng % TIMING_JITTER_US;
+            ppg_dsp_anchor(dsp, last, t_us);
+        }
+        ppg_dsp_process(dsp, red, ir, BLOCK_SAMPLES);
+
+        // Skip the first seconds: filter settling and clock fit
+        if (!settled && done > TIMING_SETTLE_S * TIMING_RATE) {
+            ppg_dsp_reset_hrv(dsp);
+            settled = true;
+        }
+        if (dsp->beat_count > 0 && dsp->last_beat_us != last_beat) {
+            if (last_beat > 0 && done > TIMING_SETTLE_S * TIMING_RATE) {
+                double err = dsp->last_beat_us - last_beat - true_rr_us;
+                sum += err;
+                sum_sq += err * err;
+                intervals++;
+            }
+            last_beat = dsp->last_beat_us;
+        }
+    }
+    hrv_metrics_t hrv;
+    hrv_get(&dsp->hrv, &hrv);
+    free(dsp);
+
+    double mean = intervals ? sum / intervals : 0;
+    double sd = intervals > 1 ? sqrt((sum_sq - sum * mean) / (intervals - 1)) : 0;
+    bool pass = intervals > 0 && fabs(mean) < TIMING_MAX_MEAN_US && sd < TIMING_MAX_SD_US &&
+                hrv.intervals >= HRV_MIN_INTERVALS && hrv.rmssd_ms < TIMING_MAX_RMSSD_MS;
+    printf("  HR %5.1f  clock %+4.1f%%  %-8s  interval error mean %+8.1f us  SD %6.1f us  (%d)"
+           "  RMSSD %4.2f ms  %s\n",
+           hr * (1.0 + skew), skew * 100, anchored ? "anchored" : "nominal", mean, sd, intervals,
+           hrv.rmssd_ms, !anchored ? "control" : pass ? "ok" : "FAIL");
+    return pass;
+}
+
+// Samples lost part way through a trace. The synthetic pulse is strictly
+// periodic, so every beat time should sit on the grid of the first beat
+// after settling (a beat may fall into the gap). Marked with ppg_dsp_gap()
+// the timeline keeps true time and the phase error stays at the jitter
+// level; unmarked, every beat after the gap is stamped `lost` too early.
+// Unmarked is a control run and is not scored. Beats in the second after
+// the gap are skipped: the filter is settling on the bridged step.
+static bool bench_gap(uint32_t lost_ms, bool marked) {
+    const uint32_t rate = TIMING_RATE;
+    const int count = SYNTH_SECONDS * rate;
+    const int start = GAP_START_S * rate;
+    const uint32_t lost = lost_ms * rate / 1000;
+    const double rr_us = 60e6 / 72;
+    uint32_t *red = malloc(count * sizeof(uint32_t));
+    uint32_t *ir = malloc(count * sizeof(uint32_t));
+    ppg_dsp_t *dsp = malloc(sizeof(*dsp));
+    ppg_synth_t synth;
+    ppg_dsp_config_t cfg = {
+        .hr_engine = HR_ENGINE_PEAK,
+        .spo2_cal = SPO2_CAL_DEFAULT,
+        .input_rate = rate,
+    };
+
+    ppg_synth_init(&synth, 72, 97, rate, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, count);
+    ppg_dsp_init(dsp, &cfg);
+
+    const int settle_end = start + lost + GAP_SETTLE_S * rate;
+    double grid = 0;
+    double last_beat = 0;
+    double max_err = 0;
+    uint32_t hrv_before = 0;
+    for (int done = 0; done < count; ) {
+        if (done == start) {
+            hrv_before = dsp->hrv.accepted;
+            if (marked) {
+                ppg_dsp_gap(dsp, lost);
+            }
+            done += lost;
+            continue;
+        }
+        int n = (count - done < BLOCK_SAMPLES) ? (count - done) : BLOCK_SAMPLES;
+        if (done < start && done + n > start) {
+            n = start - done;
+        }
+        ppg_dsp_process(dsp, &red[done], &ir[done], n);
+        done += n;
+
+        if (dsp->beat_count > 0 && dsp->last_beat_us != last_beat) {
+            last_beat = dsp->last_beat_us;
+            if (done < 10 * (int)rate || (done > start && done < settle_end)) {
+                continue;
+            }
+            if (grid == 0) {
+                grid = last_beat;
+            }
+            double d = last_beat - grid;
+            double err = fabs(d - round(d / rr_us) * rr_us);
+            if (err > max_err) {
+                max_err = err;
+            }
+        }
+    }
+
+    bool pass = max_err < GAP_MAX_ERR_US && dsp->hrv.accepted > hrv_before;
+    printf("  %4lums gap %-8s  worst beat phase error %7.1f ms  HRV intervals %lu -> %lu  %s\n",
+           (unsigned long)lost_ms, marked ? "marked" : "unmarked", max_err / 1000.0,
+           (unsigned long)hrv_before, (unsigned long)dsp->hrv.accepted,
+           !marked ? "control" : pass ? "ok" : "FAIL");
+
+    free(dsp);
+    free(red);
+    free(ir);
+    return pass;
+}
+
+// Readings around an injected motion artifact
+typedef struct {
+    uint32_t motion_first_ms;       // First result flagged as motion
+    int motion_results;
+    int leaked;                     // Non-zero readings during the artifact
+    uint32_t resume_ms;             // First non-zero reading after it
+    double hr_err;                  // After it
+    int readings;
+} motion_stats_t;
+
+static void on_motion_result(const ppg_result_t *result, void *ctx) {
+    motion_stats_t *m = ctx;
+    const uint32_t start_ms = MOTION_START_S * 1000;
+    const uint32_t end_ms = (MOTION_START_S + MOTION_SECONDS) * 1000;
+
+    if (result->motion) {
+        if (m->motion_results++ == 0) {
+            m->motion_first_ms = result->time_ms;
+        }
+    }
+    if (result->heart_rate == 0 || result->time_ms < start_ms) {
+        return;
+    }
+    if (result->time_ms < end_ms) {
+        m->leaked++;
+    } else {
+        if (m->resume_ms == 0) {
+            m->resume_ms = result->time_ms;
+        }
+        m->hr_err += fabs(result->heart_rate - 72.0);
+        m->readings++;
+    }
+}
+
+// Finger sliding on the sensor part way through a clean 72 BPM trace: the
+// stay-still flag must come up, no reading may leak out of the artifact and
+// readings must resume once it is over
+static bool bench_motion(void) {
+    const int count = SYNTH_SECONDS * PPG_DSP_SAMPLE_RATE;
+    const int start = MOTION_START_S * PPG_DSP_SAMPLE_RATE;
+    const int end = (MOTION_START_S + MOTION_SECONDS) * PPG_DSP_SAMPLE_RATE;
+    uint32_t *red = malloc(count * sizeof(uint32_t));
+    uint32_t *ir = malloc(count * sizeof(uint32_t));
+    ppg_dsp_t *dsp = malloc(sizeof(*dsp));
+    ppg_synth_t synth;
+    motion_stats_t m = { 0 };
+    ppg_dsp_config_t cfg = {
+        .hr_engine = HR_ENGINE_PEAK,
+        .spo2_cal = SPO2_CAL_DEFAULT,
+        .on_result = on_motion_result,
+        .ctx = &m,
+        .input_rate = PPG_DSP_SAMPLE_RATE,
+    };
+
+    ppg_synth_init(&synth, 72, 97, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_synth_generate(&synth, red, ir, count);
+    for (int i = start; i < end; i++) {
+        double t = (double)(i - start) / PPG_DSP_SAMPLE_RATE;
+        double swing = 1.0 + MOTION_DC * sin(2.0 * M_PI * MOTION_HZ * t);
+        red[i] = (uint32_t)(red[i] * swing);
+        ir[i] = (uint32_t)(ir[i] * swing);
+    }
+
+    ppg_dsp_init(dsp, &cfg);
+    for (int done = 0; done < count; done += BLOCK_SAMPLES) {
+        int n = (count - done < BLOCK_SAMPLES) ? (count - done) : BLOCK_SAMPLES;
+        ppg_dsp_process(dsp, &red[done], &ir[done], n);
+    }
+
+    uint32_t resume_s = m.resume_ms / 1000;
+    bool pass = m.motion_results > 0 && m.leaked == 0 && m.resume_ms > 0 &&
+                resume_s < MOTION_START_S + MOTION_SECONDS + MOTION_RECOVER_S;
+    printf("  artifact %d-%ds: motion flagged at %5.1fs (%d results), %d leaked, resumed at %5.1fs",
+           MOTION_START_S, MOTION_START_S + MOTION_SECONDS, m.motion_first_ms / 1000.0,
+           m.motion_results, m.leaked, m.resume_ms / 1000.0);
+    if (m.readings > 0) {
+        printf(", HR err %4.1f after", m.hr_err / m.readings);
+    }
+    printf("  %s\n", pass ? "ok" : "FAIL");
+
+    free(dsp);
+    free(red);
+    free(ir);
+    return pass;
+}
+
+// Waveform stream as ble_server sends it: batches of up to WAVE_FLUSH_SAMPLES
+// (the default flush latency), each in one notification of at most MTU - 3
+// bytes. Compares notification bytes of 3-byte samples (0xF4) with packed
+// ones (0xF5), times the packer and checks every packet decodes exactly, or
+// to within half a step when drop low bits are dropped.
+static bool bench_wavepack(const uint32_t *ir, int count, uint16_t mtu, uint8_t drop) {
+    const size_t payload_cap = mtu - 3 - WAVE_HEADER_LEN;
+    const int raw_per_packet = (int)(payload_cap / 3) < WAVE_FLUSH_SAMPLES ?
+                               (int)(payload_cap / 3) : WAVE_FLUSH_SAMPLES;
+    uint8_t payload[512];
+    uint32_t decoded[256];
+    ppg_wavepack_t w;
+    size_t packed_bytes = 0;
+    int packed_packets = 0;
+    int errors = 0;
+    const uint32_t max_error = drop ? 1u << (drop - 1) : 0;
+    double encode_s = 0;
+#ifdef HAVE_CYCLES
+    uint64_t encode_cycles = 0;
+#endif
+
+    for (int done = 0; done < count; ) {
+        double start = now_seconds();
+#ifdef HAVE_CYCLES
+        uint64_t start_cycles = __rdtsc();
+#endif
+        ppg_wavepack_init(&w, payload, payload_cap, drop);
+        int n = 0;
+        while (done + n < count && n < WAVE_FLUSH_SAMPLES && ppg_wavepack_add(&w, ir[done + n])) {
+            n++;
+        }
+        size_t len = ppg_wavepack_finish(&w);
+#ifdef HAVE_CYCLES
+        encode_cycles += __rdtsc() - start_cycles;
+#endif
+        encode_s += now_seconds() - start;
+
+        if (!ppg_wavepack_decode(payload, len, n, decoded)) {
+            errors++;
+        }
+        for (int i = 0; i < n; i++) {
+            int64_t error = (int64_t)decoded[i] - ir[done + i];
+            if (error > max_error || -error > max_error) {
+                errors++;
+                break;
+            }
+        }
+        packed_bytes += WAVE_HEADER_LEN + len;
+        packed_packets++;
+        done += n;
+    }
+
+    int raw_packets = (count + raw_per_packet - 1) / raw_per_packet;
+    size_t raw_bytes = (size_t)raw_packets * WAVE_HEADER_LEN + (size_t)count * 3;
+    size_t sample_bytes = packed_bytes - (size_t)packed_packets * WAVE_HEADER_LEN;
+
+    printf("  MTU %3u  drop %u  3-byte %6.2f B/sample (%4d pkts)  packed %5.2f B/sample (%4d pkts)"
+           "  samples %4.2fx  on air %4.2fx  encode %5.1f ns/sample",
+           mtu, drop, (double)raw_bytes / count, raw_packets, (double)packed_bytes / count,
+           packed_packets, 3.0 * count / sample_bytes, (double)raw_bytes / packed_bytes,
+           encode_s / count * 1e9);
+#ifdef HAVE_CYCLES
+    printf(" %4.0f cycles", (double)encode_cycles / count);
+#endif
+    printf("  %s\n", errors ? "FAIL" : "ok");
+    return errors == 0;
+}
+
+// Burst as handed from acquisition to processing: sequence number and a
+// payload derived from it, so a torn or reordered slot shows up
+typedef struct {
+    uint32_t seq;
+    uint16_t count;
+    uint8_t data[32 * 6];
+} ring_burst_t;
+
+typedef struct {
+    ppg_ring_t ring;
+    ring_burst_t slots[RING_SLOTS];
+} ring_bench_t;
+
+static void *ring_producer(void *arg) {
+    ring_bench_t *rb = arg;
+
+    for (uint32_t seq = 0; seq < RING_BURSTS; seq++) {
+        // Each refused claim counts as an overrun; yield so a single CPU
+        // host still makes progress
+        ring_burst_t *b;
+        while ((b = ppg_ring_claim(&rb->ring)) == NULL) {
+            sched_yield();
+        }
+        b->seq = seq;
+        b->count = 1 + seq % 32;
+        for (int i = 0; i < b->count * 6; i++) {
+            b->data[i] = (uint8_t)(seq + i);
+        }
+        ppg_ring_publish(&rb->ring);
+    }
+    return NULL;
+}
+
+// Producer and consumer on two threads, free running: every burst must
+// arrive once, in order and intact
+static bool bench_ring(void) {
+    ring_bench_t *rb = calloc(1, sizeof(*rb));
+    pthread_t producer;
+    uint32_t expect = 0;
+    uint32_t errors = 0;
+
+    ppg_ring_init(&rb->ring, rb->slots, sizeof(ring_burst_t), RING_SLOTS);
+    double start = now_seconds();
+    pthread_create(&producer, NULL, ring_producer, rb);
+
+    while (expect < RING_BURSTS) {
+        const ring_burst_t *b = ppg_ring_peek(&rb->ring);
+        if (b == NULL) {
+            sched_yield();
+            continue;
+        }
+        bool ok = b->seq == expect && b->count == 1 + expect % 32;
+        for (int i = 0; ok && i < b->count * 6; i++) {
+            ok = b->data[i] == (uint8_t)(expect + i);
+        }
+        errors += !ok;
+        expect++;
+        ppg_ring_release(&rb->ring);
+    }
+    pthread_join(producer, NULL);
+    double elapsed = now_seconds() - start;
+
+    bool pass = errors == 0 && ppg_ring_count(&rb->ring) == 0;
+    printf("  %d bursts through %d slots: %.1f Mbursts/s, high water %lu, %lu full claims, "
+           "%lu corrupt  %s\n", RING_BURSTS, RING_SLOTS, RING_BURSTS / elapsed / 1e6,
+           (unsigned long)rb->ring.high_water, (unsigned long)rb->ring.overruns,
+           (unsigned long)errors, pass ? "ok" : "FAIL");
+
+    free(rb);
+    return pass;
+}
+
+// MAX30102 FIFO register model, rollover off: a full FIFO keeps its 32
+// samples and counts new ones in OVF_COUNTER (saturating); popping a sample
+// clears the counter. Each sample holds its timeline index.
+typedef struct {
+    uint32_t slot[PPG_FIFO_DEPTH];
+    uint8_t wr_ptr;
+    uint8_t rd_ptr;
+    uint8_t ovf;
+    int used;                   // WR_PTR == RD_PTR is empty or full; the chip knows which
+    uint32_t next;              // Timeline index of the next sample taken
+} fifo_sim_t;
+
+static void fifo_sim_take(fifo_sim_t *f, int n) {
+    for (int i = 0; i < n; i++, f->next++) {
+        if (f->used == PPG_FIFO_DEPTH) {
+            if (f->ovf < PPG_FIFO_OVF_MAX) {
+                f->ovf++;
+            }
+            continue;
+        }
+        f->slot[f->wr_ptr] = f->next;
+        f->wr_ptr = (f->wr_ptr + 1) & PPG_FIFO_PTR_MASK;
+        f->used++;
+    }
+}
+
+// Burst read of count samples that pops only `pop` of them; the bytes
+// returned are the count samples from RD_PTR on regardless
+static void fifo_sim_read(fifo_sim_t *f, uint32_t *out, int count, int pop) {
+    for (int i = 0; i < count; i++) {
+        out[i] = f->slot[(f->rd_ptr + i) & PPG_FIFO_PTR_MASK];
+    }
+    if (pop > f->used) {
+        pop = f->used;
+    }
+    if (pop > 0) {
+        f->ovf = 0;
+    }
+    f->rd_ptr = (f->rd_ptr + pop) & PPG_FIFO_PTR_MASK;
+    f->used -= pop;
+}
+
+// One acquisition round: samples taken while the task waited, then how the
+// burst read goes
+typedef struct {
+    int take;
+    int unpopped;               // Returned but left in the FIFO (read popped fewer)
+    bool start_fails;           // Transfer refused, nothing popped
+    bool fails;                 // Bus error after the samples were popped
+} fifo_step_t;
+
+// Runs the script FIFO_ROUNDS times through ppg_fifo as the acquisition task
+// does (lost samples become a gap before the next good burst, duplicates are
+// dropped), then drains. Every delivered sample must sit at its timeline
+// index, and the timeline must end where the sensor did.
+static bool bench_fifo(const char *name, const fifo_step_t *script, int steps) {
+    const int64_t period_us = 1000000 / TIMING_RATE;
+    fifo_sim_t sim = { 0 };
+    ppg_fifo_t fifo;
+    uint32_t data[PPG_FIFO_DEPTH];
+    uint32_t index = 0;         // Timeline index of the next delivered sample
+    uint32_t gap = 0;
+    uint32_t delivered = 0;
+    uint32_t duplicates = 0;
+    uint32_t misplaced = 0;
+    int64_t now_us = 0;
+    const int total = steps * FIFO_ROUNDS + 2;
+
+    ppg_fifo_reset(&fifo, TIMING_RATE);
+    for (int r = 0; r < total; r++) {
+        // Two clean rounds at the end drain what is left
+        static const fifo_step_t drain = { .take = 0 };
+        const fifo_step_t *step = (r < total - 2) ? &script[r % steps] : &drain;
+
+        fifo_sim_take(&sim, step->take);
+        now_us += step->take * period_us;
+
+        ppg_fifo_regs_t regs = { sim.wr_ptr, sim.ovf, sim.rd_ptr };
+        ppg_fifo_burst_t burst;
+        ppg_fifo_status(&fifo, &regs, now_us, &burst);
+        gap += burst.lost;
+        if (burst.count == 0) {
+            continue;
+        }
+
+        ppg_fifo_read_start(&fifo, burst.count, !step->start_fails);
+        if (step->start_fails) {
+            continue;
+        }
+        fifo_sim_read(&sim, data, burst.count, burst.count - step->unpopped);
+        ppg_fifo_read_done(&fifo, !step->fails);
+        if (step->fails) {
+            continue;
+        }
+
+        index += gap;
+        gap = 0;
+        for (int i = burst.duplicates; i < burst.count; i++) {
+            misplaced += data[i] != index;
+            index++;
+        }
+        delivered += burst.count - burst.duplicates;
+        duplicates += burst.duplicates;
+    }
+
+    bool pass = misplaced == 0 && index + gap == sim.next && sim.used == 0;
+    printf("  %-28s %7lu taken  %7lu delivered  %6lu lost  %5lu duplicates  %lu misplaced,"
+           " timeline %+ld  %s\n", name, (unsigned long)sim.next, (unsigned long)delivered,
+           (unsigned long)(sim.next - delivered), (unsigned long)duplicates,
+           (unsigned long)misplaced, (long)(index + gap) - (long)sim.next, pass ? "ok" : "FAIL");
+    return pass;
+}
+
+static bool bench_fifo_all(void) {
+    // Burst sizes that are not a divisor of 32: pointers wrap mid-burst
+    static const fifo_step_t wrap[] = {
+        { .take = 17 }, { .take = 13 }, { .take = 31 }, { .take = 1 }, { .take = 9 },
+    };
+    // 40 into an empty FIFO: 8 counted exactly. 300: OVF_COUNTER saturates
+    // and the loss comes from the time since the last snapshot
+    static const fifo_step_t overflow[] = {
+        { .take = 17 }, { .take = 40 }, { .take = 17 }, { .take = 300 }, { .take = 5 },
+    };
+    // Nothing popped, then exactly full: WR_PTR == RD_PTR without overflow
+    static const fifo_step_t short_read[] = {
+        { .take = 17 }, { .take = 17, .unpopped = 3 }, { .take = 17 },
+        { .take = 20, .unpopped = 20 }, { .take = 12, .unpopped = 1 },
+    };
+    static const fifo_step_t failed[] = {
+        { .take = 17 }, { .take = 17, .fails = true }, { .take = 17 },
+        { .take = 17, .start_fails = true }, { .take = 17 },
+        { .take = 25, .unpopped = 4, .fails = true },
+    };
+    static const struct {
+        const char *name;
+        const fifo_step_t *script;
+        int steps;
+    } cases[] = {
+        { "pointer wrap", wrap, sizeof(wrap) / sizeof(wrap[0]) },
+        { "overflow, rollover off", overflow, sizeof(overflow) / sizeof(overflow[0]) },
+        { "read pops fewer", short_read, sizeof(short_read) / sizeof(short_read[0]) },
+        { "failed reads", failed, sizeof(failed) / sizeof(failed[0]) },
+    };
+    bool pass = true;
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        pass &= bench_fifo(cases[c].name, cases[c].script, cases[c].steps);
+    }
+    return pass;
+}
+
+static int load_csv(const char *path, uint32_t **red, uint32_t **ir) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    int cap = 4096;
+    int count = 0;
+    *red = malloc(cap * sizeof(uint32_t));
+    *ir = malloc(cap * sizeof(uint32_t));
+
+    char line[128];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long r, i;
+        if (sscanf(line, "%lu,%lu", &r, &i) != 2) {
+            continue;   // Header or comment
+        }
+        if (count == cap) {
+            cap *= 2;
+            *red = realloc(*red, cap * sizeof(uint32_t));
+            *ir = realloc(*ir, cap * sizeof(uint32_t));
+        }
+        (*red)[count] = (uint32_t)r;
+        (*ir)[count] = (uint32_t)i;
+        count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    uint32_t *red;
+    uint32_t *ir;
+
+    if (argc > 1) {
+        int count = load_csv(argv[1], &red, &ir);
+        if (count <= 0) {
+            return 1;
+        }
+        printf("%s: %d samples (%.1fs)\n", argv[1], count, (double)count / PPG_DSP_SAMPLE_RATE);
+        bench(red, ir, count, 0, 0);
+        printf("waveform packing, IR\n");
+        bool pack_ok = true;
+        for (uint8_t drop = 0; drop <= PPG_WAVEPACK_MAX_DROP; drop++) {
+            pack_ok &= bench_wavepack(ir, count, 23, drop);
+            pack_ok &= bench_wavepack(ir, count, 247, drop);
+        }
+        free(red);
+        free(ir);
+        return pack_ok ? 0 : 1;
+    }
+
+    static const struct { double hr; double spo2; } cases[] = {
+        { 50, 98 }, { 72, 97 }, { 95, 94 }, { 120, 92 }, { 150, 90 },
+    };
+    const int count = SYNTH_SECONDS * PPG_DSP_SAMPLE_RATE;
+
+    red = malloc(count * sizeof(uint32_t));
+    ir = malloc(count * sizeof(uint32_t));
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        printf("synthetic HR %.0f SpO2 %.0f, %ds\n", cases[c].hr, cases[c].spo2, SYNTH_SECONDS);
+        ppg_synth_t synth;
+        ppg_synth_init(&synth, cases[c].hr, cases[c].spo2, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+        ppg_synth_generate(&synth, red, ir, count);
+        bench(red, ir, count, cases[c].hr, cases[c].spo2);
+    }
+
+    printf("sliding windows, synthetic HR 72 SpO2 97, %d samples\n", WINDOW_SAMPLES);
+    bool window_ok = bench_window();
+
+    printf("IR stage before beat detection, synthetic HR 72 SpO2 97, %d samples\n", WINDOW_SAMPLES);
+    bool filter_ok = bench_filter();
+
+    printf("SpO2 evaluation, %d AC/DC sets\n", SPO2_SETS);
+    bool spo2_ok = bench_spo2();
+
+    // Synthetic noise is uniform over PPG_SYNTH_NOISE counts, which alone
+    // needs ~7.2 bits per sample: a pessimistic trace for a lossless packer
+    ppg_synth_t wave_synth;
+    ppg_synth_init(&wave_synth, 72, 97, PPG_DSP_SAMPLE_RATE, SYNTH_SEED);
+    ppg_synth_generate(&wave_synth, red, ir, count);
+    printf("waveform packing, synthetic IR HR 72 (5%% perfusion), %ds\n", SYNTH_SECONDS);
+    bool pack_ok = true;
+    for (uint8_t drop = 0; drop <= PPG_WAVEPACK_MAX_DROP; drop++) {
+        pack_ok &= bench_wavepack(ir, count, 23, drop);
+        pack_ok &= bench_wavepack(ir, count, 247, drop);
+    }
+
+    // Same trace, AC and noise scaled to a typical finger (1.25% perfusion)
+    for (int i = 0; i < count; i++) {
+        ir[i] = (uint32_t)(PPG_SYNTH_IR_DC + ((double)ir[i] - PPG_SYNTH_IR_DC) / 4);
+    }
+    printf("waveform packing, synthetic IR HR 72 (1.25%% perfusion), %ds\n", SYNTH_SECONDS);
+    for (uint8_t drop = 0; drop <= PPG_WAVEPACK_MAX_DROP; drop++) {
+        pack_ok &= bench_wavepack(ir, count, 23, drop);
+        pack_ok &= bench_wavepack(ir, count, 247, drop);
+    }
+
+    free(red);
+    free(ir);
+
+    static const uint32_t rates[] = { 200, 400, 800 };
+    for (size_t c = 0; c < sizeof(rates) / sizeof(rates[0]); c++) {
+        printf("sensor rate %luHz -> %dHz, synthetic HR 72 SpO2 97, %ds\n",
+               (unsigned long)rates[c], PPG_DSP_SAMPLE_RATE, SYNTH_SECONDS);
+        bench_rate(rates[c]);
+    }
+
+    // Unanchored with a skewed clock is the control: it shows the skew the
+    // anchors remove
+    static const double timing_hr[] = { 40, 50, 72, 100, 150 };
+    static const double timing_skew[] = { -0.02, 0.0, 0.02 };
+    bool timing_ok = true;
+    printf("beat timing at %dHz, %ds\n", TIMING_RATE, SYNTH_SECONDS);
+    for (size_t h = 0; h < sizeof(timing_hr) / sizeof(timing_hr[0]); h++) {
+        for (size_t k = 0; k < sizeof(timing_skew) / sizeof(timing_skew[0]); k++) {
+            timing_ok &= bench_timing(timing_hr[h], timing_skew[k], true);
+        }
+    }
+    bench_timing(72, 0.02, false);
+
+    // Unmarked is the control: it shows what the gap markers prevent
+    static const uint32_t gap_ms[] = { 50, 150, 2000 };
+    bool gap_ok = true;
+    printf("timeline gaps at %dHz, synthetic HR 72, %ds\n", TIMING_RATE, SYNTH_SECONDS);
+    for (size_t g = 0; g < sizeof(gap_ms) / sizeof(gap_ms[0]); g++) {
+        gap_ok &= bench_gap(gap_ms[g], true);
+    }
+    bench_gap(150, false);
+
+    printf("motion gating, synthetic HR 72 SpO2 97, %ds\n", SYNTH_SECONDS);
+    bool motion_ok = bench_motion();
+
+    static const double reflectance[] = { 0.15, 0.3, 0.5, 1.0, 1.6, 2.5, 4.0 };
+    printf("LED AGC, synthetic HR 72 SpO2 97, %ds\n", SYNTH_SECONDS);
+    for (size_t c = 0; c < sizeof(reflectance) / sizeof(reflectance[0]); c++) {
+        bench_agc(reflectance[c], false);
+        bench_agc(reflectance[c], true);
+    }
+
+    printf("sample ring, two threads\n");
+    bool ring_ok = bench_ring();
+
+    printf("FIFO bookkeeping, simulated MAX30102 at %dHz, %d rounds each\n", TIMING_RATE, FIFO_ROUNDS);
+    bool fifo_ok = bench_fifo_all();
+
+    printf("PPG sources through the firmware block path, synthetic HR %d SpO2 %d, %ds\n",
+           SOURCE_HR, SOURCE_SPO2, SOURCE_SECONDS);
+    bool source_ok = bench_source();
+    return (window_ok && filter_ok && spo2_ok && timing_ok && gap_ok && motion_ok && pack_ok && ring_ok && fifo_ok && source_ok) ? 0 : 1;
+}